@@ -21,9 +21,8 @@
 #ifndef INCLUDED_LIMERFE_H
 #define INCLUDED_LIMERFE_H
 
-#include <limeRFE.h>
+#include <gnuradio/block.h>
 #include <limesdr/api.h>
-#include <iostream>
 #include <string>
 
 namespace gr {
@@ -34,20 +33,37 @@ namespace limesdr {
  * \ingroup limesdr
  *
  */
-class LIMESDR_API rfe
+class LIMESDR_API rfe : virtual public gr::block
 {
 public:
-    rfe(int comm_type,
-        std::string device,
-        std::string config_file,
-        char IDRX,
-        char IDTX,
-        char PortRX,
-        char PortTX,
-        char Mode,
-        char Notch,
-        char Atten);
-    ~rfe();
+    typedef boost::shared_ptr<rfe> sptr;
+    /*!
+     * @brief Return a shared_ptr to a new instance of rfe.
+     *
+     * Board settings are written by a background thread: attenuation and notch changes
+     * return at once, pending changes are merged into a single board update and changes
+     * equal to the board state are skipped. Result of each board update is published on
+     * "status" message port as dict with keys command, error, message, mode, attenuation,
+     * notch and merged (number of requests applied by the update).
+     *
+     * @param comm_type Communication: direct USB(0), SDR GPIO(1).
+     *
+     * @param device USB COM port or SDR device serial.
+     *
+     * @param config_file LimeRFE .ini configuration file, empty to use the settings below.
+     *
+     * @return a new limesdr rfe block object
+     */
+    static sptr make(int comm_type,
+                     std::string device,
+                     std::string config_file,
+                     char IDRX,
+                     char IDTX,
+                     char PortRX,
+                     char PortTX,
+                     char Mode,
+                     char Notch,
+                     char Atten);
     /**
      * Change LimeRFE Mode
      *
@@ -55,7 +71,7 @@ public:
      *
      * @return 0 on success, other on failure (see LimeRFE error codes)
      */
-    int change_mode(int mode);
+    virtual int change_mode(int mode) = 0;
     /**
      * Enable or disbale fan
      *
@@ -63,59 +79,65 @@ public:
      *
      * @return 0 on success, other on failure (see LimeRFE error codes)
      */
-    int set_fan(int enable);
+    virtual int set_fan(int enable) = 0;
     /**
-     * Set RX Attenuation value
+     * Set RX Attenuation value. Board is updated in background, see make.
      *
      * @param   attenuation  Specifies the attenuation in the RX path. Attenuation [dB] =
      * 2 * attenuation. Value range: [0,7]
      *
-     * @return 0 on success, other on failure (see LimeRFE error codes)
+     * @return 0 when queued, -1 on invalid value
      */
-    int set_attenuation(int attenuation);
+    virtual int set_attenuation(int attenuation) = 0;
     /**
-     * Enable or disable AM/FM notch filter
+     * Enable or disable AM/FM notch filter. Board is updated in background, see make.
      *
      * @param   enable notch state: 0 - disable; 1 - enable
      *
      * @note Notch filter is only possible up to HAM 430-440 MHz, or Wideband 1-1000 MHz
-     * @return 0 on success, other on failure (see LimeRFE error codes)
+     * @return 0 when queued, -1 when not possible for RX channel
      */
-    int set_notch(int enable);
-
-private:
-    rfe_dev_t* rfe_dev = nullptr;
-    rfe_boardState boardState = { RFE_CID_WB_1000,
-                                  RFE_CID_WB_1000,
-                                  RFE_PORT_1,
-                                  RFE_PORT_1,
-                                  RFE_MODE_NONE,
-                                  RFE_NOTCH_OFF,
-                                  0,
-                                  0,
-                                  0 };
-    int sdr_device_num = 0;
-
-    void print_error(int error);
-
-    void get_board_state()
-    {
-        rfe_boardState currentState = { 0 };
-        if (RFE_GetState(rfe_dev, &currentState) != 0) {
-            std::cout << "LimeRFE: failed to get board state" << std::endl;
-            return;
-        }
-
-        std::cout << "LimeRFE: RX channel: " << (int)currentState.channelIDRX << std::endl;
-        std::cout << "LimeRFE: TX channel: " << (int)currentState.channelIDTX << std::endl;
-        std::cout << "LimeRFE: PortRX: " << (int)currentState.selPortRX << std::endl;
-        std::cout << "LimeRFE: PortTx: " << (int)currentState.selPortTX << std::endl;
-        std::cout << "LimeRFE: Mode: " << (int)currentState.mode << std::endl;
-        std::cout << "LimeRFE: Notch: " << (int)currentState.notchOnOff << std::endl;
-        std::cout << "LimeRFE: Attenuation: " << (int)currentState.attValue << std::endl;
-        std::cout << "LimeRFE: Enable SWR: " << (int)currentState.enableSWR << std::endl;
-        std::cout << "LimeRFE: SourceSWR: " << (int)currentState.sourceSWR << std::endl;
-    }
+    virtual int set_notch(int enable) = 0;
+    /**
+     * Switch mode by bursts of LimeSDR sink on the same device: TX guard_time before each
+     * burst and back to RX guard_time after it. Bursts are set by length tags (and tx_time
+     * tags) of the sink input. Only available with SDR communication.
+     *
+     * @param   enable  TDD switching: 0 - disable; 1 - enable.
+     *
+     * @param   guard_time  Time in seconds board is in TX mode before and after a burst.
+     *
+     * @return 0 on success, -1 on failure
+     */
+    virtual int set_tdd(int enable, double guard_time = 0.0005) = 0;
+    /**
+     * Measure forward and reflected power every interval on a background thread and
+     * publish them on "measurement" message port as dict with keys time (UTC seconds and
+     * fraction), forward_adc, reflected_adc, forward_db, return_loss, swr, mode, fan and
+     * tx_cutoff. Power is relative to detector output at ADC code 0, return loss and SWR
+     * are absolute.
+     *
+     * @param   enable  Measurement: 0 - disable; 1 - enable.
+     *
+     * @param   interval  Measurement interval in seconds.
+     *
+     * @param   swr_source  SWR measured on external coupler(0) or cellular channel(1).
+     *
+     * @param   swr_threshold  SWR above which board is switched to RX and kept out of TX
+     *                         until clear_tx_cutoff, 0 disables cut-off.
+     *
+     * @return 0 on success, -1 on failure
+     */
+    virtual int set_measurement(int enable,
+                                double interval = 0.1,
+                                int swr_source = 0,
+                                double swr_threshold = 0) = 0;
+    /**
+     * Allow TX mode again after SWR cut-off.
+     *
+     * @return 0 on success, -1 on failure
+     */
+    virtual int clear_tx_cutoff() = 0;
 };
 
 } // namespace limesdr
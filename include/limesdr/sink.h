@@ -23,6 +23,7 @@
 
 #include <gnuradio/block.h>
 #include <limesdr/api.h>
+#include <vector>
 
 namespace gr {
 namespace limesdr {
@@ -55,12 +56,35 @@ class LIMESDR_API sink : virtual public gr::block {
      *
      * @param   freq Frequency to set in Hz
      *
-     * @param   chan Channel (not used)
+     * @param   chan Channel A(0) or B(1). In SISO the channel is tuned with LO. In MIMO both
+     *              channels share LO and are offset from it with their NCO, so channels can
+     *              be tuned independently within NCO range (RF rate minus sample rate, see
+     *              set_oversampling). Frequency 0 makes the channel follow the other
+     *              channel, in SISO it is ignored.
      *
      * @return  actual center frequency
      */
     virtual double set_center_freq(double freq, size_t chan = 0) = 0;
 
+    /**
+     * Precompute LO tuning of frequencies used later (e.g. a hop list). Retunes to
+     * frequencies visited before only rewrite stored synthesizer registers, which is much
+     * faster than full PLL/VCO tuning. Warm-up makes even the first visit fast.
+     *
+     * @param   freqs  LO frequencies in Hz.
+     */
+    virtual void warm_up_tuning(const std::vector<double>& freqs) = 0;
+
+    /**
+     * Print retune time over frequencies with full tuning and with tuning cache.
+     * Should be called before the stream is started.
+     *
+     * @param   freqs  LO frequencies in Hz.
+     *
+     * @param   rounds  Passes over frequency list.
+     */
+    virtual void benchmark_tuning(const std::vector<double>& freqs, int rounds = 10) = 0;
+
     /**
      * Set which antenna is used
      *
@@ -100,6 +124,44 @@ class LIMESDR_API sink : virtual public gr::block {
      * @param   channel  Channel selection: A(LMS_CH_0),B(LMS_CH_1).
      */
     virtual void set_digital_filter(double digital_bandw, int channel) = 0;
+    /**
+     * Upload custom GFIR coefficients and enable the filter, moving channel filtering into
+     * the LMS7002M. GFIRs run at sample rate, GFIR1 and GFIR2 take up to 5 and GFIR3 up to
+     * 15 taps per oversampling step, at most 40 and 120. Digital filter and custom
+     * coefficients share the GFIRs, the setting made last is in effect.
+     *
+     * @param   filter  GFIR1(1), GFIR2(2), GFIR3(3).
+     *
+     * @param   taps  Coefficients in range [-1, 1], empty disables the filter.
+     *
+     * @param   channel  Channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     */
+    virtual void
+    set_gfir_taps(int filter, const std::vector<double>& taps, int channel = 0) = 0;
+    /**
+     * Design lowpass GFIR coefficients (Kaiser window) for current sample rate and upload
+     * them. Filter is designed again when sample rate or oversampling changes. If the
+     * specification needs more taps than available, the longest possible filter is used and
+     * the reached attenuation is printed.
+     *
+     * @param   filter  GFIR1(1), GFIR2(2), GFIR3(3).
+     *
+     * @param   passband  Passband edge in Hz.
+     *
+     * @param   stopband  Stopband edge in Hz, not above half of sample rate.
+     *
+     * @param   ripple  Passband ripple in dB.
+     *
+     * @param   attenuation  Stopband attenuation in dB.
+     *
+     * @param   channel  Channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     */
+    virtual void set_gfir_lowpass(int filter,
+                                  double passband,
+                                  double stopband,
+                                  double ripple = 0.1,
+                                  double attenuation = 60,
+                                  int channel = 0) = 0;
     /**
      * Set the combined gain value in dB
      *
@@ -115,6 +177,9 @@ class LIMESDR_API sink : virtual public gr::block {
     virtual unsigned set_gain(unsigned gain_dB, int channel = 0) = 0;
     /**
      * Set the same sample rate for both channels.
+     * While streaming, the stream is stopped, its FIFO resized for the new rate and started
+     * again internally, without restarting the flowgraph. Time since start used for tx_time
+     * stays continuous across the restart.
      *
      * @param   rate  Sample rate in S/s.
      *
@@ -127,6 +192,19 @@ class LIMESDR_API sink : virtual public gr::block {
      * @param oversample Oversampling value (0 (default),1,2,4,8,16,32).
      */
     virtual void set_oversampling(int oversample) = 0;
+    /**
+     * Choose oversampling automatically for a bandwidth on this and every following sample
+     * rate change. All decimation/interpolation runs on chip so the link carries only the
+     * sample rate, oversampling is the lowest one at which GFIR3 filters the band to
+     * Nyquist with required attenuation, and GFIR3 is set up with that filter. Link budget
+     * of all device streams is printed with a warning when the board interface can not
+     * carry it. Applied at once with current sample rate.
+     *
+     * @param   bandwidth  Occupied bandwidth in Hz, 0 returns to default oversampling.
+     *
+     * @param   attenuation  GFIR stopband attenuation in dB.
+     */
+    virtual void set_rate_plan(double bandwidth, double attenuation = 60) = 0;
     /**
      * Perform device calibration.
      *
@@ -152,6 +230,119 @@ class LIMESDR_API sink : virtual public gr::block {
      * @param   dacVal		   DAC value (0-65535)
      */
      virtual void set_tcxo_dac(uint16_t dacVal = 125 ) = 0;
+
+    /**
+     * Select host time source used for absolute UTC in tx_time tags.
+     * Device timestamp is latched to the time source while streaming and a drift model
+     * is maintained. Until the first latch tags carry time since stream start.
+     *
+     * @param   source  None(0), system clock (PTP disciplined if host runs PTP)(1),
+     *                  PPS on GPIO(2), simulated clock(3).
+     *
+     * @param   param   GPIO pin for PPS source, clock frequency error in ppm for simulated source.
+     */
+    virtual void set_time_source(int source, double param = 0) = 0;
+
+    /**
+     * Placement of internal sample buffers (cyclic waveforms).
+     * At high sample rates hugepages avoid TLB misses and binding keeps buffers on the
+     * socket of the sending thread. Placement report is printed when streaming stops.
+     * Applies to buffers allocated after the call, set it before the flowgraph starts.
+     *
+     * @param   hugepages  Back buffers with 2 MB hugepages: No(0), Yes(1). Reserved pages
+     *                     (vm.nr_hugepages) are used when available, else transparent hugepages.
+     *
+     * @param   numa_node  NUMA node to bind buffers to, -1 for node of the sending thread.
+     */
+    virtual void set_buffer_policy(bool hugepages, int numa_node = -1) = 0;
+    /**
+     * Replay I16 file(s) directly to the device.
+     * Files are memory mapped and sent by a dedicated thread with LMS_SendStream,
+     * bypassing the scheduler and float conversion. Block input is not used while replay
+     * is set. Underruns are counted and reported when replay finishes.
+     * Must be set before flowgraph is started.
+     *
+     * @param   filename_ch0  Interleaved int16 I/Q file for channel A (or selected SISO
+     *                        channel). Empty string disables replay.
+     *
+     * @param   filename_ch1  Interleaved int16 I/Q file for channel B in MIMO mode.
+     *
+     * @param   loop  Repeat file continuously.
+     *
+     * @param   prefetch  Load whole file into memory before start (MAP_POPULATE) and
+     *                    request hugepages for the mapping.
+     */
+    virtual void set_replay(const std::string& filename_ch0,
+                            const std::string& filename_ch1 = "",
+                            bool loop = true,
+                            bool prefetch = false) = 0;
+    /**
+     * Start configuration transaction.
+     * Frequency, antenna, filter, NCO and gain changes are collected until commit and
+     * setters return requested values. Transactions may be nested, only the outermost
+     * commit applies changes.
+     */
+    virtual void begin_config() = 0;
+    /**
+     * Apply changes collected since begin_config under one device lock, each setting once,
+     * in order LO frequency, antenna, analog filter, digital filter, NCO and gain.
+     * "command" message port applies a dict with keys freq, antenna, bandwidth,
+     * digital_filter, nco, gain and optional chan as one transaction.
+     */
+    virtual void commit() = 0;
+    /**
+     * Transmit waveform cyclically.
+     * Waveform is repeated by a dedicated thread without scheduler involvement and block
+     * input is not used. New waveform (from this call, set_cyclic_file or "cyclic" message
+     * port) replaces the current one at the next period boundary.
+     * "cyclic" message port accepts complex vector or PDU, dict with "ch0"/"ch1" complex
+     * vectors, or symbol with path to complex float file.
+     *
+     * @param   waveform_ch0  Waveform for channel A (or both channels in MIMO when
+     *                        waveform_ch1 is empty). Empty waveform stops cyclic mode.
+     *
+     * @param   waveform_ch1  Waveform for channel B in MIMO, same length as waveform_ch0.
+     */
+    virtual void set_cyclic_waveform(const std::vector<gr_complex>& waveform_ch0,
+                                     const std::vector<gr_complex>& waveform_ch1) = 0;
+    /**
+     * Load cyclic waveform from complex float file(s), see set_cyclic_waveform.
+     *
+     * @param   filename_ch0  Waveform file for channel A.
+     *
+     * @param   filename_ch1  Waveform file for channel B in MIMO.
+     */
+    virtual void set_cyclic_file(const std::string& filename_ch0,
+                                 const std::string& filename_ch1 = "") = 0;
+    /**
+     * Use first N input samples as cyclic waveform, see set_cyclic_waveform.
+     * Input is not consumed after capture.
+     *
+     * @param   length  Waveform length in samples.
+     */
+    virtual void set_cyclic_capture(int length) = 0;
+    /**
+     * Publish device health on "telemetry" message port.
+     * Low priority device thread polls chip temperature and reference clock, stream
+     * dropped packet, underrun and overrun totals and FIFO fill are read by the work thread
+     * once per interval. Dict also carries the same for channels of a source block on the
+     * same device.
+     *
+     * @param   interval  Report interval in seconds, 0 disables telemetry.
+     */
+    virtual void set_telemetry(double interval) = 0;
+    /**
+     * Reconnect to device serial when it is unplugged and plugged in again.
+     * When no samples can be sent for timeout seconds and the device does not respond, streams
+     * are released and the device is opened again under its serial as soon as it is
+     * enumerated, with the last sample rate, frequency, antenna, filter and gain settings.
+     * Time to resume is logged. Enables background device enumeration at the same interval.
+     *
+     * @param   enable  Reconnect automatically.
+     *
+     * @param   timeout  Stall before the device is checked and reconnect wait in seconds.
+     */
+    virtual void set_auto_reconnect(bool enable, double timeout = 1) = 0;
 };
 } // namespace limesdr
 } // namespace gr
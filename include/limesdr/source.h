@@ -23,6 +23,7 @@
 
 #include <gnuradio/block.h>
 #include <limesdr/api.h>
+#include <vector>
 
 namespace gr {
 namespace limesdr {
@@ -52,12 +53,35 @@ class LIMESDR_API source : virtual public gr::block {
      *
      * @param   freq Frequency to set in Hz
      *
-     * @param   chan Channel (not used)
+     * @param   chan Channel A(0) or B(1). In SISO the channel is tuned with LO. In MIMO both
+     *              channels share LO and are offset from it with their NCO, so channels can
+     *              be tuned independently within NCO range (RF rate minus sample rate, see
+     *              set_oversampling). Frequency 0 makes the channel follow the other
+     *              channel, in SISO it is ignored.
      * 
      * @return  actual center frequency in Hz
      */
     virtual double set_center_freq(double freq, size_t chan = 0) = 0;
 
+    /**
+     * Precompute LO tuning of frequencies used later (e.g. a hop list). Retunes to
+     * frequencies visited before only rewrite stored synthesizer registers, which is much
+     * faster than full PLL/VCO tuning. Warm-up makes even the first visit fast.
+     *
+     * @param   freqs  LO frequencies in Hz.
+     */
+    virtual void warm_up_tuning(const std::vector<double>& freqs) = 0;
+
+    /**
+     * Print retune time over frequencies with full tuning and with tuning cache.
+     * Should be called before the stream is started.
+     *
+     * @param   freqs  LO frequencies in Hz.
+     *
+     * @param   rounds  Passes over frequency list.
+     */
+    virtual void benchmark_tuning(const std::vector<double>& freqs, int rounds = 10) = 0;
+
     /**
      * Set which antenna is used
      *
@@ -94,6 +118,44 @@ class LIMESDR_API source : virtual public gr::block {
      * @param   channel  Channel selection: A(LMS_CH_0),B(LMS_CH_1).
      */
     virtual void set_digital_filter(double digital_bandw, int channel) = 0;
+    /**
+     * Upload custom GFIR coefficients and enable the filter, moving channel filtering into
+     * the LMS7002M. GFIRs run at sample rate, GFIR1 and GFIR2 take up to 5 and GFIR3 up to
+     * 15 taps per oversampling step, at most 40 and 120. Digital filter and custom
+     * coefficients share the GFIRs, the setting made last is in effect.
+     *
+     * @param   filter  GFIR1(1), GFIR2(2), GFIR3(3).
+     *
+     * @param   taps  Coefficients in range [-1, 1], empty disables the filter.
+     *
+     * @param   channel  Channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     */
+    virtual void
+    set_gfir_taps(int filter, const std::vector<double>& taps, int channel = 0) = 0;
+    /**
+     * Design lowpass GFIR coefficients (Kaiser window) for current sample rate and upload
+     * them. Filter is designed again when sample rate or oversampling changes. If the
+     * specification needs more taps than available, the longest possible filter is used and
+     * the reached attenuation is printed.
+     *
+     * @param   filter  GFIR1(1), GFIR2(2), GFIR3(3).
+     *
+     * @param   passband  Passband edge in Hz.
+     *
+     * @param   stopband  Stopband edge in Hz, not above half of sample rate.
+     *
+     * @param   ripple  Passband ripple in dB.
+     *
+     * @param   attenuation  Stopband attenuation in dB.
+     *
+     * @param   channel  Channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     */
+    virtual void set_gfir_lowpass(int filter,
+                                  double passband,
+                                  double stopband,
+                                  double ripple = 0.1,
+                                  double attenuation = 60,
+                                  int channel = 0) = 0;
     /**
      * Set the combined gain value in dB
      * 
@@ -109,6 +171,9 @@ class LIMESDR_API source : virtual public gr::block {
     virtual unsigned set_gain(unsigned gain_dB, int channel = 0) = 0;
     /**
      * Set the same sample rate for both channels.
+     * While streaming, the stream is stopped, its FIFO resized for the new rate and started
+     * again internally, without restarting the flowgraph. rx_time stays continuous across the
+     * restart and the first sample at the new rate carries rx_time and rx_rate tags.
      *
      * @param   rate  Sample rate in S/s.
      * 
@@ -121,6 +186,19 @@ class LIMESDR_API source : virtual public gr::block {
      * @param oversample Oversampling value (0 (default),1,2,4,8,16,32).
      */
     virtual void set_oversampling(int oversample) = 0;
+    /**
+     * Choose oversampling automatically for a bandwidth on this and every following sample
+     * rate change. All decimation/interpolation runs on chip so the link carries only the
+     * sample rate, oversampling is the lowest one at which GFIR3 filters the band to
+     * Nyquist with required attenuation, and GFIR3 is set up with that filter. Link budget
+     * of all device streams is printed with a warning when the board interface can not
+     * carry it. Applied at once with current sample rate.
+     *
+     * @param   bandwidth  Occupied bandwidth in Hz, 0 returns to default oversampling.
+     *
+     * @param   attenuation  GFIR stopband attenuation in dB.
+     */
+    virtual void set_rate_plan(double bandwidth, double attenuation = 60) = 0;
     /**
      * Perform device calibration.
      *
@@ -146,6 +224,151 @@ class LIMESDR_API source : virtual public gr::block {
      * @param   dacVal		   DAC value (0-65535)
      */
      virtual void set_tcxo_dac(uint16_t dacVal = 125 ) = 0;
+
+    /**
+     * Select host time source used for absolute UTC in rx_time tags.
+     * Device timestamp is latched to the time source while streaming and a drift model
+     * is maintained. Until the first latch tags carry time since stream start.
+     *
+     * @param   source  None(0), system clock (PTP disciplined if host runs PTP)(1),
+     *                  PPS on GPIO(2), simulated clock(3).
+     *
+     * @param   param   GPIO pin for PPS source, clock frequency error in ppm for simulated source.
+     */
+    virtual void set_time_source(int source, double param = 0) = 0;
+
+    /**
+     * Placement of internal sample buffers (recorder ring, trigger buffers).
+     * At high sample rates hugepages avoid TLB misses and binding keeps buffers on the
+     * socket of the receiving thread. Placement report is printed when streaming stops.
+     * Applies to buffers allocated after the call, set it before the flowgraph starts.
+     *
+     * @param   hugepages  Back buffers with 2 MB hugepages: No(0), Yes(1). Reserved pages
+     *                     (vm.nr_hugepages) are used when available, else transparent hugepages.
+     *
+     * @param   numa_node  NUMA node to bind buffers to, -1 for node of the receiving thread.
+     */
+    virtual void set_buffer_policy(bool hugepages, int numa_node = -1) = 0;
+    /**
+     * Record received samples to disk.
+     * Buffers are stored by a dedicated writer thread using O_DIRECT into pre-allocated
+     * files named filename_chN_NNN.ci16, each with .meta file holding device serial, sample
+     * rate, frequency, gain, start timestamp and map of dropped samples.
+     * Samples are stored as interleaved 16 bit I/Q at full scale of the link format (2047 for
+     * the default 12 bit link), so files take half the space of cf32 and hold the received
+     * integer values. IQ correction, when enabled, is applied before storing.
+     * With SigMF metadata files are named filename_chN_NNN.sigmf-data/.sigmf-meta, with new
+     * capture segment on every retune and gap, and annotation for every dropped samples gap.
+     *
+     * @param   filename  Path and name prefix of recording files. Empty string stops recording.
+     *
+     * @param   file_size  File rotation size in bytes, 0 to record into a single file.
+     *
+     * @param   metadata  Metadata format: plain .meta(0), SigMF(1).
+     */
+    virtual void
+    set_recording(const std::string& filename, uint64_t file_size = 0, int metadata = 0) = 0;
+    /**
+     * Produce only triggered captures instead of continuous stream.
+     * Last pre samples are kept in a ring and when sample power crosses threshold on any
+     * channel, or a message arrives on "trigger" port, pre + post samples are produced.
+     * Capture starts with rx_time and burst_len tags, trigger point is tagged with rx_trigger.
+     *
+     * @param   pre  Samples kept before trigger point.
+     *
+     * @param   post  Samples captured from trigger point, 0 disables triggered mode.
+     *
+     * @param   threshold  Power trigger level in dBFS, positive value disables level trigger
+     *                     so only "trigger" messages are used.
+     */
+    virtual void set_trigger(int pre, int post, double threshold = 1) = 0;
+    /**
+     * Detect ADC overload on received samples.
+     * Peak, RMS and clipping are measured in a single pass over each received buffer.
+     * First clipped sample of a buffer is tagged with rx_clip holding clipped sample count,
+     * and per-channel statistics are published on "stats" port as dict with keys channel,
+     * peak, rms, peak_dbfs, rms_dbfs, clipped and samples.
+     *
+     * @param   enable  Enable detector.
+     *
+     * @param   clip_level  I or Q magnitude relative to full scale counted as clipping.
+     *
+     * @param   interval  Statistics publishing interval in seconds.
+     */
+    virtual void
+    set_overload_detector(bool enable, double clip_level = 0.95, double interval = 1) = 0;
+    /**
+     * Start configuration transaction.
+     * Frequency, antenna, filter, NCO and gain changes are collected until commit and
+     * setters return requested values. Transactions may be nested, only the outermost
+     * commit applies changes.
+     */
+    virtual void begin_config() = 0;
+    /**
+     * Apply changes collected since begin_config under one device lock, each setting once,
+     * in order LO frequency, antenna, analog filter, digital filter, NCO and gain. A single
+     * rx_time tag is added at the first sample received after commit.
+     * "command" message port applies a dict with keys freq, antenna, bandwidth,
+     * digital_filter, nco, gain and optional chan as one transaction.
+     */
+    virtual void commit() = 0;
+    /**
+     * Native receive AGC.
+     * Level of every received buffer is passed to a control thread that adjusts gain
+     * (LMS_SetGaindB) towards target level. Each change is tagged with rx_gain at the sample
+     * where it took effect. Gain set with set_gain is used as starting point.
+     *
+     * @param   enable  Enable AGC.
+     *
+     * @param   target  Target RMS level in dBFS.
+     *
+     * @param   attack  Time constant of gain reduction in seconds.
+     *
+     * @param   decay  Time constant of gain increase in seconds.
+     *
+     * @param   hysteresis  Level error in dB tolerated without gain change.
+     */
+    virtual void set_agc(bool enable,
+                         double target = -20,
+                         double attack = 0.001,
+                         double decay = 0.1,
+                         double hysteresis = 3) = 0;
+    /**
+     * Host DC offset and IQ imbalance correction of received samples.
+     * First and second order moments of each buffer are averaged over time_constant and
+     * removed in the receive path, so all outputs, recordings and level measurements see
+     * corrected samples. Estimation starts over on every change of frequency or gain
+     * (also by AGC) and converges within the first buffer. Estimates are cached per
+     * frequency and gain, revisits start from the cached estimate.
+     * Works on top of the chip DC corrector, which may be left enabled.
+     *
+     * @param   enable  Enable correction.
+     *
+     * @param   time_constant  Averaging time in seconds.
+     */
+    virtual void set_iq_correction(bool enable, double time_constant = 0.1) = 0;
+    /**
+     * Publish device health on "telemetry" message port.
+     * Low priority device thread polls chip temperature and reference clock, stream
+     * dropped packet, underrun and overrun totals and FIFO fill come from the status the
+     * work thread reads anyway. Dict also carries the same for channels of a sink block on
+     * the same device.
+     *
+     * @param   interval  Report interval in seconds, 0 disables telemetry.
+     */
+    virtual void set_telemetry(double interval) = 0;
+    /**
+     * Reconnect to device serial when it is unplugged and plugged in again.
+     * When no samples are received for timeout seconds and the device does not respond, streams
+     * are released and the device is opened again under its serial as soon as it is
+     * enumerated, with the last sample rate, frequency, antenna, filter and gain settings.
+     * Time to resume is logged. Enables background device enumeration at the same interval.
+     *
+     * @param   enable  Reconnect automatically.
+     *
+     * @param   timeout  Stall before the device is checked and reconnect wait in seconds.
+     */
+    virtual void set_auto_reconnect(bool enable, double timeout = 1) = 0;
 };
 } // namespace limesdr
 } // namespace gr
@@ -0,0 +1,138 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "agc.h"
+#include "device_handler.h"
+#include <algorithm>
+#include <cmath>
+
+rx_agc::rx_agc(int device_number,
+               int channel,
+               double samp_rate,
+               const agc_settings& settings,
+               unsigned gain)
+    : device_number(device_number),
+      channel(channel),
+      samp_rate(samp_rate),
+      settings(settings),
+      gain(gain),
+      applied_gain(gain) {
+    control_thread = std::thread(&rx_agc::control_loop, this);
+}
+
+rx_agc::~rx_agc() {
+    {
+        std::lock_guard<std::mutex> lock(agc_mutex);
+        running = false;
+    }
+    agc_cv.notify_one();
+    if (control_thread.joinable())
+        control_thread.join();
+}
+
+void rx_agc::update(uint64_t timestamp, uint64_t samples, double power_sum, uint64_t clipped) {
+    {
+        std::lock_guard<std::mutex> lock(agc_mutex);
+        // Gain was written before this buffer was received, later samples carry it
+        if (change_pending) {
+            change_pending = false;
+            settle_timestamp = timestamp + samples;
+            changes.push_back({settle_timestamp, applied_gain});
+        }
+        // Level before the last change took effect does not reflect current gain
+        if (timestamp < settle_timestamp)
+            return;
+        if (level_samples == 0)
+            level_timestamp = timestamp;
+        level_samples += samples;
+        level_power += power_sum;
+        level_clipped += clipped;
+    }
+    agc_cv.notify_one();
+}
+
+bool rx_agc::pop_change(uint64_t timestamp, agc_change& change) {
+    std::lock_guard<std::mutex> lock(agc_mutex);
+    if (changes.empty() || changes.front().timestamp >= timestamp)
+        return false;
+    change = changes.front();
+    changes.pop_front();
+    return true;
+}
+
+void rx_agc::set_settings(const agc_settings& new_settings) {
+    std::lock_guard<std::mutex> lock(agc_mutex);
+    settings = new_settings;
+}
+
+void rx_agc::set_gain(unsigned new_gain) {
+    std::lock_guard<std::mutex> lock(agc_mutex);
+    gain = applied_gain = new_gain;
+    change_pending = false;
+    settle_timestamp = 0;
+    level_samples = 0;
+}
+
+void rx_agc::control_loop() {
+    std::unique_lock<std::mutex> lock(agc_mutex);
+    while (true) {
+        agc_cv.wait(lock, [this] { return !running || level_samples > 0; });
+        if (!running)
+            break;
+
+        uint64_t samples = level_samples;
+        double level_db = 10 * std::log10(level_power / samples + 1e-20);
+        // Clipping hides true level, treat it as full scale so gain drops at attack rate
+        if (level_clipped > 0)
+            level_db = std::max(level_db, 0.0);
+        level_samples = 0;
+        level_power = 0;
+        level_clipped = 0;
+
+        double error = settings.target - level_db;
+        if (std::fabs(error) <= settings.hysteresis)
+            continue;
+
+        // First order loop, time constant depends on direction of change
+        double tau = (error < 0) ? settings.attack : settings.decay;
+        double dt = samples / samp_rate;
+        gain += error * std::min(1.0, dt / std::max(tau, 1e-9));
+        gain = std::max<double>(settings.min_gain, std::min<double>(settings.max_gain, gain));
+
+        unsigned new_gain = (unsigned)std::lround(gain);
+        if (new_gain == applied_gain)
+            continue;
+
+        // Hardware access without holding the lock so work thread is never blocked
+        lock.unlock();
+        device_handler::getInstance().set_agc_gain(device_number, channel, new_gain);
+        lock.lock();
+
+        applied_gain = new_gain;
+        change_pending = true;
+        // Nothing counts until work thread has seen a buffer after the write
+        settle_timestamp = UINT64_MAX;
+        // Levels gathered while writing the gain are stale
+        level_samples = 0;
+        level_power = 0;
+        level_clipped = 0;
+    }
+}
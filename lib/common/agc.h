@@ -0,0 +1,131 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef AGC_H
+#define AGC_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/**
+ * AGC loop settings.
+ */
+struct agc_settings {
+    // Target RMS level in dBFS
+    double target = -20;
+    // Time constants in seconds for gain reduction (attack) and increase (decay)
+    double attack = 0.001;
+    double decay = 0.1;
+    // Level error in dB tolerated without gain change
+    double hysteresis = 3;
+    unsigned min_gain = 0;
+    unsigned max_gain = 73;
+};
+
+/**
+ * Gain applied by AGC and the device timestamp at which it took effect.
+ */
+struct agc_change {
+    uint64_t timestamp;
+    unsigned gain;
+};
+
+/**
+ * Receive AGC. Work thread passes level of each received buffer, control thread adjusts gain
+ * towards target level through device_handler so the configuration cache follows it. Work thread
+ * stamps each change with its own buffer timestamps and queues it for tagging. Buffers received
+ * before the last change took effect are ignored so the loop does not react to stale levels.
+ */
+class rx_agc {
+    private:
+    int device_number;
+    int channel;
+    double samp_rate;
+    agc_settings settings;
+
+    // Gain with fractional part accumulated between integer dB steps
+    double gain;
+    unsigned applied_gain;
+    uint64_t settle_timestamp = 0;
+    // Gain written by control thread, not yet stamped by work thread
+    bool change_pending = false;
+
+    // Level accumulated by work thread since control thread last ran
+    uint64_t level_timestamp = 0;
+    uint64_t level_samples = 0;
+    double level_power = 0;
+    uint64_t level_clipped = 0;
+
+    std::deque<agc_change> changes;
+
+    std::mutex agc_mutex;
+    std::condition_variable agc_cv;
+    std::thread control_thread;
+    bool running = true;
+
+    void control_loop();
+
+    public:
+    /**
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   gain  Gain at start in dB.
+     */
+    rx_agc(int device_number,
+           int channel,
+           double samp_rate,
+           const agc_settings& settings,
+           unsigned gain);
+    ~rx_agc();
+
+    /**
+     * Pass level of received buffer. Called from work thread, never waits for hardware.
+     *
+     * @param   timestamp  Device timestamp of the first sample.
+     *
+     * @param   samples  Sample count.
+     *
+     * @param   power_sum  Sum of |x|^2 over the buffer.
+     *
+     * @param   clipped  Clipped samples in the buffer.
+     */
+    void update(uint64_t timestamp, uint64_t samples, double power_sum, uint64_t clipped);
+
+    /**
+     * Take next applied gain change that took effect before timestamp.
+     *
+     * @return  false if there is none
+     */
+    bool pop_change(uint64_t timestamp, agc_change& change);
+
+    void set_settings(const agc_settings& new_settings);
+
+    /**
+     * Restart loop from externally set gain.
+     */
+    void set_gain(unsigned new_gain);
+};
+
+#endif
@@ -0,0 +1,210 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "buffer_alloc.h"
+#include "logger.h"
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <linux/mempolicy.h>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#define HUGEPAGE_SIZE (2 << 20)
+#define BUFFER_ALIGN 4096
+
+#define BUFFER_HEAP 0
+#define BUFFER_HUGETLB 1
+#define BUFFER_MMAP 2
+
+namespace {
+struct allocation {
+    size_t size;
+    int kind;
+};
+
+// Allocations by address, so buffers are freed the way they were allocated
+std::mutex registry_mutex;
+std::map<void*, allocation> registry;
+
+void bind_node(void* data, size_t size, int node) {
+    unsigned long mask = 1UL << node;
+    if (syscall(SYS_mbind, data, size, MPOL_BIND, &mask, sizeof(mask) * 8, 0) != 0) {
+        log_stream() << "WARNING: buffer_alloc(): binding buffer to NUMA node " << node
+                     << " failed." << std::endl;
+    }
+}
+
+// Transparent hugepage size backing mapping at address, from /proc/self/smaps
+size_t anon_huge_kb(const void* data) {
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    uintptr_t address = reinterpret_cast<uintptr_t>(data);
+    bool inside = false;
+    while (std::getline(smaps, line)) {
+        unsigned long start, end;
+        char dash;
+        std::istringstream range(line);
+        if (line.find(':') > line.find(' ') && (range >> std::hex >> start >> dash >> end) &&
+            dash == '-') {
+            inside = address >= start && address < end;
+        } else if (inside && line.compare(0, 14, "AnonHugePages:") == 0) {
+            return std::strtoul(line.c_str() + 14, nullptr, 10);
+        }
+    }
+    return 0;
+}
+} // namespace
+
+void* buffer_alloc(size_t size, const buffer_policy& policy) {
+    if (size == 0)
+        size = 1;
+    void* data = nullptr;
+    allocation a = {size, BUFFER_HEAP};
+
+    if (policy.hugepages) {
+        a.size = (size + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+        a.kind = BUFFER_HUGETLB;
+        data = mmap(nullptr,
+                    a.size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                    -1,
+                    0);
+        // No reserved hugepages, ask for transparent hugepages instead
+        if (data == MAP_FAILED) {
+            a.kind = BUFFER_MMAP;
+            data = mmap(
+                nullptr, a.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data == MAP_FAILED)
+                return nullptr;
+            madvise(data, a.size, MADV_HUGEPAGE);
+        }
+    } else if (policy.numa_node >= 0) {
+        // Binding works on whole pages, buffer must not share them with other heap data
+        a.size = (size + BUFFER_ALIGN - 1) / BUFFER_ALIGN * BUFFER_ALIGN;
+        a.kind = BUFFER_MMAP;
+        data = mmap(nullptr, a.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED)
+            return nullptr;
+    } else if (posix_memalign(&data, BUFFER_ALIGN, size) != 0) {
+        return nullptr;
+    }
+
+    // Pages are placed when first written, binding only has to be set before that
+    if (policy.numa_node >= 0)
+        bind_node(data, a.size, policy.numa_node);
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry[data] = a;
+    return data;
+}
+
+void buffer_free(void* data) {
+    if (!data)
+        return;
+    allocation a;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        auto it = registry.find(data);
+        if (it == registry.end())
+            return;
+        a = it->second;
+        registry.erase(it);
+    }
+    if (a.kind == BUFFER_HEAP)
+        free(data);
+    else
+        munmap(data, a.size);
+}
+
+void buffer_report(const char* name, const void* data, size_t size) {
+    if (!data || size == 0)
+        return;
+    allocation a = {size, BUFFER_HEAP};
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        auto it = registry.find(const_cast<void*>(data));
+        if (it != registry.end())
+            a = it->second;
+    }
+
+    // Query node of every page, pages not touched yet are reported with -ENOENT
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = reinterpret_cast<uintptr_t>(data) / page * page;
+    size_t count = (reinterpret_cast<uintptr_t>(data) + size - first + page - 1) / page;
+    std::vector<void*> pages(count);
+    std::vector<int> status(count, -1);
+    for (size_t i = 0; i < count; i++)
+        pages[i] = reinterpret_cast<void*>(first + i * page);
+    std::map<int, size_t> nodes;
+    size_t absent = 0;
+    if (syscall(SYS_move_pages, 0, count, pages.data(), nullptr, status.data(), 0) == 0) {
+        for (int node : status) {
+            if (node >= 0)
+                nodes[node]++;
+            else
+                absent++;
+        }
+    }
+
+    log_stream() << "INFO: buffer_report(): " << name << ": " << size / 1024 << " kB";
+    if (a.kind == BUFFER_HUGETLB) {
+        log_stream() << ", 2 MB hugepages";
+    } else {
+        size_t huge_kb = anon_huge_kb(data);
+        if (huge_kb > 0)
+            log_stream() << ", " << huge_kb / 1024 << " MB in transparent hugepages";
+        else
+            log_stream() << ", 4 kB pages";
+    }
+    for (const auto& node : nodes)
+        log_stream() << ", node " << node.first << ": " << 100 * node.second / count << "%";
+    if (absent > 0)
+        log_stream() << ", not present: " << 100 * absent / count << "%";
+    log_stream() << " (thread on node " << current_numa_node() << ")." << std::endl;
+}
+
+void buffer_move_here(void* data, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        auto it = registry.find(data);
+        // Heap buffers may share pages with other data
+        if (it == registry.end() || it->second.kind == BUFFER_HEAP)
+            return;
+        size = it->second.size;
+    }
+    unsigned long mask = 1UL << current_numa_node();
+    syscall(SYS_mbind, data, size, MPOL_BIND, &mask, sizeof(mask) * 8, MPOL_MF_MOVE);
+}
+
+int current_numa_node() {
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+        return 0;
+    return node;
+}
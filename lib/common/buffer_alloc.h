@@ -0,0 +1,116 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef BUFFER_ALLOC_H
+#define BUFFER_ALLOC_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Placement of large sample buffers.
+ */
+struct buffer_policy {
+    // Back buffers with 2 MB hugepages (reserved hugetlbfs pages, else transparent hugepages)
+    bool hugepages = false;
+    // NUMA node to bind buffers to, -1 leaves pages on the node of the thread writing them first
+    int numa_node = -1;
+};
+
+/**
+ * Allocate page aligned buffer following policy. With default policy it is plain heap memory.
+ *
+ * @return  nullptr on failure
+ */
+void* buffer_alloc(size_t size, const buffer_policy& policy);
+
+/**
+ * Free buffer from buffer_alloc.
+ */
+void buffer_free(void* data);
+
+/**
+ * Print where pages of a buffer actually are: NUMA nodes, page count and whether hugepages
+ * back it. Pages not written yet are reported as not present.
+ *
+ * @param   name  Buffer description printed in report.
+ */
+void buffer_report(const char* name, const void* data, size_t size);
+
+/**
+ * Move pages of a buffer from buffer_alloc to NUMA node of the calling thread, for buffers
+ * filled by one thread and streamed by another.
+ */
+void buffer_move_here(void* data, size_t size);
+
+/**
+ * NUMA node of CPU the calling thread runs on, 0 if unknown.
+ */
+int current_numa_node();
+
+/**
+ * STL allocator over buffer_alloc, so sample vectors follow buffer placement policy.
+ */
+template <class T>
+class buffer_allocator {
+    public:
+    typedef T value_type;
+    // Policy travels with the buffer when containers are assigned or swapped
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    buffer_policy policy;
+
+    buffer_allocator() {}
+    buffer_allocator(const buffer_policy& policy) : policy(policy) {}
+    template <class U>
+    buffer_allocator(const buffer_allocator<U>& other) : policy(other.policy) {}
+
+    T* allocate(size_t n) {
+        void* data = buffer_alloc(n * sizeof(T), policy);
+        if (!data)
+            throw std::bad_alloc();
+        return static_cast<T*>(data);
+    }
+    void deallocate(T* data, size_t) { buffer_free(data); }
+
+    template <class U>
+    struct rebind {
+        typedef buffer_allocator<U> other;
+    };
+};
+
+template <class T, class U>
+bool operator==(const buffer_allocator<T>& a, const buffer_allocator<U>& b) {
+    return a.policy.hugepages == b.policy.hugepages && a.policy.numa_node == b.policy.numa_node;
+}
+template <class T, class U>
+bool operator!=(const buffer_allocator<T>& a, const buffer_allocator<U>& b) {
+    return !(a == b);
+}
+
+template <class T>
+using buffer_vector = std::vector<T, buffer_allocator<T>>;
+
+#endif
@@ -0,0 +1,131 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "burst_trigger.h"
+#include "sample_stats.h"
+#include <algorithm>
+#include <cmath>
+
+burst_trigger::burst_trigger(int channels, size_t pre, size_t post, double threshold_dbfs)
+    : channels(channels), pre(pre), post(post) {
+    level_trigger = threshold_dbfs <= 0;
+    threshold = std::pow(10.0, threshold_dbfs / 10);
+    for (int i = 0; i < channels; i++)
+        history[i].resize(pre);
+}
+
+void burst_trigger::process(const gr_complex* const* in,
+                            size_t count,
+                            uint64_t timestamp,
+                            std::vector<trigger_capture>& captures) {
+    size_t i = 0;
+    // Start of samples not belonging to any capture, pre-trigger never reaches into a capture
+    size_t idle_start = 0;
+    while (i < count) {
+        // Continue capture in progress
+        if (remaining > 0) {
+            size_t n = std::min(remaining, count - i);
+            for (int c = 0; c < channels; c++)
+                pending[c].insert(pending[c].end(), in[c] + i, in[c] + i + n);
+            remaining -= n;
+            i += n;
+            idle_start = i;
+            continue;
+        }
+
+        // Look for trigger point
+        size_t k = count;
+        if (external.exchange(false)) {
+            k = i;
+        } else if (level_trigger) {
+            for (int c = 0; c < channels; c++)
+                k = i + find_power_above((const float*)(in[c] + i), k - i, threshold);
+        }
+        if (k == count)
+            break;
+
+        // Pre-trigger samples come from this buffer and, if not enough, from history
+        trigger_capture capture;
+        size_t from_buffer = std::min(pre, k - idle_start);
+        size_t from_history = 0;
+        if (idle_start == 0)
+            from_history = std::min<uint64_t>(
+                pre - from_buffer, std::min<uint64_t>(history_fill, idle_before));
+        capture.offset = pending[0].size() - pending_pos;
+        capture.pre = from_buffer + from_history;
+        capture.length = capture.pre + post;
+        capture.timestamp = timestamp + k - capture.pre;
+        captures.push_back(capture);
+
+        this->copy_history(from_history);
+        for (int c = 0; c < channels; c++)
+            pending[c].insert(pending[c].end(), in[c] + k - from_buffer, in[c] + k);
+        remaining = post;
+        i = k;
+    }
+    if (remaining > 0)
+        idle_before = 0;
+    else
+        idle_before = (count - idle_start) + ((idle_start == 0) ? idle_before : 0);
+    this->update_history(in, count);
+}
+
+void burst_trigger::copy_history(size_t count) {
+    if (count == 0)
+        return;
+    size_t start = (history_pos + pre - count) % pre;
+    for (int c = 0; c < channels; c++) {
+        size_t first = std::min(count, pre - start);
+        pending[c].insert(
+            pending[c].end(), history[c].begin() + start, history[c].begin() + start + first);
+        pending[c].insert(
+            pending[c].end(), history[c].begin(), history[c].begin() + (count - first));
+    }
+}
+
+void burst_trigger::update_history(const gr_complex* const* in, size_t count) {
+    if (pre == 0)
+        return;
+    size_t n = std::min(count, pre);
+    const size_t offset = count - n;
+    for (int c = 0; c < channels; c++) {
+        size_t pos = history_pos;
+        size_t first = std::min(n, pre - pos);
+        std::copy(in[c] + offset, in[c] + offset + first, history[c].begin() + pos);
+        std::copy(in[c] + offset + first, in[c] + count, history[c].begin());
+    }
+    history_pos = (history_pos + n) % pre;
+    history_fill = std::min(pre, history_fill + n);
+}
+
+size_t burst_trigger::read(gr_complex* const* out, size_t count) {
+    size_t n = std::min(count, this->get_pending());
+    for (int c = 0; c < channels; c++)
+        std::copy(pending[c].begin() + pending_pos, pending[c].begin() + pending_pos + n, out[c]);
+    pending_pos += n;
+    // Reuse storage once everything has been read
+    if (pending_pos == pending[0].size()) {
+        for (int c = 0; c < channels; c++)
+            pending[c].clear();
+        pending_pos = 0;
+    }
+    return n;
+}
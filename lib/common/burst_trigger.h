@@ -0,0 +1,120 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef BURST_TRIGGER_H
+#define BURST_TRIGGER_H
+
+#include <gnuradio/gr_complex.h>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Start of a capture in the pending output.
+ */
+struct trigger_capture {
+    // Index of the first capture sample in pending output
+    size_t offset;
+    // Device timestamp of the first capture sample
+    uint64_t timestamp;
+    // Samples before the trigger point (less than configured right after start)
+    size_t pre;
+    size_t length;
+};
+
+/**
+ * Triggered capture of received stream. Keeps the last pre samples of the stream in a ring
+ * and on power threshold crossing or external trigger queues pre + post samples for output,
+ * everything else is dropped. Captures never overlap: triggers during a capture are ignored and
+ * pre-trigger history is cut at the end of the previous capture.
+ */
+class burst_trigger {
+    private:
+    int channels;
+    size_t pre;
+    size_t post;
+    float threshold;
+    bool level_trigger;
+
+    // Pre-trigger history, samples preceding the current buffer
+    std::vector<gr_complex> history[2];
+    size_t history_pos = 0;
+    size_t history_fill = 0;
+    // Samples received since end of last capture
+    uint64_t idle_before = 0;
+
+    // Post-trigger samples still to be captured
+    size_t remaining = 0;
+
+    // Captured samples waiting for output buffer space
+    std::vector<gr_complex> pending[2];
+    size_t pending_pos = 0;
+
+    std::atomic<bool> external{false};
+
+    void update_history(const gr_complex* const* in, size_t count);
+    void copy_history(size_t count);
+
+    public:
+    /**
+     * @param   channels  Channel count, trigger on any channel captures all.
+     *
+     * @param   pre  Samples kept before trigger point.
+     *
+     * @param   post  Samples captured from trigger point.
+     *
+     * @param   threshold_dbfs  Power trigger level in dBFS, positive value disables level
+     *                          trigger so only external triggers are used.
+     */
+    burst_trigger(int channels, size_t pre, size_t post, double threshold_dbfs);
+
+    /**
+     * Process received buffer, capture samples are appended to pending output.
+     *
+     * @param   in  Buffer of each channel.
+     *
+     * @param   count  Samples in each buffer.
+     *
+     * @param   timestamp  Device timestamp of first sample.
+     *
+     * @param   captures  Filled with captures started in this buffer.
+     */
+    void process(const gr_complex* const* in,
+                 size_t count,
+                 uint64_t timestamp,
+                 std::vector<trigger_capture>& captures);
+
+    /**
+     * Trigger capture at the start of next processed buffer. Thread safe.
+     */
+    void fire() { external = true; }
+
+    size_t get_pending() const { return pending[0].size() - pending_pos; }
+
+    /**
+     * Move up to count pending samples of each channel to out.
+     *
+     * @return  samples moved
+     */
+    size_t read(gr_complex* const* out, size_t count);
+};
+
+#endif
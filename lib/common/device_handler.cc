@@ -19,12 +19,13 @@
  */
 
 #include "device_handler.h"
+#include "logger.h"
 #include <LMS7002M_parameters.h>
 
-device_handler::~device_handler() { delete list; }
+device_handler::~device_handler() { stop_discovery(); }
 
 void device_handler::error(int device_number) {
-    // std::cout << "ERROR: " << LMS_GetLastErrorMessage() << std::endl;
+    // log_stream() << "ERROR: " << LMS_GetLastErrorMessage() << std::endl;
     if (this->device_vector[device_number].address != NULL)
         close_all_devices();
 }
@@ -34,87 +35,76 @@ lms_device_t* device_handler::get_device(int device_number) {
 }
 
 int device_handler::open_device(std::string& serial) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
 
-    int device_number;
-    std::string search_name;
-    std::cout << "##################" << std::endl;
-    std::cout << "Connecting to device" << std::endl;
+    log_stream() << "##################" << std::endl;
+    log_stream() << "Connecting to device" << std::endl;
 
     // Print device and library information only once
     if (list_read == false) {
-        std::cout << "##################" << std::endl;
-        std::cout << "LimeSuite version: " << LMS_GetLibraryVersion() << std::endl;
-        std::cout << "gr-limesdr version: " << GR_LIMESDR_VER << std::endl;
-        std::cout << "##################" << std::endl;
-
-        device_count = LMS_GetDeviceList(list);
-        if (device_count < 1) {
-            std::cout << "ERROR: device_handler::open_device(): No Lime devices found."
-                      << std::endl;
+        log_stream() << "##################" << std::endl;
+        log_stream() << "LimeSuite version: " << LMS_GetLibraryVersion() << std::endl;
+        log_stream() << "gr-limesdr version: " << GR_LIMESDR_VER << std::endl;
+        log_stream() << "##################" << std::endl;
+
+        if (refresh_devices() < 1) {
+            log_stream() << "ERROR: device_handler::open_device(): No Lime devices found."
+                         << std::endl;
             exit(0);
         }
-        std::cout << "Device list:" << std::endl;
+        log_stream() << "Device list:" << std::endl;
 
-        for (int i = 0; i < device_count; i++) {
-            std::cout << "Nr.:" << i << " device:" << list[i] << std::endl;
-            device_vector.push_back(device());
-        }
-        std::cout << "##################" << std::endl;
+        for (size_t i = 0; i < device_vector.size(); i++)
+            log_stream() << "Nr.:" << i << " device:" << device_vector[i].info << std::endl;
+        log_stream() << "##################" << std::endl;
         list_read = true;
     }
 
     if (serial.empty()) {
-        std::cout << "INFO: device_handler::open_device(): no serial number. Using first device in "
-                     "the list."
-                  << std::endl
-                  << "Use \"LimeUtil --find\" in terminal to find prefered device serial."
-                  << std::endl;
-    }
-
-    // Identify device by serial number
-    for (int i = 0; i < device_count; i++) {
-        std::string device_string(list[i]);
-        size_t first = device_string.find("serial=") + 7;
-        size_t end = device_string.find(",", first);
-        std::string aquired_serial = device_string.substr(first, end - first);
-
-        // If serial is left empty, use first device in list
-        if (serial.empty()) {
-            device_number = i;
-            serial = aquired_serial;
-            break;
-        } else if (aquired_serial == serial) {
-            device_number = i;
-            break;
-        }
-        // If program was unable to find device in list print error and stop program
-        else if (i == device_count - 1 && (aquired_serial != serial)) {
-            std::cout << "Unable to find LMS device with serial " << serial << "." << std::endl;
-            std::cout << "##################" << std::endl;
-            close_all_devices();
-        }
+        log_stream() << "INFO: device_handler::open_device(): no serial number. Using first "
+                        "device in the list."
+                     << std::endl
+                     << "Use \"LimeUtil --find\" in terminal to find prefered device serial."
+                     << std::endl;
+    }
+
+    // Identify device by serial number, device plugged in after start is found as well
+    int device_number = find_device(serial);
+    if (device_number < 0 || !device_vector[device_number].present) {
+        refresh_devices();
+        device_number = find_device(serial);
     }
+    // If program was unable to find device in list print error and stop program
+    if (device_number < 0 || !device_vector[device_number].present) {
+        log_stream() << "Unable to find LMS device with serial " << serial << "." << std::endl;
+        log_stream() << "##################" << std::endl;
+        close_all_devices();
+    }
+    serial = device_vector[device_number].serial;
 
     // If device slot is empty, open and initialize device
     if (device_vector[device_number].address == NULL) {
-        if (LMS_Open(&device_vector[device_number].address, list[device_number], NULL) !=
-            LMS_SUCCESS)
+        lms_device_t* address = NULL;
+        if (LMS_Open(&address, device_vector[device_number].info.c_str(), NULL) != LMS_SUCCESS)
             exit(0);
+        device_vector[device_number].address = address;
         LMS_Init(device_vector[device_number].address);
         const lms_dev_info_t* info = LMS_GetDeviceInfo(device_vector[device_number].address);
-        std::cout << "Using device: " << info->deviceName << "(" << serial
-                  << ") GW: " << info->gatewareVersion << " FW: " << info->firmwareVersion
-                  << std::endl;
+        log_stream() << "Using device: " << info->deviceName << "(" << serial
+                     << ") GW: " << info->gatewareVersion << " FW: " << info->firmwareVersion
+                     << std::endl;
+        device_vector[device_number].telemetry->attach(
+            device_vector[device_number].address, &block_mutex, serial, device_number);
         ++open_devices; // Count open devices
-        std::cout << "##################" << std::endl;
-        std::cout << std::endl;
+        log_stream() << "##################" << std::endl;
+        log_stream() << std::endl;
     }
     // If device is open do nothing
     else {
-        std::cout << "Previously connected device number " << device_number
-                  << " from the list is used." << std::endl;
-        std::cout << "##################" << std::endl;
-        std::cout << std::endl;
+        log_stream() << "Previously connected device number " << device_number
+                     << " from the list is used." << std::endl;
+        log_stream() << "##################" << std::endl;
+        log_stream() << std::endl;
     }
 
 
@@ -127,18 +117,29 @@ void device_handler::close_device(int device_number, int block_type) {
     if (device_vector[device_number].source_flag == false ||
         device_vector[device_number].sink_flag == false) {
         if (device_vector[device_number].address != NULL) {
-            std::cout << std::endl;
-            std::cout << "##################" << std::endl;
+            log_stream() << std::endl;
+            log_stream() << "##################" << std::endl;
+            device_vector[device_number].telemetry->attach(NULL, NULL, "", device_number);
             if (LMS_Reset(this->device_vector[device_number].address) != LMS_SUCCESS)
                 error(device_number);
             if (LMS_Close(this->device_vector[device_number].address) != LMS_SUCCESS)
                 error(device_number);
-            std::cout << "INFO: device_handler::close_device(): Disconnected from device number "
-                      << device_number << "." << std::endl;
+            log_stream() << "INFO: device_handler::close_device(): Disconnected from device number "
+                         << device_number << "." << std::endl;
+            log_stream() << "INFO: device_handler::close_device(): configuration writes applied: "
+                         << device_vector[device_number].writes_applied
+                         << ", skipped: " << device_vector[device_number].writes_skipped << "."
+                         << std::endl;
+            device_vector[device_number].tuning->print_stats();
+            device_vector[device_number].tuning->clear();
             device_vector[device_number].address = NULL;
-            std::cout << "##################" << std::endl;
-            std::cout << std::endl;
+            log_stream() << "##################" << std::endl;
+            log_stream() << std::endl;
         }
+        // Streams on handles lost to unplugging have been released by now
+        for (lms_device_t* retired : device_vector[device_number].retired)
+            LMS_Close(retired);
+        device_vector[device_number].retired.clear();
     }
     // If two blocks used switch one block flag and let other block finish work
     // Switch flag when closing device
@@ -154,11 +155,13 @@ void device_handler::close_device(int device_number, int block_type) {
 
 void device_handler::close_all_devices() {
     if (close_flag == false) {
-        for (int i = 0; i <= open_devices; i++) {
-            if (this->device_vector[i].address != NULL) {
-                LMS_Reset(this->device_vector[i].address);
-                LMS_Close(this->device_vector[i].address);
+        for (device& dev : device_vector) {
+            if (dev.address != NULL) {
+                LMS_Reset(dev.address);
+                LMS_Close(dev.address);
             }
+            for (lms_device_t* retired : dev.retired)
+                LMS_Close(retired);
         }
         close_flag = true;
         exit(0);
@@ -173,9 +176,9 @@ void device_handler::check_blocks(int device_number,
     switch (block_type) {
     case 1: // Source block
         if (device_vector[device_number].source_flag == true) {
-            std::cout << "ERROR: device_handler::check_blocks(): only one LimeSuite Source (RX) "
-                         "block is allowed per device."
-                      << std::endl;
+            log_stream() << "ERROR: device_handler::check_blocks(): only one LimeSuite Source (RX) "
+                            "block is allowed per device."
+                         << std::endl;
             close_all_devices();
         } else {
             device_vector[device_number].source_flag = true;
@@ -186,9 +189,9 @@ void device_handler::check_blocks(int device_number,
 
     case 2: // Sink block
         if (device_vector[device_number].sink_flag == true) {
-            std::cout << "ERROR: device_handler::check_blocks(): only one LimeSuite Sink (TX) "
-                         "block is allowed per device."
-                      << std::endl;
+            log_stream() << "ERROR: device_handler::check_blocks(): only one LimeSuite Sink (TX) "
+                            "block is allowed per device."
+                         << std::endl;
             close_all_devices();
         } else {
             device_vector[device_number].sink_flag = true;
@@ -198,8 +201,8 @@ void device_handler::check_blocks(int device_number,
         break;
 
     default:
-        std::cout << "ERROR: device_handler::check_blocks(): incorrect block_type value."
-                  << std::endl;
+        log_stream() << "ERROR: device_handler::check_blocks(): incorrect block_type value."
+                     << std::endl;
         close_all_devices();
     }
 
@@ -208,21 +211,21 @@ void device_handler::check_blocks(int device_number,
         // Chip_mode must match in blocks with the same serial
         if (device_vector[device_number].source_channel_mode !=
             device_vector[device_number].sink_channel_mode) {
-            std::cout << "Source: " << device_vector[device_number].source_channel_mode
-                      << std::endl;
-            std::cout << "Sink: " << device_vector[device_number].sink_channel_mode << std::endl;
-            std::cout << "ERROR: device_handler::check_blocks(): channel mismatch in LimeSuite "
-                         "Source (RX) and LimeSuite Sink (TX)."
-                      << std::endl;
+            log_stream() << "Source: " << device_vector[device_number].source_channel_mode
+                         << std::endl;
+            log_stream() << "Sink: " << device_vector[device_number].sink_channel_mode << std::endl;
+            log_stream() << "ERROR: device_handler::check_blocks(): channel mismatch in LimeSuite "
+                            "Source (RX) and LimeSuite Sink (TX)."
+                         << std::endl;
             close_all_devices();
         }
 
         // When file_switch is 1 check filename match throughout the blocks with the same serial
         if (device_vector[device_number].source_filename !=
             device_vector[device_number].sink_filename) {
-            std::cout << "ERROR: device_handler::check_blocks(): file must match in LimeSuite "
-                         "Source (RX) and LimeSuite Sink (TX)."
-                      << std::endl;
+            log_stream() << "ERROR: device_handler::check_blocks(): file must match in LimeSuite "
+                            "Source (RX) and LimeSuite Sink (TX)."
+                         << std::endl;
             close_all_devices();
         }
     }
@@ -233,6 +236,15 @@ void device_handler::settings_from_file(int device_number,
                                         int* pAntenna_tx) {
     if (LMS_LoadConfig(device_handler::getInstance().get_device(device_number), filename.c_str()))
         device_handler::getInstance().error(device_number);
+    invalidate_config(device_number);
+    device_vector[device_number].tuning->clear();
+    for (int direction = 0; direction < 2; direction++) {
+        for (int channel = 0; channel < 2; channel++) {
+            clear_gfir(device_number, direction, channel);
+            // File replaces earlier settings, reconnect loads it again
+            device_vector[device_number].restore[direction][channel] = channel_config();
+        }
+    }
 
     // Set LimeSDR-Mini switches based on .ini file
     int antenna_rx = LMS_PATH_NONE;
@@ -261,7 +273,7 @@ void device_handler::settings_from_file(int device_number,
 }
 
 void device_handler::enable_channels(int device_number, int channel_mode, bool direction) {
-    std::cout << "INFO: device_handler::enable_channels(): ";
+    log_stream() << "INFO: device_handler::enable_channels(): ";
     if (channel_mode < 2) {
 
         if (LMS_EnableChannel(device_handler::getInstance().get_device(device_number),
@@ -269,18 +281,22 @@ void device_handler::enable_channels(int device_number, int channel_mode, bool d
                               channel_mode,
                               true) != LMS_SUCCESS)
             device_handler::getInstance().error(device_number);
-        std::cout << "SISO CH" << channel_mode << " set for device number " << device_number << "."
-                  << std::endl;
-                          std::cout << "SISO CH" << channel_mode << " set for device number "
-                  << device_number << "." << std::endl;
+        log_stream() << "SISO CH" << channel_mode << " set for device number " << device_number
+                     << "." << std::endl;
+        log_stream() << "SISO CH" << channel_mode << " set for device number " << device_number
+                     << "." << std::endl;
 
+        rfe_link& rfe = *device_vector[device_number].rfe;
+        std::unique_lock<std::mutex> rfe_lock(rfe.mutex);
         if (direction)
-            rfe_device.tx_channel = channel_mode;
+            rfe.tx_channel = channel_mode;
         else
-            rfe_device.rx_channel = channel_mode;
+            rfe.rx_channel = channel_mode;
+        bool rfe_attached = rfe.rfe_dev != nullptr;
+        rfe_lock.unlock();
 
-        if (rfe_device.rfe_dev) {
-            update_rfe_channels();
+        if (rfe_attached) {
+            update_rfe_channels(device_number);
         }
     } else if (channel_mode == 2) {
         if (LMS_EnableChannel(device_handler::getInstance().get_device(device_number),
@@ -293,13 +309,17 @@ void device_handler::enable_channels(int device_number, int channel_mode, bool d
                               LMS_CH_1,
                               true) != LMS_SUCCESS)
             device_handler::getInstance().error(device_number);
-        std::cout << "MIMO mode set for device number " << device_number << "." << std::endl;
+        log_stream() << "MIMO mode set for device number " << device_number << "." << std::endl;
     }
 }
 
 void device_handler::set_samp_rate(int device_number, double& rate) {
-    std::cout << "INFO: device_handler::set_samp_rate(): ";
-    if (LMS_SetSampleRate(device_handler::getInstance().get_device(device_number), rate, 0) !=
+    device_vector[device_number].samp_rate = rate;
+    device_vector[device_number].oversample = -1;
+    int oversample = plan_oversampling(device_number, rate);
+    log_stream() << "INFO: device_handler::set_samp_rate(): ";
+    if (LMS_SetSampleRate(
+            device_handler::getInstance().get_device(device_number), rate, oversample) !=
         LMS_SUCCESS)
         device_handler::getInstance().error(device_number);
     double host_value;
@@ -310,14 +330,130 @@ void device_handler::set_samp_rate(int device_number, double& rate) {
                           &host_value,
                           &rf_value))
         device_handler::getInstance().error(device_number);
-    std::cout << "set sampling rate: " << host_value / 1e6 << " MS/s." << std::endl;
+    log_stream() << "set sampling rate: " << host_value / 1e6 << " MS/s." << std::endl;
     rate = host_value; // Get the real rate back;
+    // Clock change recalculates filters and NCO
+    invalidate_config(device_number);
+    // NCO frequency word depends on the clock, write active offsets again
+    device& dev = device_vector[device_number];
+    for (int direction = 0; direction < 2; direction++) {
+        for (int channel = 0; channel < 2; channel++) {
+            double nco = dev.user_nco[direction][channel] + dev.tune_nco[direction][channel];
+            if (nco != 0)
+                write_nco(device_number, direction, channel, nco);
+        }
+    }
+    apply_rate_plan(device_number, rate);
+    rewrite_gfir(device_number);
+}
+
+void device_handler::set_rate_plan(int device_number,
+                                   bool direction,
+                                   double bandwidth,
+                                   double attenuation) {
+    if (bandwidth < 0 || attenuation <= 0) {
+        log_stream() << "ERROR: device_handler::set_rate_plan(): bandwidth can not be negative, "
+                        "attenuation must be more than 0."
+                     << std::endl;
+        return;
+    }
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    // Planned GFIR3 is no longer wanted
+    if (bandwidth == 0 && dev.plan_bandw[direction] > 0) {
+        for (int channel = 0; channel < 2; channel++) {
+            gfir_config& config = dev.gfir[direction][channel][2];
+            if (config.spec.passband > 0) {
+                config = gfir_config();
+                write_gfir(device_number, direction, channel, 3);
+            }
+        }
+    }
+    dev.plan_bandw[direction] = bandwidth;
+    dev.plan_attenuation[direction] = attenuation;
+}
+
+int device_handler::plan_oversampling(int device_number, double rate) {
+    device& dev = device_vector[device_number];
+    if (dev.plan_bandw[LMS_CH_RX] <= 0 && dev.plan_bandw[LMS_CH_TX] <= 0)
+        return 0;
+
+    link_interface link =
+        link_for_board(LMS_GetDeviceInfo(get_device(device_number))->deviceName);
+    int channel_mode[2] = {dev.source_channel_mode, dev.sink_channel_mode};
+    int streams = 0;
+    for (int mode : channel_mode)
+        streams += (mode == 2) ? 2 : (mode >= 0) ? 1 : 0;
+
+    // Widest planned band needs the most taps and sets oversampling for both directions
+    std::string s_dir[2] = {"RX", "TX"};
+    int oversample = 1;
+    rate_plan plan;
+    for (int direction = 0; direction < 2; direction++) {
+        if (dev.plan_bandw[direction] <= 0)
+            continue;
+        rate_plan p = plan_rate(
+            rate, dev.plan_bandw[direction], dev.plan_attenuation[direction], streams, link);
+        if (dev.plan_bandw[direction] > rate) {
+            log_stream() << "WARNING: device_handler::set_rate_plan(): [" << s_dir[direction]
+                         << "] bandwidth " << dev.plan_bandw[direction] / 1e6
+                         << " MHz does not fit into " << rate / 1e6 << " MS/s." << std::endl;
+        }
+        if (p.oversample >= oversample) {
+            oversample = p.oversample;
+            plan = p;
+        }
+    }
+
+    log_stream() << "INFO: device_handler::set_rate_plan(): " << rate / 1e6 << " MS/s, ADC/DAC "
+                 << plan.adc_clock / 1e6 << " MHz, CGEN " << plan.cgen_clock / 1e6
+                 << " MHz, decimation/interpolation " << oversample << "." << std::endl;
+    log_stream() << "INFO: device_handler::set_rate_plan(): link " << streams << " x "
+                 << rate / 1e6 << " MS/s (12-bit): " << plan.link_rate / 1e6 << " MB/s of "
+                 << link.capacity / 1e6 << " MB/s " << link.name << " ("
+                 << (int)(plan.link_load * 100) << "%)." << std::endl;
+    if (plan.link_load > 1) {
+        log_stream() << "WARNING: device_handler::set_rate_plan(): link rate exceeds " << link.name
+                     << " throughput, packets will be dropped. Lower sample rate or number of "
+                        "channels."
+                     << std::endl;
+    } else if (plan.link_load > 0.8) {
+        log_stream() << "WARNING: device_handler::set_rate_plan(): link rate is close to "
+                     << link.name << " throughput, packets may be dropped on a loaded host."
+                     << std::endl;
+    }
+    return oversample;
+}
+
+void device_handler::apply_rate_plan(int device_number, double rate) {
+    // GFIR3 of planned directions is designed for the actual rate by rewrite_gfir
+    device& dev = device_vector[device_number];
+    int channel_mode[2] = {dev.source_channel_mode, dev.sink_channel_mode};
+    for (int direction = 0; direction < 2; direction++) {
+        if (dev.plan_bandw[direction] <= 0 || channel_mode[direction] < 0)
+            continue;
+        rate_plan plan = plan_rate(rate,
+                                   dev.plan_bandw[direction],
+                                   dev.plan_attenuation[direction],
+                                   0,
+                                   link_interface());
+        for (int channel = 0; channel < 2; channel++) {
+            if (channel_mode[direction] != 2 && channel_mode[direction] != channel)
+                continue;
+            gfir_config& config = dev.gfir[direction][channel][2];
+            config = gfir_config();
+            config.spec = plan.filter;
+            // No room for a transition band, GFIR3 is not used
+            if (plan.filter.passband == 0)
+                write_gfir(device_number, direction, channel, 3);
+        }
+    }
 }
 
 void device_handler::set_oversampling(int device_number, int oversample) {
     if (oversample == 0 || oversample == 1 || oversample == 2 || oversample == 4 ||
         oversample == 8 || oversample == 16 || oversample == 32) {
-        std::cout << "INFO: device_handler::set_oversampling(): ";
+        log_stream() << "INFO: device_handler::set_oversampling(): ";
         double host_value;
         double rf_value;
         if (LMS_GetSampleRate(device_handler::getInstance().get_device(device_number),
@@ -332,41 +468,74 @@ void device_handler::set_oversampling(int device_number, int oversample) {
                               oversample) != LMS_SUCCESS)
             device_handler::getInstance().error(device_number);
 
-        std::cout << "Oversampling set to: " << oversample << std::endl;
+        log_stream() << "Oversampling set to: " << oversample << std::endl;
+        device_vector[device_number].oversample = oversample;
+        invalidate_config(device_number);
+        rewrite_gfir(device_number);
     } else {
-        std::cout << "ERROR: device_handler::set_oversampling(): valid oversample values are: "
-                     "0,1,2,4,8,16,32."
-                  << std::endl;
+        log_stream() << "ERROR: device_handler::set_oversampling(): valid oversample values are: "
+                        "0,1,2,4,8,16,32."
+                     << std::endl;
         close_all_devices();
     }
 }
 
-double device_handler::set_rf_freq(int device_number, bool direction, int channel, float rf_freq) {
+double device_handler::set_rf_freq(int device_number, bool direction, int channel, double rf_freq) {
     if (rf_freq <= 0) {
-        std::cout << "ERROR: device_handler::set_rf_freq(): rf_freq must be more than 0 Hz."
-                  << std::endl;
+        log_stream() << "ERROR: device_handler::set_rf_freq(): rf_freq must be more than 0 Hz."
+                     << std::endl;
         close_all_devices();
-    } else {
-        std::cout << "INFO: device_handler::set_rf_freq(): ";
-        if (LMS_SetLOFrequency(device_handler::getInstance().get_device(device_number),
-                               direction,
-                               channel,
-                               rf_freq) != LMS_SUCCESS)
+    }
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    if (dev.batch_depth > 0) {
+        dev.pending[direction][channel].rf_freq = rf_freq;
+        return rf_freq;
+    }
+    if (dev.applied[direction][channel].rf_freq == rf_freq) {
+        dev.writes_skipped++;
+        return dev.actual[direction][channel].rf_freq;
+    }
+    return apply_rf_freq(device_number, direction, channel, rf_freq);
+}
+
+double device_handler::apply_rf_freq(int device_number, bool direction, int channel, double rf_freq) {
+    log_stream() << "INFO: device_handler::set_rf_freq(): ";
+    device& dev = device_vector[device_number];
+    lms_device_t* address = device_handler::getInstance().get_device(device_number);
+    auto t_start = std::chrono::steady_clock::now();
+
+    // Revisited frequency: write resolved synthesizer registers instead of full PLL/VCO tuning
+    double value = 0;
+    bool auto_path = dev.applied[direction][channel].antenna <= 0;
+    bool cached = dev.tuning->replay(address, direction, channel, rf_freq, auto_path, value);
+    if (!cached) {
+        if (LMS_SetLOFrequency(address, direction, channel, rf_freq) != LMS_SUCCESS)
             device_handler::getInstance().error(device_number);
+        LMS_GetLOFrequency(address, direction, channel, &value);
+        dev.tuning->store(address, direction, channel, rf_freq, value);
+    }
+    dev.tuning->record(
+        cached, std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count());
 
-        double value = 0;
-        LMS_GetLOFrequency(
-            device_handler::getInstance().get_device(device_number), direction, channel, &value);
+    std::string s_dir[2] = {"RX", "TX"};
+    log_stream() << "RF frequency set [" << s_dir[direction] << "]: " << value / 1e6 << " MHz"
+                 << (cached ? " (cached)." : ".") << std::endl;
 
-        std::string s_dir[2] = {"RX", "TX"};
-        std::cout << "RF frequency set [" << s_dir[direction] << "]: " << value / 1e6 << " MHz."
-                  << std::endl;
-        return value;
+    // LO is shared by both channels of the same direction
+    if (rf_freq != dev.tune_lo[direction])
+        dev.tune_lo[direction] = dev.tune_lo_actual[direction] = NAN;
+    for (int i = 0; i < 2; i++) {
+        dev.applied[direction][i].rf_freq = rf_freq;
+        dev.actual[direction][i].rf_freq = value;
+        dev.restore[direction][i].rf_freq = rf_freq;
     }
+    dev.writes_applied++;
+    return value;
 }
 
 void device_handler::calibrate(int device_number, int direction, int channel, double bandwidth) {
-    std::cout << "INFO: device_handler::calibrate(): ";
+    log_stream() << "INFO: device_handler::calibrate(): ";
     double rf_freq = 0;
     LMS_GetLOFrequency(
         device_handler::getInstance().get_device(device_number), direction, channel, &rf_freq);
@@ -390,7 +559,21 @@ void device_handler::calibrate(int device_number, int direction, int channel, do
 }
 
 void device_handler::set_antenna(int device_number, int channel, int direction, int antenna) {
-    std::cout << "INFO: device_handler::set_antenna(): ";
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    if (dev.batch_depth > 0) {
+        dev.pending[direction][channel].antenna = antenna;
+        return;
+    }
+    if (dev.applied[direction][channel].antenna == antenna) {
+        dev.writes_skipped++;
+        return;
+    }
+    apply_antenna(device_number, channel, direction, antenna);
+}
+
+void device_handler::apply_antenna(int device_number, int channel, int direction, int antenna) {
+    log_stream() << "INFO: device_handler::set_antenna(): ";
     LMS_SetAntenna(
         device_handler::getInstance().get_device(device_number), direction, channel, antenna);
     int antenna_value =
@@ -400,8 +583,14 @@ void device_handler::set_antenna(int device_number, int channel, int direction,
                                    {"Auto(NONE)", "BAND1", "BAND2", "NONE"}};
     std::string s_dir[2] = {"RX", "TX"};
 
-    std::cout << "CH" << channel << " antenna set [" << s_dir[direction]
-              << "]: " << s_antenna[direction][antenna_value] << "." << std::endl;
+    log_stream() << "CH" << channel << " antenna set [" << s_dir[direction]
+                 << "]: " << s_antenna[direction][antenna_value] << "." << std::endl;
+
+    device& dev = device_vector[device_number];
+    dev.applied[direction][channel].antenna = antenna;
+    dev.actual[direction][channel].antenna = antenna_value;
+    dev.restore[direction][channel].antenna = antenna;
+    dev.writes_applied++;
 }
 
 double device_handler::set_analog_filter(int device_number,
@@ -410,95 +599,342 @@ double device_handler::set_analog_filter(int device_number,
                                          double analog_bandw) {
     if (channel == 0 || channel == 1) {
         if (direction == LMS_CH_TX || direction == LMS_CH_RX) {
-            std::cout << "INFO: device_handler::set_analog_filter(): ";
-            LMS_SetLPFBW(device_handler::getInstance().get_device(device_number),
-                         direction,
-                         channel,
-                         analog_bandw);
-
-            double analog_value;
-            LMS_GetLPFBW(device_handler::getInstance().get_device(device_number),
-                         direction,
-                         channel,
-                         &analog_value);
-            return analog_value;
+            std::lock_guard<std::recursive_mutex> lock(block_mutex);
+            device& dev = device_vector[device_number];
+            if (dev.batch_depth > 0) {
+                dev.pending[direction][channel].analog_bandw = analog_bandw;
+                return analog_bandw;
+            }
+            // LMS_SetLPFBW reruns filter tuning, skip it when nothing changes
+            if (dev.applied[direction][channel].analog_bandw == analog_bandw) {
+                dev.writes_skipped++;
+                return dev.actual[direction][channel].analog_bandw;
+            }
+            return apply_analog_filter(device_number, direction, channel, analog_bandw);
         } else {
-            std::cout << "ERROR: device_handler::set_analog_filter(): direction must be "
-                         "0(LMS_CH_RX) or 1(LMS_CH_TX)."
-                      << std::endl;
+            log_stream() << "ERROR: device_handler::set_analog_filter(): direction must be "
+                            "0(LMS_CH_RX) or 1(LMS_CH_TX)."
+                         << std::endl;
             close_all_devices();
         }
     } else {
-        std::cout << "ERROR: device_handler::set_analog_filter(): channel must be 0 or 1."
-                  << std::endl;
+        log_stream() << "ERROR: device_handler::set_analog_filter(): channel must be 0 or 1."
+                     << std::endl;
         close_all_devices();
     }
 }
 
+double device_handler::apply_analog_filter(int device_number,
+                                           bool direction,
+                                           int channel,
+                                           double analog_bandw) {
+    log_stream() << "INFO: device_handler::set_analog_filter(): ";
+    LMS_SetLPFBW(
+        device_handler::getInstance().get_device(device_number), direction, channel, analog_bandw);
+
+    double analog_value;
+    LMS_GetLPFBW(
+        device_handler::getInstance().get_device(device_number), direction, channel, &analog_value);
+
+    device& dev = device_vector[device_number];
+    dev.applied[direction][channel].analog_bandw = analog_bandw;
+    dev.actual[direction][channel].analog_bandw = analog_value;
+    dev.restore[direction][channel].analog_bandw = analog_bandw;
+    dev.writes_applied++;
+    return analog_value;
+}
+
 double device_handler::set_digital_filter(int device_number,
                                           bool direction,
                                           int channel,
                                           double digital_bandw) {
     if (channel == 0 || channel == 1) {
         if (direction == LMS_CH_TX || direction == LMS_CH_RX) {
-            bool enable = (digital_bandw > 0) ? true : false;
-            std::cout << "INFO: device_handler::set_digital_filter(): ";
-            LMS_SetGFIRLPF(device_handler::getInstance().get_device(device_number),
-                           direction,
-                           channel,
-                           enable,
-                           digital_bandw);
-            std::string s_dir[2] = {"RX", "TX"};
-            std::cout << "digital filter CH" << channel << " [" << s_dir[direction] << "]: ";
-            if (enable)
-                std::cout << digital_bandw / 1e6 << " MHz." << std::endl;
-            else
-                std::cout << "disabled" << std::endl;
-            return digital_bandw;
+            std::lock_guard<std::recursive_mutex> lock(block_mutex);
+            device& dev = device_vector[device_number];
+            if (dev.batch_depth > 0) {
+                dev.pending[direction][channel].digital_bandw = digital_bandw;
+                return digital_bandw;
+            }
+            if (dev.applied[direction][channel].digital_bandw == digital_bandw) {
+                dev.writes_skipped++;
+                return digital_bandw;
+            }
+            return apply_digital_filter(device_number, direction, channel, digital_bandw);
         } else {
-            std::cout << "ERROR: device_handler::set_digital_filter(): direction must be "
-                         "0(LMS_CH_RX) or 1(LMS_CH_TX)."
-                      << std::endl;
+            log_stream() << "ERROR: device_handler::set_digital_filter(): direction must be "
+                            "0(LMS_CH_RX) or 1(LMS_CH_TX)."
+                         << std::endl;
             close_all_devices();
         }
     } else {
-        std::cout << "ERROR: device_handler::set_digital_filter(): channel must be 0 or 1."
-                  << std::endl;
+        log_stream() << "ERROR: device_handler::set_digital_filter(): channel must be 0 or 1."
+                     << std::endl;
         close_all_devices();
     }
 }
 
+double device_handler::apply_digital_filter(int device_number,
+                                            bool direction,
+                                            int channel,
+                                            double digital_bandw) {
+    bool enable = (digital_bandw > 0) ? true : false;
+    log_stream() << "INFO: device_handler::set_digital_filter(): ";
+    LMS_SetGFIRLPF(device_handler::getInstance().get_device(device_number),
+                   direction,
+                   channel,
+                   enable,
+                   digital_bandw);
+    std::string s_dir[2] = {"RX", "TX"};
+    log_stream() << "digital filter CH" << channel << " [" << s_dir[direction] << "]: ";
+    if (enable)
+        log_stream() << digital_bandw / 1e6 << " MHz." << std::endl;
+    else
+        log_stream() << "disabled" << std::endl;
+
+    device& dev = device_vector[device_number];
+    dev.applied[direction][channel].digital_bandw = digital_bandw;
+    dev.actual[direction][channel].digital_bandw = digital_bandw;
+    dev.restore[direction][channel].digital_bandw = digital_bandw;
+    dev.writes_applied++;
+    // GFIRs now hold the filter designed by LimeSuite
+    clear_gfir(device_number, direction, channel);
+    return digital_bandw;
+}
+
+void device_handler::set_gfir_taps(int device_number,
+                                   bool direction,
+                                   int channel,
+                                   int filter,
+                                   const std::vector<double>& taps) {
+    if (filter < 1 || filter > 3) {
+        log_stream() << "ERROR: device_handler::set_gfir_taps(): filter must be GFIR1(1), "
+                        "GFIR2(2) or GFIR3(3)."
+                     << std::endl;
+        return;
+    }
+    if (channel != 0 && channel != 1) {
+        log_stream() << "ERROR: device_handler::set_gfir_taps(): channel must be 0 or 1."
+                     << std::endl;
+        return;
+    }
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    gfir_config& config = device_vector[device_number].gfir[direction][channel][filter - 1];
+    gfir_config previous = config;
+    config.taps = taps;
+    config.spec = fir_spec();
+    if (!write_gfir(device_number, direction, channel, filter))
+        config = previous;
+}
+
+void device_handler::set_gfir_lowpass(
+    int device_number, bool direction, int channel, int filter, const fir_spec& spec) {
+    if (filter < 1 || filter > 3) {
+        log_stream() << "ERROR: device_handler::set_gfir_lowpass(): filter must be GFIR1(1), "
+                        "GFIR2(2) or GFIR3(3)."
+                     << std::endl;
+        return;
+    }
+    if (channel != 0 && channel != 1) {
+        log_stream() << "ERROR: device_handler::set_gfir_lowpass(): channel must be 0 or 1."
+                     << std::endl;
+        return;
+    }
+    if (spec.passband <= 0 || spec.stopband <= spec.passband || spec.ripple <= 0 ||
+        spec.attenuation <= 0) {
+        log_stream() << "ERROR: device_handler::set_gfir_lowpass(): passband must be more than 0 "
+                        "and below stopband, ripple and attenuation must be more than 0."
+                     << std::endl;
+        return;
+    }
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    gfir_config& config = device_vector[device_number].gfir[direction][channel][filter - 1];
+    gfir_config previous = config;
+    config.spec = spec;
+    if (!write_gfir(device_number, direction, channel, filter))
+        config = previous;
+}
+
+bool device_handler::write_gfir(int device_number, bool direction, int channel, int filter) {
+    lms_device_t* address = device_handler::getInstance().get_device(device_number);
+    gfir_config& config = device_vector[device_number].gfir[direction][channel][filter - 1];
+    std::string s_dir[2] = {"RX", "TX"};
+
+    double host_value;
+    double rf_value;
+    if (LMS_GetSampleRate(address, direction, channel, &host_value, &rf_value) != LMS_SUCCESS)
+        device_handler::getInstance().error(device_number);
+    // Each output sample has one clock cycle per decimation step for 5 (15) taps, up to 8 cycles
+    int cycles = std::min(8, std::max(1, (int)std::lround(rf_value / host_value)));
+    size_t max_taps = (filter == 3) ? 15 * cycles : 5 * cycles;
+
+    if (config.spec.passband > 0) {
+        if (config.spec.stopband > host_value / 2) {
+            log_stream() << "ERROR: device_handler::set_gfir_lowpass(): stopband must not be "
+                            "above half of sample rate ("
+                         << host_value / 2e6 << " MHz)." << std::endl;
+            return false;
+        }
+        fir_design design = design_lowpass(host_value, config.spec, max_taps);
+        if (design.required_taps > max_taps) {
+            log_stream() << "WARNING: device_handler::set_gfir_lowpass(): GFIR" << filter
+                         << " needs " << design.required_taps << " taps, " << max_taps
+                         << " available at current oversampling. Attenuation reduced to "
+                         << design.attenuation << " dB." << std::endl;
+        }
+        config.taps = design.taps;
+    } else if (config.taps.size() > max_taps) {
+        log_stream() << "ERROR: device_handler::set_gfir_taps(): GFIR" << filter << " takes "
+                     << max_taps << " taps at current oversampling, " << config.taps.size()
+                     << " given." << std::endl;
+        return false;
+    }
+
+    log_stream() << "INFO: device_handler::set_gfir(): GFIR" << filter << " CH" << channel
+                 << " [" << s_dir[direction] << "]: ";
+    if (config.taps.empty()) {
+        if (LMS_SetGFIR(address, direction, channel, (lms_gfir_t)(filter - 1), false) !=
+            LMS_SUCCESS)
+            device_handler::getInstance().error(device_number);
+        log_stream() << "disabled" << std::endl;
+    } else {
+        std::vector<float_type> coeffs(config.taps.begin(), config.taps.end());
+        if (LMS_SetGFIRCoeff(address,
+                             direction,
+                             channel,
+                             (lms_gfir_t)(filter - 1),
+                             coeffs.data(),
+                             coeffs.size()) != LMS_SUCCESS ||
+            LMS_SetGFIR(address, direction, channel, (lms_gfir_t)(filter - 1), true) !=
+                LMS_SUCCESS)
+            device_handler::getInstance().error(device_number);
+        log_stream() << config.taps.size() << " taps";
+        if (config.spec.passband > 0)
+            log_stream() << ", passband " << config.spec.passband / 1e6 << " MHz, stopband "
+                         << config.spec.stopband / 1e6 << " MHz";
+        log_stream() << "." << std::endl;
+    }
+
+    // Digital filter setting no longer describes GFIR contents
+    device& dev = device_vector[device_number];
+    dev.applied[direction][channel].digital_bandw = NAN;
+    dev.actual[direction][channel].digital_bandw = NAN;
+    dev.writes_applied++;
+    return true;
+}
+
+void device_handler::rewrite_gfir(int device_number) {
+    // Designed filters follow the new rate, tap limits depend on oversampling
+    device& dev = device_vector[device_number];
+    for (int direction = 0; direction < 2; direction++) {
+        for (int channel = 0; channel < 2; channel++) {
+            for (int filter = 1; filter <= 3; filter++) {
+                gfir_config& config = dev.gfir[direction][channel][filter - 1];
+                bool set = !config.taps.empty() || config.spec.passband > 0;
+                if (set && !write_gfir(device_number, direction, channel, filter))
+                    config = gfir_config();
+            }
+        }
+    }
+}
+
+void device_handler::clear_gfir(int device_number, bool direction, int channel) {
+    for (gfir_config& config : device_vector[device_number].gfir[direction][channel])
+        config = gfir_config();
+}
+
 unsigned
 device_handler::set_gain(int device_number, bool direction, int channel, unsigned gain_dB) {
     if (gain_dB >= 0 && gain_dB <= 73) {
-        std::cout << "INFO: device_handler::set_gain(): ";
-        LMS_SetGaindB(
-            device_handler::getInstance().get_device(device_number), direction, channel, gain_dB);
-
-        std::string s_dir[2] = {"RX", "TX"};
-
-        unsigned int gain_value;
-        LMS_GetGaindB(device_handler::getInstance().get_device(device_number),
-                      direction,
-                      channel,
-                      &gain_value);
-        std::cout << "set gain [" << s_dir[direction] << "] CH" << channel << ": " << gain_value
-                  << " dB." << std::endl;
-        return gain_value;
+        std::lock_guard<std::recursive_mutex> lock(block_mutex);
+        device& dev = device_vector[device_number];
+        if (dev.batch_depth > 0) {
+            dev.pending[direction][channel].gain = gain_dB;
+            return gain_dB;
+        }
+        if (dev.applied[direction][channel].gain == (int)gain_dB) {
+            dev.writes_skipped++;
+            return dev.actual[direction][channel].gain;
+        }
+        return apply_gain(device_number, direction, channel, gain_dB);
     } else {
-        std::cout << "ERROR: device_handler::set_gain(): valid gain range [0, 73] "
-                  << std::endl;
+        log_stream() << "ERROR: device_handler::set_gain(): valid gain range [0, 73] "
+                     << std::endl;
         close_all_devices();
     }
 }
 
+unsigned
+device_handler::apply_gain(int device_number, bool direction, int channel, unsigned gain_dB) {
+    log_stream() << "INFO: device_handler::set_gain(): ";
+    LMS_SetGaindB(
+        device_handler::getInstance().get_device(device_number), direction, channel, gain_dB);
+
+    std::string s_dir[2] = {"RX", "TX"};
+
+    unsigned int gain_value;
+    LMS_GetGaindB(
+        device_handler::getInstance().get_device(device_number), direction, channel, &gain_value);
+    log_stream() << "set gain [" << s_dir[direction] << "] CH" << channel << ": " << gain_value
+                 << " dB." << std::endl;
+
+    device& dev = device_vector[device_number];
+    dev.applied[direction][channel].gain = gain_dB;
+    dev.actual[direction][channel].gain = gain_value;
+    dev.restore[direction][channel].gain = gain_dB;
+    dev.writes_applied++;
+    return gain_value;
+}
+
+void device_handler::set_agc_gain(int device_number, int channel, unsigned gain_dB) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    if (dev.batch_depth > 0) {
+        dev.pending[LMS_CH_RX][channel].gain = gain_dB;
+        return;
+    }
+    if (dev.applied[LMS_CH_RX][channel].gain == (int)gain_dB) {
+        dev.writes_skipped++;
+        return;
+    }
+    LMS_SetGaindB(dev.address, LMS_CH_RX, channel, gain_dB);
+    unsigned int gain_value = gain_dB;
+    LMS_GetGaindB(dev.address, LMS_CH_RX, channel, &gain_value);
+    dev.applied[LMS_CH_RX][channel].gain = gain_dB;
+    dev.actual[LMS_CH_RX][channel].gain = gain_value;
+    dev.restore[LMS_CH_RX][channel].gain = gain_dB;
+    dev.writes_applied++;
+}
+
 void device_handler::set_nco(int device_number, bool direction, int channel, float nco_freq) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    // Channel tuning offset stays in effect on top of requested NCO
+    dev.user_nco[direction][channel] = nco_freq;
+    write_nco(device_number, direction, channel, nco_freq + dev.tune_nco[direction][channel]);
+}
+
+void device_handler::write_nco(int device_number, bool direction, int channel, double nco_freq) {
+    device& dev = device_vector[device_number];
+    if (dev.batch_depth > 0) {
+        dev.pending[direction][channel].nco_freq = nco_freq;
+        return;
+    }
+    if (dev.applied[direction][channel].nco_freq == nco_freq) {
+        dev.writes_skipped++;
+        return;
+    }
+    apply_nco(device_number, direction, channel, nco_freq);
+}
+
+void device_handler::apply_nco(int device_number, bool direction, int channel, double nco_freq) {
     std::string s_dir[2] = {"RX", "TX"};
-    std::cout << "INFO: device_handler::set_nco(): ";
+    log_stream() << "INFO: device_handler::set_nco(): ";
     if (nco_freq == 0) {
         LMS_SetNCOIndex(
             device_handler::getInstance().get_device(device_number), direction, channel, -1, 0);
-        std::cout << "NCO [" << s_dir[direction] << "] CH" << channel << " disabled" << std::endl;
+        log_stream() << "NCO [" << s_dir[direction] << "] CH" << channel << " disabled"
+                     << std::endl;
     } else {
         double freq_value_in[16] = {nco_freq};
         int cmix_mode;
@@ -528,12 +964,281 @@ void device_handler::set_nco(int device_number, bool direction, int channel, flo
                             channel,
                             freq_value_out,
                             pho_value_out);
-        std::cout << "NCO [" << s_dir[direction] << "] CH" << channel << ": "
-                  << freq_value_out[0] / 1e6 << " MHz (" << pho_value_out[0] << " deg.)("
-                  << s_cmix[cmix_mode] << ")." << std::endl;
+        log_stream() << "NCO [" << s_dir[direction] << "] CH" << channel << ": "
+                     << freq_value_out[0] / 1e6 << " MHz (" << pho_value_out[0] << " deg.)("
+                     << s_cmix[cmix_mode] << ")." << std::endl;
+    }
+
+    device& dev = device_vector[device_number];
+    dev.applied[direction][channel].nco_freq = nco_freq;
+    dev.actual[direction][channel].nco_freq = nco_freq;
+    dev.writes_applied++;
+}
+
+double device_handler::tune_channel(int device_number, bool direction, int channel, double rf_freq) {
+    if (rf_freq < 0) {
+        log_stream() << "ERROR: device_handler::tune_channel(): rf_freq can not be negative."
+                     << std::endl;
+        close_all_devices();
+    }
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    dev.channel_freq[direction][channel] = (rf_freq > 0) ? rf_freq : NAN;
+
+    double freq[2] = {dev.channel_freq[direction][0], dev.channel_freq[direction][1]};
+    if (std::isnan(freq[0]) && std::isnan(freq[1]))
+        return 0;
+    for (int i = 0; i < 2; i++)
+        if (std::isnan(freq[i]))
+            freq[i] = freq[1 - i];
+
+    // NCO can move the channel within the part of RF sample rate not used by the host rate
+    double host_rate = 0, rf_rate = 0;
+    LMS_GetSampleRate(get_device(device_number), direction, channel, &host_rate, &rf_rate);
+    double max_offset = std::max(0.0, (rf_rate - host_rate) / 2);
+
+    double lo = dev.tune_lo[direction];
+    if (std::isnan(lo) || std::fabs(freq[0] - lo) > max_offset ||
+        std::fabs(freq[1] - lo) > max_offset) {
+        lo = (freq[0] + freq[1]) / 2;
+        if (std::fabs(freq[0] - freq[1]) / 2 > max_offset) {
+            log_stream() << "WARNING: device_handler::tune_channel(): channels are "
+                         << std::fabs(freq[0] - freq[1]) / 1e6
+                         << " MHz apart, more than NCO range allows. Increase oversampling or "
+                            "reduce separation, tuning LO to CH"
+                         << channel << "." << std::endl;
+            lo = freq[channel];
+        }
+        double actual = set_rf_freq(device_number, direction, LMS_CH_0, lo);
+        dev.tune_lo[direction] = lo;
+        // Inside batch LO is not tuned yet, offsets are relative to requested value
+        dev.tune_lo_actual[direction] = (dev.batch_depth > 0) ? lo : actual;
+    }
+
+    // Down-shift by the offset on RX, up-shift on TX
+    for (int i = 0; i < 2; i++) {
+        double offset = freq[i] - dev.tune_lo_actual[direction];
+        dev.tune_nco[direction][i] = (direction == LMS_CH_TX) ? offset : -offset;
+        write_nco(device_number,
+                  direction,
+                  i,
+                  dev.user_nco[direction][i] + dev.tune_nco[direction][i]);
+    }
+    return freq[channel];
+}
+
+double device_handler::get_channel_freq(int device_number, bool direction, int channel) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    double freq = dev.channel_freq[direction][channel];
+    if (std::isnan(freq))
+        freq = dev.channel_freq[direction][1 - channel];
+    return std::isnan(freq) ? 0 : freq;
+}
+
+void device_handler::warm_up_tuning(int device_number,
+                                    bool direction,
+                                    int channel,
+                                    const std::vector<double>& freqs) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    lms_device_t* address = get_device(device_number);
+    double current = 0;
+    LMS_GetLOFrequency(address, direction, channel, &current);
+
+    int added = 0;
+    for (double freq : freqs) {
+        if (freq <= 0 || dev.tuning->contains(direction, freq))
+            continue;
+        double value = 0;
+        if (LMS_SetLOFrequency(address, direction, channel, freq) != LMS_SUCCESS)
+            continue;
+        LMS_GetLOFrequency(address, direction, channel, &value);
+        dev.tuning->store(address, direction, channel, freq, value);
+        added++;
+    }
+    // Return to frequency used before warm-up
+    if (added > 0 && current > 0)
+        LMS_SetLOFrequency(address, direction, channel, current);
+
+    std::string s_dir[2] = {"RX", "TX"};
+    log_stream() << "INFO: device_handler::warm_up_tuning(): " << added << " [" << s_dir[direction]
+                 << "] frequencies added to tuning cache." << std::endl;
+}
+
+void device_handler::benchmark_tuning(int device_number,
+                                      bool direction,
+                                      int channel,
+                                      const std::vector<double>& freqs,
+                                      int rounds) {
+    if (freqs.empty() || rounds <= 0)
+        return;
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    warm_up_tuning(device_number, direction, channel, freqs);
+
+    device& dev = device_vector[device_number];
+    lms_device_t* address = get_device(device_number);
+    double current = 0;
+    LMS_GetLOFrequency(address, direction, channel, &current);
+    bool auto_path = dev.applied[direction][channel].antenna <= 0;
+
+    // Same hop sequence with full tuning and with register replay
+    double time[2] = {0, 0};
+    double worst[2] = {0, 0};
+    int mismatches = 0;
+    for (int cached = 0; cached < 2; cached++) {
+        for (int r = 0; r < rounds; r++) {
+            for (double freq : freqs) {
+                auto t_start = std::chrono::steady_clock::now();
+                double value = 0;
+                bool replayed = false;
+                if (cached)
+                    replayed =
+                        dev.tuning->replay(address, direction, channel, freq, auto_path, value);
+                else
+                    LMS_SetLOFrequency(address, direction, channel, freq);
+                double t = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                         t_start)
+                               .count();
+                time[cached] += t;
+                worst[cached] = std::max(worst[cached], t);
+
+                // Replayed registers must put LO where full tuning did, checked in first round
+                if (!cached || r > 0)
+                    continue;
+                double lo = 0;
+                if (replayed)
+                    LMS_GetLOFrequency(address, direction, channel, &lo);
+                if (replayed && std::fabs(lo - value) <= 1)
+                    continue;
+                mismatches++;
+                log_stream() << "ERROR: device_handler::benchmark_tuning(): cached tuning to "
+                             << freq / 1e6 << " MHz ";
+                if (replayed)
+                    log_stream() << "set LO to " << lo / 1e6 << " MHz instead of "
+                                 << value / 1e6 << " MHz." << std::endl;
+                else
+                    log_stream() << "failed." << std::endl;
+            }
+        }
+    }
+    if (current > 0)
+        LMS_SetLOFrequency(address, direction, channel, current);
+
+    double tunes = (double)freqs.size() * rounds;
+    std::string s_dir[2] = {"RX", "TX"};
+    log_stream() << "INFO: device_handler::benchmark_tuning(): [" << s_dir[direction] << "] "
+                 << tunes << " tunes over " << freqs.size() << " frequencies" << std::endl;
+    log_stream() << "full tuning:   avg. " << time[0] / tunes * 1e6 << " us, max. "
+                 << worst[0] * 1e6 << " us" << std::endl;
+    log_stream() << "cached tuning: avg. " << time[1] / tunes * 1e6 << " us, max. "
+                 << worst[1] * 1e6 << " us" << std::endl;
+    if (time[1] > 0)
+        log_stream() << "speedup: " << time[0] / time[1] << "x" << std::endl;
+    log_stream() << "cached LO check: " << freqs.size() - mismatches << " of " << freqs.size()
+                 << " frequencies match full tuning" << std::endl;
+}
+
+void device_handler::begin_batch(int device_number) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device_vector[device_number].batch_depth++;
+}
+
+void device_handler::end_batch(int device_number) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    if (dev.batch_depth == 0 || --dev.batch_depth > 0)
+        return;
+
+    // Apply in order that avoids repeated recalculation: LO first (filter and gain
+    // calibration depend on it), then RF path, filters, NCO and gain last
+    for (int step = 0; step < 6; step++) {
+        for (int dir = 0; dir < 2; dir++) {
+            for (int ch = 0; ch < 2; ch++) {
+                const channel_config& want = dev.pending[dir][ch];
+                const channel_config& have = dev.applied[dir][ch];
+                switch (step) {
+                case 0:
+                    if (std::isnan(want.rf_freq))
+                        break;
+                    if (want.rf_freq != have.rf_freq)
+                        apply_rf_freq(device_number, dir, ch, want.rf_freq);
+                    else
+                        dev.writes_skipped++;
+                    break;
+                case 1:
+                    if (want.antenna < 0)
+                        break;
+                    if (want.antenna != have.antenna)
+                        apply_antenna(device_number, ch, dir, want.antenna);
+                    else
+                        dev.writes_skipped++;
+                    break;
+                case 2:
+                    if (std::isnan(want.analog_bandw))
+                        break;
+                    if (want.analog_bandw != have.analog_bandw)
+                        apply_analog_filter(device_number, dir, ch, want.analog_bandw);
+                    else
+                        dev.writes_skipped++;
+                    break;
+                case 3:
+                    if (std::isnan(want.digital_bandw))
+                        break;
+                    if (want.digital_bandw != have.digital_bandw)
+                        apply_digital_filter(device_number, dir, ch, want.digital_bandw);
+                    else
+                        dev.writes_skipped++;
+                    break;
+                case 4:
+                    if (std::isnan(want.nco_freq))
+                        break;
+                    if (want.nco_freq != have.nco_freq)
+                        apply_nco(device_number, dir, ch, want.nco_freq);
+                    else
+                        dev.writes_skipped++;
+                    break;
+                case 5:
+                    if (want.gain < 0)
+                        break;
+                    if (want.gain != have.gain)
+                        apply_gain(device_number, dir, ch, want.gain);
+                    else
+                        dev.writes_skipped++;
+                    break;
+                }
+            }
+        }
+    }
+    for (int dir = 0; dir < 2; dir++)
+        for (int ch = 0; ch < 2; ch++)
+            dev.pending[dir][ch] = channel_config();
+}
+
+void device_handler::invalidate_config(int device_number) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    for (int dir = 0; dir < 2; dir++) {
+        for (int ch = 0; ch < 2; ch++) {
+            dev.applied[dir][ch] = channel_config();
+            dev.actual[dir][ch] = channel_config();
+        }
     }
 }
 
+void device_handler::invalidate_antenna(int device_number, bool direction, int channel) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    dev.applied[direction][channel].antenna = -1;
+    dev.actual[direction][channel].antenna = -1;
+}
+
+void device_handler::get_config_stats(int device_number, uint64_t& applied, uint64_t& skipped) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    applied = device_vector[device_number].writes_applied;
+    skipped = device_vector[device_number].writes_skipped;
+}
+
 void device_handler::disable_DC_corrections(int device_number) {
     LMS_WriteParam(device_handler::getInstance().get_device(device_number), LMS7_DC_BYP_RXTSP, 1);
     LMS_WriteParam(device_handler::getInstance().get_device(device_number), LMS7_DCLOOP_STOP, 1);
@@ -541,7 +1246,7 @@ void device_handler::disable_DC_corrections(int device_number) {
 
 void device_handler::set_tcxo_dac(int device_number, uint16_t dacVal) {
     if (dacVal >= 0 && dacVal <= 65535) {
-        std::cout << "INFO: device_handler::set_tcxo_dac(): ";
+        log_stream() << "INFO: device_handler::set_tcxo_dac(): ";
         float_type dac_value = dacVal;
 
         LMS_WriteCustomBoardParam(
@@ -552,29 +1257,290 @@ void device_handler::set_tcxo_dac(int device_number, uint16_t dacVal) {
                                  &dac_value,
                                  NULL);
 
-        std::cout << "VCTCXO DAC value set to: " << dac_value << std::endl;
+        log_stream() << "VCTCXO DAC value set to: " << dac_value << std::endl;
+        device_vector[device_number].tcxo_dac = dacVal;
     } else {
-        std::cout << "ERROR: device_handler::set_tcxo_dac(): valid range [0, 65535]" << std::endl;
+        log_stream() << "ERROR: device_handler::set_tcxo_dac(): valid range [0, 65535]"
+                     << std::endl;
         close_all_devices();
     }
 }
 
-void device_handler::set_rfe_device(rfe_dev_t* rfe_dev) { rfe_device.rfe_dev = rfe_dev; }
+void device_handler::set_time_source(int device_number, int source, double param) {
+    log_stream() << "INFO: device_handler::set_time_source(): ";
+    device_vector[device_number].sync->set_source(source, param);
+    std::string s_source[4] = {"NONE", "SYSTEM", "PPS_GPIO", "SIMULATED"};
+    log_stream() << "time source set to "
+                 << s_source[device_vector[device_number].sync->get_source()] << "." << std::endl;
+}
+
+time_sync& device_handler::get_time_sync(int device_number) {
+    return *device_vector[device_number].sync;
+}
+
+device_telemetry& device_handler::get_telemetry(int device_number) {
+    return *device_vector[device_number].telemetry;
+}
+
+void device_handler::set_rfe_device(int device_number, rfe_dev_t* rfe_dev) {
+    rfe_link& rfe = *device_vector[device_number].rfe;
+    std::lock_guard<std::mutex> lock(rfe.mutex);
+    if (rfe_dev && rfe.rfe_dev && rfe.rfe_dev != rfe_dev)
+        log_stream() << "WARNING: device_handler::set_rfe_device(): device number "
+                     << device_number << " already has LimeRFE, replacing it." << std::endl;
+    rfe.rfe_dev = rfe_dev;
+}
 
-void device_handler::update_rfe_channels()
+void device_handler::update_rfe_channels(int device_number)
 {
-    if (rfe_device.rfe_dev) {
-        std::cout << "INFO: device_handler::update_rfe_channels(): ";
-        if (RFE_AssignSDRChannels(
-                rfe_device.rfe_dev, rfe_device.rx_channel, rfe_device.tx_channel) != 0) {
-            std::cout << std::endl << "ERROR: Failed to assign SDR channels" << std::endl;
+    rfe_link& rfe = *device_vector[device_number].rfe;
+    std::lock_guard<std::mutex> lock(rfe.mutex);
+    if (rfe.rfe_dev) {
+        log_stream() << "INFO: device_handler::update_rfe_channels(): ";
+        if (RFE_AssignSDRChannels(rfe.rfe_dev, rfe.rx_channel, rfe.tx_channel) != 0) {
+            log_stream() << std::endl << "ERROR: Failed to assign SDR channels" << std::endl;
             return;
         }
-        std::cout << "RFE RX channel: " << rfe_device.rx_channel
-                  << " TX channel: " << rfe_device.tx_channel << std::endl;
+        log_stream() << "device number " << device_number << " RFE RX channel: "
+                     << rfe.rx_channel << " TX channel: " << rfe.tx_channel << std::endl;
     } else {
-        std::cout
-            << "ERROR: device_handler::update_rfe_channels(): no assigned RFE device"
-            << std::endl;
+        log_stream()
+               << "ERROR: device_handler::update_rfe_channels(): no assigned RFE device"
+               << std::endl;
+    }
+}
+
+void device_handler::set_rfe_tdd(int device_number, std::shared_ptr<rfe_tdd> tdd) {
+    std::atomic_store(&device_vector[device_number].rfe->tdd, tdd);
+}
+
+std::shared_ptr<rfe_tdd> device_handler::get_rfe_tdd(int device_number) {
+    // Read by sink work thread at each burst, set from flow graph thread
+    return std::atomic_load(&device_vector[device_number].rfe->tdd);
+}
+
+// Serial field of LMS_GetDeviceList entry
+static std::string info_serial(const std::string& info) {
+    size_t first = info.find("serial=");
+    if (first == std::string::npos)
+        return info;
+    first += 7;
+    size_t end = info.find(",", first);
+    return info.substr(first, end - first);
+}
+
+int device_handler::refresh_devices() {
+    // Enumeration may take a while on USB, streams keep going meanwhile
+    int count = LMS_GetDeviceList(NULL);
+    std::unique_ptr<lms_info_str_t[]> found(new lms_info_str_t[std::max(count, 1)]);
+    if (count > 0)
+        count = LMS_GetDeviceList(found.get());
+
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    if (count < 0) {
+        log_stream() << "ERROR: device_handler::refresh_devices(): device enumeration failed."
+                     << std::endl;
+        return count;
+    }
+    device_vector.reserve(MAX_DEVICES);
+    std::vector<bool> present(device_vector.size(), false);
+    for (int i = 0; i < count; i++) {
+        std::string info(found[i]);
+        std::string serial = info_serial(info);
+        size_t device_number = 0;
+        while (device_number < device_vector.size() &&
+               device_vector[device_number].serial != serial)
+            device_number++;
+        if (device_number == device_vector.size()) {
+            if (device_vector.size() == MAX_DEVICES) {
+                log_stream() << "WARNING: device_handler::refresh_devices(): more than "
+                             << MAX_DEVICES << " devices, " << serial << " is not used."
+                             << std::endl;
+                continue;
+            }
+            device_vector.push_back(device());
+            device_vector.back().serial = serial;
+            present.push_back(false);
+        }
+        device& dev = device_vector[device_number];
+        if (!dev.present && list_read) {
+            log_stream() << "INFO: device_handler::refresh_devices(): device " << serial
+                         << " present as device number " << device_number << "." << std::endl;
+        }
+        // Address of a replugged device may change
+        dev.info = info;
+        dev.present = true;
+        present[device_number] = true;
+    }
+    for (size_t i = 0; i < device_vector.size(); i++) {
+        if (device_vector[i].present && !present[i]) {
+            log_stream() << "WARNING: device_handler::refresh_devices(): device "
+                         << device_vector[i].serial << " (device number " << i
+                         << ") removed." << std::endl;
+            device_vector[i].present = false;
+        }
+    }
+    return count;
+}
+
+void device_handler::start_discovery(double interval) {
+    stop_discovery();
+    if (interval <= 0)
+        return;
+    std::lock_guard<std::mutex> lock(discovery_mutex);
+    discovery_interval = interval;
+    discovery_running = true;
+    discovery_thread = std::thread(&device_handler::discovery_loop, this);
+}
+
+void device_handler::stop_discovery() {
+    {
+        std::lock_guard<std::mutex> lock(discovery_mutex);
+        discovery_running = false;
+        discovery_cv.notify_all();
+    }
+    if (discovery_thread.joinable())
+        discovery_thread.join();
+}
+
+void device_handler::discovery_loop() {
+    std::unique_lock<std::mutex> lock(discovery_mutex);
+    while (discovery_running) {
+        lock.unlock();
+        refresh_devices();
+        lock.lock();
+        discovery_cv.wait_for(lock,
+                              std::chrono::duration<double>(discovery_interval),
+                              [this] { return !discovery_running; });
+    }
+}
+
+int device_handler::find_device(const std::string& serial) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    for (size_t i = 0; i < device_vector.size(); i++) {
+        if (serial.empty() ? device_vector[i].present : device_vector[i].serial == serial)
+            return i;
+    }
+    return -1;
+}
+
+bool device_handler::device_lost(int device_number, uint64_t generation) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    device& dev = device_vector[device_number];
+    if (dev.generation != generation || dev.address == NULL)
+        return true;
+    // Chip version register is readable whenever the board is connected
+    uint16_t value;
+    return LMS_ReadLMSReg(dev.address, 0x002F, &value) != LMS_SUCCESS;
+}
+
+bool device_handler::reconnect_device(int device_number, uint64_t& generation, double timeout) {
+    device& dev = device_vector[device_number];
+    {
+        std::lock_guard<std::recursive_mutex> lock(block_mutex);
+        // Other block has already reconnected
+        if (dev.generation != generation && dev.address != NULL) {
+            generation = dev.generation;
+            return true;
+        }
+        if (dev.address != NULL) {
+            log_stream() << "WARNING: device_handler::reconnect_device(): lost device "
+                         << dev.serial << " (device number " << device_number << ")."
+                         << std::endl;
+            dev.telemetry->attach(NULL, NULL, "", device_number);
+            dev.retired.push_back(dev.address);
+            dev.address = NULL;
+        }
+    }
+
+    // Wait for the serial to be enumerated again, address may differ after replugging. Lock
+    // is held only to open the device, so that blocks on other devices keep running.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout);
+    while (true) {
+        refresh_devices();
+        {
+            std::lock_guard<std::recursive_mutex> lock(block_mutex);
+            // Opened by other block meanwhile
+            if (dev.address != NULL) {
+                generation = dev.generation;
+                return true;
+            }
+            lms_device_t* address = NULL;
+            if (dev.present && LMS_Open(&address, dev.info.c_str(), NULL) == LMS_SUCCESS) {
+                auto t_open = std::chrono::steady_clock::now();
+                dev.address = address;
+                LMS_Init(address);
+                restore_config(device_number);
+                dev.telemetry->attach(address, &block_mutex, dev.serial, device_number);
+                generation = ++dev.generation;
+                double elapsed =
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - t_open)
+                        .count();
+                log_stream() << "INFO: device_handler::reconnect_device(): device " << dev.serial
+                             << " open again, settings restored in " << elapsed * 1e3 << " ms."
+                             << std::endl;
+                return true;
+            }
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            log_stream() << "WARNING: device_handler::reconnect_device(): device " << dev.serial
+                         << " did not reappear within " << timeout << " s." << std::endl;
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+void device_handler::restore_config(int device_number) {
+    device& dev = device_vector[device_number];
+    // Loaded file first, settings made after loading it go on top
+    const std::string& filename = dev.source_flag ? dev.source_filename : dev.sink_filename;
+    if (!filename.empty() && LMS_LoadConfig(dev.address, filename.c_str()) != LMS_SUCCESS)
+        log_stream() << "WARNING: device_handler::restore_config(): failed to load " << filename
+                     << "." << std::endl;
+
+    int channel_mode[2] = {dev.source_flag ? dev.source_channel_mode : -1,
+                           dev.sink_flag ? dev.sink_channel_mode : -1};
+    for (int direction = 0; direction < 2; direction++)
+        if (channel_mode[direction] >= 0)
+            enable_channels(device_number, channel_mode[direction], direction);
+
+    // Sample rate writes NCOs and GFIRs again
+    dev.tuning->clear();
+    int oversample = dev.oversample;
+    if (dev.samp_rate > 0) {
+        double rate = dev.samp_rate;
+        set_samp_rate(device_number, rate);
+    }
+    if (oversample >= 0)
+        set_oversampling(device_number, oversample);
+
+    for (int dir = 0; dir < 2; dir++) {
+        for (int ch = 0; ch < 2; ch++) {
+            // Copy, apply functions record into restore
+            channel_config want = dev.restore[dir][ch];
+            // LO is shared, tuned once per direction
+            if (!std::isnan(want.rf_freq) && std::isnan(dev.applied[dir][ch].rf_freq))
+                apply_rf_freq(device_number, dir, ch, want.rf_freq);
+            if (want.antenna >= 0)
+                apply_antenna(device_number, ch, dir, want.antenna);
+            if (!std::isnan(want.analog_bandw))
+                apply_analog_filter(device_number, dir, ch, want.analog_bandw);
+            // Custom GFIR set after the digital filter replaces it
+            bool custom_gfir = false;
+            for (const gfir_config& config : dev.gfir[dir][ch])
+                custom_gfir |= !config.taps.empty();
+            if (!std::isnan(want.digital_bandw) && !custom_gfir)
+                apply_digital_filter(device_number, dir, ch, want.digital_bandw);
+            if (want.gain >= 0)
+                apply_gain(device_number, dir, ch, want.gain);
+        }
     }
-}
\ No newline at end of file
+    if (dev.tcxo_dac >= 0)
+        set_tcxo_dac(device_number, dev.tcxo_dac);
+}
+
+uint64_t device_handler::get_generation(int device_number) {
+    std::lock_guard<std::recursive_mutex> lock(block_mutex);
+    return device_vector[device_number].generation;
+}
@@ -21,14 +21,25 @@
 #ifndef DEVICE_HANDLER_H
 #define DEVICE_HANDLER_H
 
+#include "fir_design.h"
+#include "rate_planner.h"
+#include "rfe_tdd.h"
+#include "telemetry.h"
+#include "time_sync.h"
+#include "tuning_cache.h"
 #include <LimeSuite.h>
 #include <limeRFE.h>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <iostream>
 #include <list>
 #include <math.h>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #define LMS_CH_0 0
@@ -40,17 +51,71 @@
 
 #define GR_LIMESDR_VER "2.2.7"
 
+// Device numbers of unplugged devices are kept, so the device vector is never reallocated
+// while work threads read from it
+#define MAX_DEVICES 32
+
 class device_handler {
     private:
     int open_devices = 0;
     // Read device list once flag
     bool list_read = false;
-    // Calculate open devices to close them all on close_all_devices
-    int device_count;
+
+    // Requested channel configuration, unset values are NAN or -1
+    struct channel_config {
+        double rf_freq = NAN;
+        int antenna = -1;
+        double analog_bandw = NAN;
+        double digital_bandw = NAN;
+        double nco_freq = NAN;
+        int gain = -1;
+    };
+
+    // Custom GFIR coefficient set, empty taps when not set. Sets given by specification
+    // (spec.passband > 0) are designed again when the sample rate changes.
+    struct gfir_config {
+        std::vector<double> taps;
+        fir_spec spec;
+    };
+
+    // LimeRFE of one SDR device: SDR channels for automatic channel assignment and burst
+    // driven mode switching. Own lock, so that boards on different devices do not wait on
+    // each other.
+    struct rfe_link {
+        std::mutex mutex;
+        int rx_channel = 0;
+        int tx_channel = 0;
+        rfe_dev_t* rfe_dev = nullptr;
+        std::shared_ptr<rfe_tdd> tdd;
+    };
+
+    // Device handle read by work threads while reconnect replaces it. Copyable, so that
+    // device can be kept in a vector.
+    struct device_address {
+        std::atomic<lms_device_t*> value{NULL};
+
+        device_address(){};
+        device_address(const device_address& other) : value(other.value.load()){};
+        device_address& operator=(lms_device_t* address) {
+            value = address;
+            return *this;
+        }
+        operator lms_device_t*() const { return value.load(); }
+    };
 
     struct device {
         // Device address
-        lms_device_t* address = NULL;
+        device_address address;
+
+        // Enumeration result, device keeps its number while unplugged and replugged
+        std::string serial;
+        std::string info;
+        bool present = false;
+        // Handles lost to unplugging. Streams set up on them are still released by their
+        // blocks, so they are closed with the device.
+        std::vector<lms_device_t*> retired;
+        // Incremented by every reconnect
+        uint64_t generation = 0;
 
         // Flags and variables used to check
         // shared settings and blocks usage
@@ -60,17 +125,54 @@ class device_handler {
         int sink_channel_mode = -1;
         std::string source_filename;
         std::string sink_filename;
-    };
 
-    struct rfe_device
-    {
-        int rx_channel = 0;
-        int tx_channel = 0;
-        rfe_dev_t* rfe_dev = nullptr;
-    }rfe_device;
-    // Device list
-    lms_info_str_t* list = new lms_info_str_t[20];
-    // Device vector. Adds devices from the list
+        // Device to UTC time mapping shared by source and sink
+        std::shared_ptr<time_sync> sync = std::make_shared<time_sync>();
+
+        // Health telemetry polled while blocks subscribe to it
+        std::shared_ptr<device_telemetry> telemetry = std::make_shared<device_telemetry>();
+
+        // Synthesizer register sets of visited LO frequencies
+        std::shared_ptr<tuning_cache> tuning = std::make_shared<tuning_cache>();
+
+        // Configuration cache [direction][channel]. Requests equal to the last applied one
+        // return the value read back then without touching hardware.
+        channel_config applied[2][2];
+        channel_config actual[2][2];
+        // Changes collected between begin_batch and end_batch
+        channel_config pending[2][2];
+        int batch_depth = 0;
+        uint64_t writes_applied = 0;
+        uint64_t writes_skipped = 0;
+
+        // Independent channel tuning on shared LO [direction][channel]: requested channel
+        // frequency (NAN follows the other channel), user NCO and NCO part of tuning offset
+        double channel_freq[2][2] = {{NAN, NAN}, {NAN, NAN}};
+        double user_nco[2][2] = {{0, 0}, {0, 0}};
+        double tune_nco[2][2] = {{0, 0}, {0, 0}};
+        // LO selected for channel tuning and its actual value [direction]
+        double tune_lo[2] = {NAN, NAN};
+        double tune_lo_actual[2] = {NAN, NAN};
+
+        // Custom GFIR sets [direction][channel][GFIR1..3]
+        gfir_config gfir[2][2][3];
+
+        // Bandwidth and attenuation planned with each sample rate change [direction],
+        // bandwidth 0 leaves oversampling to LimeSuite
+        double plan_bandw[2] = {0, 0};
+        double plan_attenuation[2] = {60, 60};
+
+        // LimeRFE attached to GPIO of this device
+        std::shared_ptr<rfe_link> rfe = std::make_shared<rfe_link>();
+
+        // Settings written to hardware, applied again after reconnect [direction][channel].
+        // Unlike applied these survive sample rate changes.
+        channel_config restore[2][2];
+        double samp_rate = 0;
+        int oversample = -1;
+        int tcxo_dac = -1;
+    };
+    // Device vector. Adds devices from LMS_GetDeviceList
     std::vector<device> device_vector;
     // Run close_all_devices once with this flag
     bool close_flag = false;
@@ -79,6 +181,31 @@ class device_handler {
     device_handler(device_handler const&);
     void operator=(device_handler const&);
 
+    // Hardware writes behind cached setters
+    double apply_rf_freq(int device_number, bool direction, int channel, double rf_freq);
+    void apply_antenna(int device_number, int channel, int direction, int antenna);
+    double apply_analog_filter(int device_number, bool direction, int channel, double analog_bandw);
+    double
+    apply_digital_filter(int device_number, bool direction, int channel, double digital_bandw);
+    unsigned apply_gain(int device_number, bool direction, int channel, unsigned gain_dB);
+    void apply_nco(int device_number, bool direction, int channel, double nco_freq);
+    void write_nco(int device_number, bool direction, int channel, double nco_freq);
+    bool write_gfir(int device_number, bool direction, int channel, int filter);
+    int plan_oversampling(int device_number, double rate);
+    void apply_rate_plan(int device_number, double rate);
+    void rewrite_gfir(int device_number);
+    void clear_gfir(int device_number, bool direction, int channel);
+    void restore_config(int device_number);
+
+    // Periodic enumeration
+    std::thread discovery_thread;
+    std::mutex discovery_mutex;
+    std::condition_variable discovery_cv;
+    bool discovery_running = false;
+    double discovery_interval = 1;
+
+    void discovery_loop();
+
 
     public:
     static device_handler& getInstance() {
@@ -179,6 +306,22 @@ class device_handler {
      */
     void set_oversampling(int device_number, int oversample);
 
+    /**
+     * Plan clocks for bandwidth on every following sample rate change. Oversampling is
+     * chosen so that all decimation/interpolation runs on chip and GFIR3 can filter the band
+     * to Nyquist with required attenuation, the link budget of all active streams against
+     * the board interface is printed, and a warning is given when the link can not carry it.
+     *
+     * @param   device_number Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   direction  Direction of samples: RX(LMS_CH_RX),TX(LMS_CH_TX).
+     *
+     * @param   bandwidth  Occupied bandwidth in Hz, 0 returns to default oversampling.
+     *
+     * @param   attenuation  GFIR stopband attenuation in dB.
+     */
+    void set_rate_plan(int device_number, bool direction, double bandwidth, double attenuation);
+
     /**
      * Set RF frequency of both channels (RX and TX separately).
      *
@@ -192,7 +335,69 @@ class device_handler {
      *
      * @return  returns RF frequency in Hz
      */
-    double set_rf_freq(int device_number, bool direction, int channel, float rf_freq);
+    double set_rf_freq(int device_number, bool direction, int channel, double rf_freq);
+
+    /**
+     * Tune single channel independently of the other channel of the same direction.
+     * Both channels share one LO, so channel offsets from it are made with the channel NCO
+     * (on top of NCO set by set_nco). LO is only retuned when a channel falls outside
+     * NCO range, then it is placed between both channel frequencies.
+     *
+     * @param   device_number Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   direction  Direction of samples RX(LMS_CH_RX), TX(LMS_CH_TX).
+     *
+     * @param   channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     *
+     * @param   rf_freq  RF frequency in Hz, 0 makes the channel follow the other channel.
+     *
+     * @return  returns channel RF frequency in Hz
+     */
+    double tune_channel(int device_number, bool direction, int channel, double rf_freq);
+
+    /**
+     * Precompute synthesizer settings of frequencies into tuning cache, so that the first
+     * tune to each of them is as fast as revisits. LO is returned to current frequency.
+     *
+     * @param   device_number Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   direction  Direction of samples RX(LMS_CH_RX), TX(LMS_CH_TX).
+     *
+     * @param   channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     *
+     * @param   freqs  LO frequencies in Hz.
+     */
+    void warm_up_tuning(int device_number,
+                        bool direction,
+                        int channel,
+                        const std::vector<double>& freqs);
+
+    /**
+     * Measure retune time over frequencies with full tuning and with tuning cache, and print
+     * average and worst case of both. LO is returned to current frequency.
+     *
+     * @param   device_number Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   direction  Direction of samples RX(LMS_CH_RX), TX(LMS_CH_TX).
+     *
+     * @param   channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     *
+     * @param   freqs  LO frequencies in Hz.
+     *
+     * @param   rounds  Passes over frequency list.
+     */
+    void benchmark_tuning(int device_number,
+                          bool direction,
+                          int channel,
+                          const std::vector<double>& freqs,
+                          int rounds);
+
+    /**
+     * Get frequency of a channel tuned with tune_channel.
+     *
+     * @return  returns channel RF frequency in Hz, 0 if not tuned
+     */
+    double get_channel_freq(int device_number, bool direction, int channel);
 
     /**
      * Perform device calibration.
@@ -249,6 +454,46 @@ class device_handler {
      */
     double set_digital_filter(int device_number, bool direction, int channel, double digital_bandw);
 
+    /**
+     * Upload custom GFIR coefficients and enable the filter. GFIRs run at host sample rate,
+     * GFIR1 and GFIR2 take up to 5 and GFIR3 up to 15 taps per decimation/interpolation step
+     * (at most 40 and 120). Digital filter (set_digital_filter) uses the same GFIRs, the
+     * setting made last is in effect.
+     *
+     * @param   device_number Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   direction  Direction of samples: RX(LMS_CH_RX),TX(LMS_CH_TX).
+     *
+     * @param   channel  Channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     *
+     * @param   filter  GFIR1(1), GFIR2(2), GFIR3(3).
+     *
+     * @param   taps  Coefficients in range [-1, 1], empty disables the filter.
+     */
+    void set_gfir_taps(int device_number,
+                       bool direction,
+                       int channel,
+                       int filter,
+                       const std::vector<double>& taps);
+
+    /**
+     * Design lowpass GFIR coefficients for current sample rate and upload them. Filter is
+     * designed again after sample rate changes. If the specification needs more taps than
+     * the filter allows at current oversampling, the longest possible filter is used.
+     *
+     * @param   device_number Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   direction  Direction of samples: RX(LMS_CH_RX),TX(LMS_CH_TX).
+     *
+     * @param   channel  Channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     *
+     * @param   filter  GFIR1(1), GFIR2(2), GFIR3(3).
+     *
+     * @param   spec  Passband and stopband edges in Hz, ripple and attenuation in dB.
+     */
+    void set_gfir_lowpass(
+        int device_number, bool direction, int channel, int filter, const fir_spec& spec);
+
     /**
      * Set the combined gain value in dB
      * This function computes and sets the optimal gain values of various amplifiers
@@ -267,6 +512,18 @@ class device_handler {
      */
     unsigned set_gain(int device_number, bool direction, int channel, unsigned gain_dB);
 
+    /**
+     * Set receive gain chosen by AGC. Written under block_mutex and recorded in the
+     * configuration cache like set_gain, but without logging every step.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   channel        Channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     *
+     * @param   gain_dB        Gain: [0,73] dB
+     */
+    void set_agc_gain(int device_number, int channel, unsigned gain_dB);
+
     /**
      * Set NCO (numerically controlled oscillator).
      * By selecting NCO frequency
@@ -284,6 +541,49 @@ class device_handler {
 
     void disable_DC_corrections(int device_number);
 
+    /**
+     * Start collecting configuration changes instead of writing them.
+     * Frequency, antenna, filter, NCO and gain setters only store requested values
+     * (and return them) until matching end_batch. Calls may be nested.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     */
+    void begin_batch(int device_number);
+
+    /**
+     * Apply changes collected since begin_batch under one lock, each setting once, in order
+     * LO frequency, antenna, analog filter, digital filter, NCO, gain. Settings equal to the
+     * applied configuration are skipped.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     */
+    void end_batch(int device_number);
+
+    /**
+     * Forget cached configuration, e.g. after it was changed outside device_handler.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     */
+    void invalidate_config(int device_number);
+
+    /**
+     * Forget cached antenna of one channel, other settings stay cached.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   direction      Select RX or TX.
+     *
+     * @param   channel        Channel selection: A(LMS_CH_0),B(LMS_CH_1).
+     */
+    void invalidate_antenna(int device_number, bool direction, int channel);
+
+    /**
+     * Get counters of configuration requests written to hardware and skipped as redundant.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     */
+    void get_config_stats(int device_number, uint64_t& applied, uint64_t& skipped);
+
     /**
      * Set TCXO DAC.
      * @note Care must be taken as this parameter is returned to default value only after power off.
@@ -297,16 +597,111 @@ class device_handler {
      * @param   dacVal		   DAC value (0-65535)
      */
     void set_tcxo_dac(int device_number, uint16_t dacVal);
-        /**
+
+    /**
+     * Select host time source used to convert device timestamps to absolute UTC.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   source  None(0), system clock(1), PPS on GPIO(2), simulated(3).
+     *
+     * @param   param   GPIO pin for PPS source, frequency error in ppm for simulated source.
+     */
+    void set_time_source(int device_number, int source, double param);
+
+    /**
+     * Get device time synchronization object.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     */
+    time_sync& get_time_sync(int device_number);
+
+    /**
+     * Get device health telemetry object.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     */
+    device_telemetry& get_telemetry(int device_number);
+    /**
      * Sets up LimeRFE device pointer so that automatic channel configuration could be made
-     * @param   rfe_dev  Pointer to LimeRFE device descriptor
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   rfe_dev  Pointer to LimeRFE device descriptor, nullptr when LimeRFE is closed
      */
-    void set_rfe_device(rfe_dev_t* rfe_dev);
+    void set_rfe_device(int device_number, rfe_dev_t* rfe_dev);
     /**
      * Assigns configured LimeSDR channels to LimeRFE for automatic channel switching
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
      */
-    void update_rfe_channels();
+    void update_rfe_channels(int device_number);
+    /**
+     * Let sink bursts on SDR device switch LimeRFE mode.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   tdd  Mode switcher of LimeRFE, nullptr to stop sink from switching.
+     */
+    void set_rfe_tdd(int device_number, std::shared_ptr<rfe_tdd> tdd);
+    /**
+     * Get LimeRFE mode switcher driven by sink bursts on device.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     *
+     * @return  switcher, nullptr when LimeRFE on this device does not use TDD
+     */
+    std::shared_ptr<rfe_tdd> get_rfe_tdd(int device_number);
 
+    /**
+     * Enumerate devices again. Known serials keep their device number, new ones are
+     * appended, unplugged ones are marked as not present.
+     *
+     * @return  number of devices present, negative on enumeration error
+     */
+    int refresh_devices();
+    /**
+     * Enumerate devices in background, so that arrivals and removals are logged and device
+     * list is current when a block reconnects.
+     *
+     * @param   interval  Enumeration interval in seconds, 0 stops enumeration.
+     */
+    void start_discovery(double interval);
+    void stop_discovery();
+    /**
+     * Find device number of a serial from the last enumeration.
+     *
+     * @param   serial  Device serial, empty for the first present device.
+     *
+     * @return  device number, -1 if serial is not known
+     */
+    int find_device(const std::string& serial);
+    /**
+     * Check whether streams of a block no longer reach the device.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   generation  Device generation the block streams were set up on.
+     *
+     * @return  true if device was reconnected since or current handle does not respond
+     */
+    bool device_lost(int device_number, uint64_t generation);
+    /**
+     * Open device again under its serial and apply last settings. Blocks release their
+     * streams before and set them up again after, the first block to call it reopens the
+     * device and others only pick up the new generation. Must be called without holding
+     * block_mutex, the lock is released while waiting.
+     *
+     * @param   device_number  Device number from the list of LMS_GetDeviceList.
+     *
+     * @param   generation  Generation of the caller streams, updated on success.
+     *
+     * @param   timeout  Time to wait for the device to reappear in seconds.
+     *
+     * @return  true when device is open again
+     */
+    bool reconnect_device(int device_number, uint64_t& generation, double timeout);
+    uint64_t get_generation(int device_number);
 };
 
 
@@ -0,0 +1,78 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "fir_design.h"
+#include <algorithm>
+#include <cmath>
+
+// Zeroth order modified Bessel function of the first kind
+static double bessel_i0(double x) {
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+fir_design design_lowpass(double samp_rate, const fir_spec& spec, size_t max_taps) {
+    fir_design result;
+
+    // Passband ripple as peak deviation, window method meets the smaller deviation in both bands
+    double ripple_gain = std::pow(10, spec.ripple / 20);
+    double delta_pass = (ripple_gain - 1) / (ripple_gain + 1);
+    double delta_stop = std::pow(10, -spec.attenuation / 20);
+    double a = -20 * std::log10(std::min(delta_pass, delta_stop));
+
+    // Kaiser length estimate from attenuation and normalized transition width
+    double transition = 2 * M_PI * (spec.stopband - spec.passband) / samp_rate;
+    result.required_taps = (size_t)std::ceil((a - 8) / (2.285 * transition)) + 1;
+    size_t taps = std::max<size_t>(std::min(result.required_taps, max_taps), 1);
+    result.attenuation =
+        (taps < result.required_taps) ? 2.285 * (taps - 1) * transition + 8 : a;
+    a = std::min(a, result.attenuation);
+
+    double beta = 0;
+    if (a > 50)
+        beta = 0.1102 * (a - 8.7);
+    else if (a >= 21)
+        beta = 0.5842 * std::pow(a - 21, 0.4) + 0.07886 * (a - 21);
+
+    // Windowed sinc with cutoff in the middle of the transition band
+    double cutoff = (spec.passband + spec.stopband) / samp_rate;
+    double center = (taps - 1) / 2.0;
+    double norm = bessel_i0(beta);
+    double sum = 0;
+    result.taps.resize(taps);
+    for (size_t n = 0; n < taps; n++) {
+        double x = n - center;
+        double sinc = (x == 0) ? 1 : std::sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+        double r = (center > 0) ? x / center : 0;
+        double window = bessel_i0(beta * std::sqrt(std::max(0.0, 1 - r * r))) / norm;
+        result.taps[n] = cutoff * sinc * window;
+        sum += result.taps[n];
+    }
+    for (double& tap : result.taps)
+        tap /= sum;
+    return result;
+}
@@ -0,0 +1,65 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef FIR_DESIGN_H
+#define FIR_DESIGN_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Lowpass filter specification.
+ */
+struct fir_spec {
+    // Passband and stopband edges in Hz
+    double passband = 0;
+    double stopband = 0;
+    // Passband ripple in dB peak to peak
+    double ripple = 0.1;
+    // Stopband attenuation in dB
+    double attenuation = 60;
+};
+
+/**
+ * Result of a filter design.
+ */
+struct fir_design {
+    std::vector<double> taps;
+    // Taps needed to meet the specification, more than taps.size() if it was limited
+    size_t required_taps = 0;
+    // Stopband attenuation reached with the designed length in dB
+    double attenuation = 0;
+};
+
+/**
+ * Kaiser window lowpass design. Window method gives equal ripple in passband and stopband,
+ * so the tighter of ripple and attenuation sets the filter length. Taps are normalized to
+ * unity DC gain.
+ *
+ * @param   samp_rate  Sample rate the filter runs at in Hz.
+ *
+ * @param   spec  Filter specification, edges must satisfy 0 < passband < stopband <= rate/2.
+ *
+ * @param   max_taps  Length limit, shorter filter with less attenuation is designed if the
+ *                    specification needs more.
+ */
+fir_design design_lowpass(double samp_rate, const fir_spec& spec, size_t max_taps);
+
+#endif
@@ -0,0 +1,147 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "iq_correction.h"
+#include <algorithm>
+#include <cmath>
+
+iq_corrector::iq_corrector(double samp_rate, double time_constant)
+    : samp_rate(samp_rate), time_constant(time_constant) {
+    span = std::max(1.0, samp_rate * time_constant);
+}
+
+void iq_corrector::set_samp_rate(double rate) {
+    samp_rate = rate;
+    span = std::max(1.0, samp_rate * time_constant);
+    state.weight = std::min(state.weight, span);
+}
+
+void iq_corrector::set_time_constant(double seconds) {
+    time_constant = seconds;
+    this->set_samp_rate(samp_rate);
+}
+
+void iq_corrector::select(double rf_freq, unsigned gain) {
+    // Frequencies within 1 kHz share state
+    cache_key new_key(llround(rf_freq / 1e3), gain);
+    if (has_key && new_key == key)
+        return;
+
+    if (has_key && state.weight > 0) {
+        if (cache.size() >= cache_size && cache.find(key) == cache.end()) {
+            auto oldest = cache.begin();
+            for (auto it = cache.begin(); it != cache.end(); ++it)
+                if (it->second.used < oldest->second.used)
+                    oldest = it;
+            cache.erase(oldest);
+        }
+        cache_entry& entry = cache[key];
+        entry.state = state;
+        entry.used = ++use_counter;
+    }
+
+    key = new_key;
+    has_key = true;
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        state = it->second.state;
+        state.weight = std::min(state.weight, span);
+        it->second.used = ++use_counter;
+        hits++;
+    } else {
+        state = iq_state();
+        misses++;
+    }
+    this->update_coeffs();
+}
+
+void iq_corrector::process(float* iq, size_t count) {
+    if (count == 0)
+        return;
+    iq_sums sums;
+    if (state.weight < span) {
+        // Average still filling, correct buffer with its own estimate
+        sum_iq(iq, count, sums);
+        this->update(sums, count);
+        correct_iq(iq, count, coeffs);
+    } else {
+        correct_sum_iq(iq, count, coeffs, sums);
+        this->update(sums, count);
+    }
+}
+
+void iq_corrector::update(const iq_sums& sums, size_t count) {
+    // Cumulative average until span samples are in, exponential over span after that
+    double weight = std::min(state.weight + count, span);
+    double a = std::min(1.0, count / weight);
+    double n = (double)count;
+    state.mean_i += a * (sums.i / n - state.mean_i);
+    state.mean_q += a * (sums.q / n - state.mean_q);
+    state.power_i += a * (sums.ii / n - state.power_i);
+    state.power_q += a * (sums.qq / n - state.power_q);
+    state.cross += a * (sums.iq / n - state.cross);
+    state.weight = weight;
+    this->update_coeffs();
+}
+
+void iq_corrector::update_coeffs() {
+    double var_i = state.power_i - state.mean_i * state.mean_i;
+    double var_q = state.power_q - state.mean_q * state.mean_q;
+    double cov = state.cross - state.mean_i * state.mean_q;
+
+    // Q component correlated with I is phase error, remaining Q power against I power is
+    // gain error
+    double i_to_q = 0;
+    double scale_q = 1;
+    if (var_i > 1e-20) {
+        i_to_q = cov / var_i;
+        double residual = var_q - cov * i_to_q;
+        if (residual > 1e-20)
+            scale_q = std::sqrt(var_i / residual);
+        else
+            i_to_q = 0;
+    }
+
+    // I' = I - dc_i, Q' = scale_q * ((Q - dc_q) - i_to_q * (I - dc_i))
+    coeffs.offset_i = -state.mean_i;
+    coeffs.scale_q = scale_q;
+    coeffs.i_to_q = -scale_q * i_to_q;
+    coeffs.offset_q = scale_q * (i_to_q * state.mean_i - state.mean_q);
+}
+
+void iq_corrector::get_estimate(double& dc_i,
+                                double& dc_q,
+                                double& gain_error,
+                                double& phase_error) const {
+    dc_i = state.mean_i;
+    dc_q = state.mean_q;
+    double var_i = state.power_i - state.mean_i * state.mean_i;
+    double var_q = state.power_q - state.mean_q * state.mean_q;
+    double cov = state.cross - state.mean_i * state.mean_q;
+    if (var_i <= 1e-20 || var_q <= 1e-20) {
+        gain_error = 0;
+        phase_error = 0;
+        return;
+    }
+    gain_error = 10 * std::log10(var_q / var_i);
+    // Correlation of I and Q is sine of phase error for a circular signal
+    double rho = std::max(-1.0, std::min(1.0, cov / std::sqrt(var_i * var_q)));
+    phase_error = std::asin(rho) * 180 / M_PI;
+}
@@ -0,0 +1,279 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef IQ_CORRECTION_H
+#define IQ_CORRECTION_H
+
+#include "sample_stats.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <utility>
+
+/**
+ * Raw first and second order sums of I/Q samples.
+ */
+struct iq_sums {
+    double i = 0;
+    double q = 0;
+    double ii = 0;
+    double qq = 0;
+    double iq = 0;
+};
+
+/**
+ * Correction applied to each sample:
+ * I' = I + offset_i, Q' = scale_q * Q + i_to_q * I + offset_q.
+ * Removes DC offset, then the part of Q correlated with I (phase error) and scales Q to the
+ * power of I (gain error).
+ */
+struct iq_coeffs {
+    float offset_i = 0;
+    float offset_q = 0;
+    float scale_q = 1;
+    float i_to_q = 0;
+};
+
+// Lane sums are flushed to double this often so float sums keep their precision
+#define IQ_FLUSH_MASK 0xFFF
+
+inline void flush_lanes(float* lanes, double& total) {
+    for (int j = 0; j < SAMPLE_STATS_LANES; j++) {
+        total += lanes[j];
+        lanes[j] = 0;
+    }
+}
+
+/**
+ * Add sums of a buffer of uncorrected samples.
+ *
+ * @param   iq  Interleaved I/Q float samples.
+ *
+ * @param   count  Sample count.
+ *
+ * @param   sums  Sums are added to it.
+ */
+inline void sum_iq(const float* iq, size_t count, iq_sums& sums) {
+    float si[SAMPLE_STATS_LANES] = {0}, sq[SAMPLE_STATS_LANES] = {0};
+    float sii[SAMPLE_STATS_LANES] = {0}, sqq[SAMPLE_STATS_LANES] = {0};
+    float siq[SAMPLE_STATS_LANES] = {0};
+
+    size_t i = 0;
+    for (; i + SAMPLE_STATS_LANES <= count; i += SAMPLE_STATS_LANES) {
+        const float* v = iq + 2 * i;
+        for (int j = 0; j < SAMPLE_STATS_LANES; j++) {
+            float re = v[2 * j];
+            float im = v[2 * j + 1];
+            si[j] += re;
+            sq[j] += im;
+            sii[j] += re * re;
+            sqq[j] += im * im;
+            siq[j] += re * im;
+        }
+        if ((i & IQ_FLUSH_MASK) == 0) {
+            flush_lanes(si, sums.i);
+            flush_lanes(sq, sums.q);
+            flush_lanes(sii, sums.ii);
+            flush_lanes(sqq, sums.qq);
+            flush_lanes(siq, sums.iq);
+        }
+    }
+    for (; i < count; i++) {
+        float re = iq[2 * i];
+        float im = iq[2 * i + 1];
+        si[0] += re;
+        sq[0] += im;
+        sii[0] += re * re;
+        sqq[0] += im * im;
+        siq[0] += re * im;
+    }
+    flush_lanes(si, sums.i);
+    flush_lanes(sq, sums.q);
+    flush_lanes(sii, sums.ii);
+    flush_lanes(sqq, sums.qq);
+    flush_lanes(siq, sums.iq);
+}
+
+/**
+ * Correct a buffer in place.
+ *
+ * @param   iq  Interleaved I/Q float samples.
+ *
+ * @param   count  Sample count.
+ *
+ * @param   c  Correction coefficients.
+ */
+inline void correct_iq(float* iq, size_t count, const iq_coeffs& c) {
+    size_t i = 0;
+    for (; i + SAMPLE_STATS_LANES <= count; i += SAMPLE_STATS_LANES) {
+        float* v = iq + 2 * i;
+        for (int j = 0; j < SAMPLE_STATS_LANES; j++) {
+            float re = v[2 * j];
+            float im = v[2 * j + 1];
+            v[2 * j] = re + c.offset_i;
+            v[2 * j + 1] = c.scale_q * im + c.i_to_q * re + c.offset_q;
+        }
+    }
+    for (; i < count; i++) {
+        float re = iq[2 * i];
+        float im = iq[2 * i + 1];
+        iq[2 * i] = re + c.offset_i;
+        iq[2 * i + 1] = c.scale_q * im + c.i_to_q * re + c.offset_q;
+    }
+}
+
+/**
+ * Correct a buffer in place and add sums of the uncorrected samples, in a single pass.
+ */
+inline void correct_sum_iq(float* iq, size_t count, const iq_coeffs& c, iq_sums& sums) {
+    float si[SAMPLE_STATS_LANES] = {0}, sq[SAMPLE_STATS_LANES] = {0};
+    float sii[SAMPLE_STATS_LANES] = {0}, sqq[SAMPLE_STATS_LANES] = {0};
+    float siq[SAMPLE_STATS_LANES] = {0};
+
+    size_t i = 0;
+    for (; i + SAMPLE_STATS_LANES <= count; i += SAMPLE_STATS_LANES) {
+        float* v = iq + 2 * i;
+        for (int j = 0; j < SAMPLE_STATS_LANES; j++) {
+            float re = v[2 * j];
+            float im = v[2 * j + 1];
+            si[j] += re;
+            sq[j] += im;
+            sii[j] += re * re;
+            sqq[j] += im * im;
+            siq[j] += re * im;
+            v[2 * j] = re + c.offset_i;
+            v[2 * j + 1] = c.scale_q * im + c.i_to_q * re + c.offset_q;
+        }
+        if ((i & IQ_FLUSH_MASK) == 0) {
+            flush_lanes(si, sums.i);
+            flush_lanes(sq, sums.q);
+            flush_lanes(sii, sums.ii);
+            flush_lanes(sqq, sums.qq);
+            flush_lanes(siq, sums.iq);
+        }
+    }
+    for (; i < count; i++) {
+        float re = iq[2 * i];
+        float im = iq[2 * i + 1];
+        si[0] += re;
+        sq[0] += im;
+        sii[0] += re * re;
+        sqq[0] += im * im;
+        siq[0] += re * im;
+        iq[2 * i] = re + c.offset_i;
+        iq[2 * i + 1] = c.scale_q * im + c.i_to_q * re + c.offset_q;
+    }
+    flush_lanes(si, sums.i);
+    flush_lanes(sq, sums.q);
+    flush_lanes(sii, sums.ii);
+    flush_lanes(sqq, sums.qq);
+    flush_lanes(siq, sums.iq);
+}
+
+/**
+ * Averaged moments of uncorrected samples of one frequency and gain.
+ */
+struct iq_state {
+    double mean_i = 0;
+    double mean_q = 0;
+    double power_i = 0;
+    double power_q = 0;
+    double cross = 0;
+    // Samples in the average, grows up to averaging span
+    double weight = 0;
+};
+
+/**
+ * Host DC offset and IQ imbalance corrector of one receive channel.
+ * Moments are averaged cumulatively after a reset and exponentially over time_constant once
+ * that many samples are in, so the first buffer at a new frequency already gets a full
+ * estimate. While the average is still filling, each buffer is estimated before it is
+ * corrected; after that estimation and correction run fused in one pass using the previous
+ * estimate. Converged state is kept per frequency and gain, revisits start from it.
+ * IQ imbalance estimation assumes a circular signal (noise or several signals), a single
+ * strong tone is not corrected correctly.
+ */
+class iq_corrector {
+    private:
+    // States kept in cache, least recently used is dropped
+    static const size_t cache_size = 256;
+
+    struct cache_entry {
+        iq_state state;
+        uint64_t used;
+    };
+    typedef std::pair<int64_t, unsigned> cache_key;
+
+    double samp_rate;
+    double time_constant;
+    double span;
+
+    iq_state state;
+    iq_coeffs coeffs;
+
+    bool has_key = false;
+    cache_key key;
+    std::map<cache_key, cache_entry> cache;
+    uint64_t use_counter = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    void update(const iq_sums& sums, size_t count);
+    void update_coeffs();
+
+    public:
+    /**
+     * @param   time_constant  Averaging time in seconds.
+     */
+    iq_corrector(double samp_rate, double time_constant);
+
+    /**
+     * Select state of frequency and gain. Current state is stored, state of new frequency and
+     * gain is taken from cache or estimation starts over. Does nothing if they are unchanged.
+     */
+    void select(double rf_freq, unsigned gain);
+
+    /**
+     * Estimate and correct a buffer in place.
+     *
+     * @param   iq  Interleaved I/Q float samples.
+     *
+     * @param   count  Sample count.
+     */
+    void process(float* iq, size_t count);
+
+    void set_samp_rate(double rate);
+
+    void set_time_constant(double seconds);
+
+    /**
+     * Current estimate.
+     *
+     * @param   gain_error  Q to I amplitude ratio in dB.
+     *
+     * @param   phase_error  Q axis deviation from orthogonal in degrees.
+     */
+    void get_estimate(double& dc_i, double& dc_q, double& gain_error, double& phase_error) const;
+
+    uint64_t get_hits() const { return hits; }
+    uint64_t get_misses() const { return misses; }
+};
+
+#endif
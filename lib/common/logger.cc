@@ -0,0 +1,247 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "logger.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <gnuradio/logger.h>
+#include <iostream>
+#include <streambuf>
+#include <string>
+
+const size_t async_logger::message_size;
+
+async_logger::async_logger() : slots(new slot[queue_size]) {
+    for (size_t i = 0; i < queue_size; i++)
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+
+    const char* target = std::getenv("GR_LIMESDR_LOG");
+    to_gr = target && std::string(target) == "gr";
+    const char* level = std::getenv("GR_LIMESDR_LOG_LEVEL");
+    if (level) {
+        std::string s_level(level);
+        if (s_level == "debug")
+            min_level = LOG_LEVEL_DEBUG;
+        else if (s_level == "warning")
+            min_level = LOG_LEVEL_WARNING;
+        else if (s_level == "error")
+            min_level = LOG_LEVEL_ERROR;
+    }
+
+    writer_thread = std::thread(&async_logger::writer_loop, this);
+    writer_thread.detach();
+}
+
+async_logger& async_logger::getInstance() {
+    // Never destroyed, blocks may still log from static destructors
+    static async_logger* instance = [] {
+        async_logger* logger = new async_logger();
+        std::atexit([] { async_logger::getInstance().shutdown(); });
+        return logger;
+    }();
+    return *instance;
+}
+
+bool async_logger::push(int level, const char* text, size_t length) {
+    size_t position = head.load(std::memory_order_relaxed);
+    for (;;) {
+        slot& s = slots[position % queue_size];
+        size_t sequence = s.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+        if (diff == 0) {
+            if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                s.level = level;
+                s.length = std::min(length, message_size);
+                std::memcpy(s.text, text, s.length);
+                s.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // Full
+            return false;
+        } else {
+            position = head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool async_logger::pop(int& level, char* text, size_t& length) {
+    size_t position = tail.load(std::memory_order_relaxed);
+    for (;;) {
+        slot& s = slots[position % queue_size];
+        size_t sequence = s.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                level = s.level;
+                length = s.length;
+                std::memcpy(text, s.text, length);
+                s.sequence.store(position + queue_size, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // Empty
+            return false;
+        } else {
+            position = tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void async_logger::log(int level, const char* text, size_t length) {
+    if (level < min_level)
+        return;
+    if (level >= LOG_LEVEL_ERROR || synchronous) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        drain();
+        output(level, text, length);
+        return;
+    }
+    if (!push(level, text, length)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // Notify without taking the mutex, writer also wakes up periodically
+    wait_cv.notify_one();
+}
+
+void async_logger::writer_loop() {
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            drain();
+        }
+        std::unique_lock<std::mutex> lock(wait_mutex);
+        wait_cv.wait_for(lock, std::chrono::milliseconds(100));
+    }
+}
+
+void async_logger::drain() {
+    int level;
+    char text[message_size];
+    size_t length;
+    while (pop(level, text, length))
+        output(level, text, length);
+
+    uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+    if (lost > 0) {
+        std::string message =
+            "WARNING: async_logger: " + std::to_string(lost) + " messages dropped, queue full.";
+        output(LOG_LEVEL_WARNING, message.data(), message.size());
+    }
+}
+
+void async_logger::output(int level, const char* text, size_t length) {
+    if (!to_gr) {
+        std::cout.write(text, length);
+        std::cout << std::endl;
+        return;
+    }
+    // GNU Radio logger adds its own level, strip ours
+    std::string message(text, length);
+    size_t colon = message.find(": ");
+    if (level != LOG_LEVEL_INFO && colon != std::string::npos && colon < 8)
+        message.erase(0, colon + 2);
+    else if (message.compare(0, 6, "INFO: ") == 0)
+        message.erase(0, 6);
+    if (message.empty())
+        return;
+
+    static gr::logger_ptr logger = gr::logger_get_logger("gr-limesdr");
+    switch (level) {
+    case LOG_LEVEL_DEBUG:
+        GR_LOG_DEBUG(logger, message);
+        break;
+    case LOG_LEVEL_INFO:
+        GR_LOG_INFO(logger, message);
+        break;
+    case LOG_LEVEL_WARNING:
+        GR_LOG_WARN(logger, message);
+        break;
+    default:
+        GR_LOG_ERROR(logger, message);
+        break;
+    }
+}
+
+void async_logger::shutdown() {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    synchronous = true;
+    drain();
+}
+
+bool log_limiter::allow(uint64_t& skipped) {
+    int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    int64_t due = next.load(std::memory_order_relaxed);
+    if (now < due ||
+        !next.compare_exchange_strong(due, now + interval.count(), std::memory_order_relaxed)) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    skipped = suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+namespace {
+// Collects output of one thread and hands completed lines to the logger
+class log_buffer : public std::streambuf {
+    private:
+    std::string line;
+
+    void emit() {
+        int level = LOG_LEVEL_INFO;
+        size_t start = line.find_first_not_of(' ');
+        if (start != std::string::npos) {
+            if (line.compare(start, 6, "ERROR:") == 0)
+                level = LOG_LEVEL_ERROR;
+            else if (line.compare(start, 8, "WARNING:") == 0 ||
+                     line.compare(start, 8, "Warning:") == 0)
+                level = LOG_LEVEL_WARNING;
+            else if (line.compare(start, 6, "DEBUG:") == 0)
+                level = LOG_LEVEL_DEBUG;
+        }
+        async_logger::getInstance().log(level, line.data(), line.size());
+        line.clear();
+    }
+
+    protected:
+    int overflow(int c) override {
+        if (c == '\n')
+            emit();
+        else if (c != traits_type::eof())
+            line.push_back((char)c);
+        return c;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        for (std::streamsize i = 0; i < n; i++)
+            overflow(s[i]);
+        return n;
+    }
+};
+} // namespace
+
+std::ostream& log_stream() {
+    thread_local log_buffer buffer;
+    thread_local std::ostream stream(&buffer);
+    return stream;
+}
@@ -0,0 +1,126 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+
+/**
+ * Asynchronous logger. Messages are copied into a bounded lock-free queue and written by
+ * a dedicated thread, so slow stdout (e.g. journald) never stalls streaming threads.
+ * When the queue is full messages are dropped and counted instead of waiting.
+ * Errors are written synchronously after pending messages, as they usually end the process.
+ *
+ * Output goes to stdout, or to GNU Radio logger when GR_LIMESDR_LOG=gr is set.
+ * GR_LIMESDR_LOG_LEVEL=debug|info|warning|error sets the lowest level written.
+ */
+class async_logger {
+    private:
+    static const size_t queue_size = 1024;
+    static const size_t message_size = 480;
+
+    // Bounded multi-producer queue slot, sequence tells which lap of the ring it belongs to
+    struct slot {
+        std::atomic<size_t> sequence;
+        int level;
+        size_t length;
+        char text[message_size];
+    };
+    std::unique_ptr<slot[]> slots;
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+
+    std::thread writer_thread;
+    std::mutex wait_mutex;
+    std::condition_variable wait_cv;
+    // Serializes output between writer thread and synchronous writes
+    std::mutex output_mutex;
+    // Set at exit, everything is written directly from then on
+    std::atomic<bool> synchronous{false};
+
+    bool to_gr = false;
+    int min_level = LOG_LEVEL_INFO;
+
+    async_logger();
+
+    bool push(int level, const char* text, size_t length);
+    bool pop(int& level, char* text, size_t& length);
+    void writer_loop();
+    void drain();
+    void output(int level, const char* text, size_t length);
+
+    public:
+    static async_logger& getInstance();
+
+    /**
+     * Queue message. Never blocks unless level is error.
+     */
+    void log(int level, const char* text, size_t length);
+
+    /**
+     * Write all queued messages from calling thread and switch to synchronous output.
+     * Called at process exit.
+     */
+    void shutdown();
+};
+
+/**
+ * Rate limiter for repeated messages from hot paths, one per call site.
+ */
+class log_limiter {
+    private:
+    std::chrono::steady_clock::duration interval;
+    std::atomic<int64_t> next{0};
+    std::atomic<uint64_t> suppressed{0};
+
+    public:
+    log_limiter(std::chrono::steady_clock::duration interval = std::chrono::seconds(1))
+        : interval(interval){};
+
+    /**
+     * @param   skipped  Messages suppressed since last allowed one.
+     *
+     * @return  true if message may be written now
+     */
+    bool allow(uint64_t& skipped);
+};
+
+/**
+ * Line buffered stream of calling thread feeding async_logger. Each completed line is one
+ * message, its level is taken from the "ERROR:", "WARNING:" or "DEBUG:" prefix, INFO otherwise.
+ */
+std::ostream& log_stream();
+
+#endif
@@ -0,0 +1,74 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "mapped_file.h"
+#include "logger.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mapped_file::mapped_file(const std::string& filename, bool prefetch) {
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        log_stream() << "ERROR: mapped_file::mapped_file(): cannot open " << filename << ": "
+                     << strerror(errno) << std::endl;
+        return;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        log_stream() << "ERROR: mapped_file::mapped_file(): " << filename << " is empty."
+                     << std::endl;
+        return;
+    }
+    length = info.st_size;
+
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (prefetch)
+        flags |= MAP_POPULATE;
+#endif
+    void* map = mmap(nullptr, length, PROT_READ, flags, fd, 0);
+    if (map == MAP_FAILED) {
+        log_stream() << "ERROR: mapped_file::mapped_file(): cannot map " << filename << ": "
+                     << strerror(errno) << std::endl;
+        length = 0;
+        return;
+    }
+    address = map;
+
+    madvise(address, length, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    // Only honoured by kernels with hugepage support for file mappings, harmless otherwise
+    if (prefetch)
+        madvise(address, length, MADV_HUGEPAGE);
+#endif
+}
+
+mapped_file::~mapped_file() {
+    if (address != nullptr)
+        munmap(address, length);
+    if (fd >= 0)
+        close(fd);
+}
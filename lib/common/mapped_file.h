@@ -0,0 +1,54 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Read-only memory mapping of a whole file.
+ */
+class mapped_file {
+    private:
+    int fd = -1;
+    void* address = nullptr;
+    size_t length = 0;
+
+    mapped_file(mapped_file const&);
+    void operator=(mapped_file const&);
+
+    public:
+    /**
+     * @param   filename  File to map.
+     *
+     * @param   prefetch  Read whole file into memory upfront (MAP_POPULATE) and
+     *                    request transparent hugepages for the mapping.
+     */
+    mapped_file(const std::string& filename, bool prefetch);
+    ~mapped_file();
+
+    bool is_open() const { return address != nullptr; }
+    const void* data() const { return address; }
+    size_t size() const { return length; }
+};
+
+#endif
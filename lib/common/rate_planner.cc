@@ -0,0 +1,83 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "rate_planner.h"
+#include <algorithm>
+
+link_interface link_for_board(const std::string& device_name) {
+    // Sustained rates measured on typical hosts, well below nominal bus speed
+    if (device_name.find("PCIe") != std::string::npos)
+        return {"PCIe", 800e6};
+    if (device_name.find("Mini") != std::string::npos)
+        return {"USB 3.0 (FT601)", 190e6};
+    if (device_name.find("Micro") != std::string::npos)
+        return {"USB 2.0", 35e6};
+    if (device_name.find("USB") != std::string::npos)
+        return {"USB 3.0 (FX3)", 330e6};
+    return {"USB 3.0 (assumed)", 330e6};
+}
+
+rate_plan plan_rate(double rate,
+                    double bandwidth,
+                    double attenuation,
+                    int streams,
+                    const link_interface& link) {
+    rate_plan plan;
+    plan.rate = rate;
+    plan.bandwidth = bandwidth;
+
+    // GFIR3 keeps the band and suppresses the rest up to Nyquist, if there is room for it
+    fir_spec spec;
+    spec.passband = bandwidth / 2;
+    spec.stopband = rate / 2;
+    spec.attenuation = attenuation;
+    bool filter = spec.passband > 0 && spec.passband < 0.95 * spec.stopband;
+
+    const int ratios[] = {2, 4, 8, 16, 32};
+    int chosen = 0;
+    for (int ratio : ratios) {
+        if (4 * rate * ratio > PLAN_MAX_CGEN)
+            break;
+        chosen = ratio;
+        if (!filter)
+            continue;
+        size_t max_taps = 15 * std::min(8, ratio);
+        if (design_lowpass(rate, spec, max_taps).required_taps <= max_taps)
+            break;
+    }
+    // Rate too high for any decimation, ADC runs at sample rate
+    if (chosen == 0)
+        chosen = 1;
+
+    plan.oversample = chosen;
+    plan.adc_clock = rate * chosen;
+    plan.cgen_clock = 4 * plan.adc_clock;
+    plan.max_taps = 15 * std::min(8, chosen);
+    if (filter) {
+        fir_design design = design_lowpass(rate, spec, plan.max_taps);
+        plan.filter = spec;
+        plan.taps = design.taps.size();
+        plan.attenuation = design.attenuation;
+    }
+
+    plan.link_rate = rate * PLAN_LINK_SAMPLE_SIZE * streams / PLAN_PACKET_EFFICIENCY;
+    plan.link_load = (link.capacity > 0) ? plan.link_rate / link.capacity : 0;
+    return plan;
+}
@@ -0,0 +1,87 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef RATE_PLANNER_H
+#define RATE_PLANNER_H
+
+#include "fir_design.h"
+#include <string>
+
+// CGEN clock limit, ADC/DAC run at a quarter of it
+#define PLAN_MAX_CGEN 640e6
+// Stream packets carry 4080 payload bytes in 4096
+#define PLAN_PACKET_EFFICIENCY (4080.0 / 4096.0)
+// Complex sample on the link with 12-bit I and Q
+#define PLAN_LINK_SAMPLE_SIZE 3
+
+/**
+ * Host interface of a board and its sustained sample throughput.
+ */
+struct link_interface {
+    std::string name;
+    // Bytes per second, RX and TX together
+    double capacity;
+};
+
+/**
+ * Interface of a board from its LMS_GetDeviceInfo name. Unknown boards are taken as USB 3.0.
+ */
+link_interface link_for_board(const std::string& device_name);
+
+/**
+ * Clock, decimation/interpolation and GFIR setting chosen for a sample rate.
+ */
+struct rate_plan {
+    double rate = 0;
+    double bandwidth = 0;
+    int oversample = 0;
+    double adc_clock = 0;
+    double cgen_clock = 0;
+    // GFIR3 lowpass, passband 0 when bandwidth leaves no room for a transition band
+    fir_spec filter;
+    size_t taps = 0;
+    size_t max_taps = 0;
+    double attenuation = 0;
+    // Link rate of all streams in bytes per second and its share of interface capacity
+    double link_rate = 0;
+    double link_load = 0;
+};
+
+/**
+ * Choose on-chip oversampling for a sample rate. All decimation/interpolation runs on chip, so
+ * link carries only the sample rate itself. Of the ratios the CGEN limit allows, the lowest
+ * one (at least 2, for halfband alias rejection) whose GFIR3 length meets the filter
+ * specification is taken, or the highest one if none does.
+ *
+ * @param   rate  Host sample rate in S/s.
+ *
+ * @param   bandwidth  Occupied bandwidth in Hz, centered at 0 Hz.
+ *
+ * @param   attenuation  Required stopband attenuation in dB.
+ *
+ * @param   streams  Active RX and TX channel streams.
+ */
+rate_plan plan_rate(double rate,
+                    double bandwidth,
+                    double attenuation,
+                    int streams,
+                    const link_interface& link);
+
+#endif
@@ -0,0 +1,461 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "recorder.h"
+#include "logger.h"
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+// O_DIRECT needs transfers aligned to storage block size
+#define DIRECT_IO_ALIGN 4096
+
+iq_recorder::iq_recorder(const std::string& basename,
+                         const recording_info& info,
+                         uint64_t file_size,
+                         size_t buffer_size)
+    : basename(basename), info(info), file_number(info.first_file) {
+    // Rotate only on whole blocks so that every write stays aligned
+    this->file_size = (file_size + block_size - 1) / block_size * block_size;
+
+    size_t block_count = std::max<size_t>(4, buffer_size / block_size);
+    for (size_t i = 0; i < block_count; i++) {
+        // Blocks are page aligned, as O_DIRECT requires; pages are placed on first write by
+        // the receiving thread unless policy binds them to a node
+        void* block = buffer_alloc(block_size, info.buffers);
+        if (!block) {
+            log_stream() << "ERROR: iq_recorder::iq_recorder(): failed to allocate recorder buffer."
+                         << std::endl;
+            break;
+        }
+        blocks.push_back(static_cast<char*>(block));
+    }
+
+    if (blocks.size() < 2 || !open_file())
+        return;
+
+    running = true;
+    writer_thread = std::thread(&iq_recorder::writer_loop, this);
+
+    log_stream() << "INFO: iq_recorder::iq_recorder(): recording CH" << info.channel << " to "
+                 << basename << " (" << blocks.size() * block_size / (1 << 20) << " MB buffer"
+                 << (direct_io ? ", O_DIRECT" : "") << ")." << std::endl;
+}
+
+iq_recorder::~iq_recorder() {
+    finish();
+    if (info.buffers.hugepages || info.buffers.numa_node >= 0) {
+        std::string name = "recorder CH" + std::to_string(info.channel) + " block 0";
+        buffer_report(name.c_str(), blocks.empty() ? nullptr : blocks[0], block_size);
+    }
+    for (char* block : blocks)
+        buffer_free(block);
+
+    if (overflow_samples > 0)
+        log_stream() << "WARNING: iq_recorder::~iq_recorder(): CH" << info.channel << " lost "
+                     << overflow_samples << " samples, storage too slow." << std::endl;
+}
+
+int iq_recorder::finish() {
+    if (writer_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(wait_mutex);
+            running = false;
+        }
+        wait_cv.notify_all();
+        writer_thread.join();
+    }
+    return file_number + 1;
+}
+
+void iq_recorder::write(const void* data,
+                        size_t items,
+                        uint64_t timestamp,
+                        uint32_t dropped_packets) {
+    if (!running)
+        return;
+
+    if (!started) {
+        std::lock_guard<std::mutex> lock(meta_mutex);
+        start_timestamp = timestamp;
+        started = true;
+        add_capture(timestamp);
+    } else if (timestamp != next_timestamp || dropped_packets > 0) {
+        std::lock_guard<std::mutex> lock(meta_mutex);
+        uint64_t lost = (timestamp > next_timestamp) ? timestamp - next_timestamp : 0;
+        drops.push_back({samples, lost, dropped_packets, false});
+        add_capture(timestamp);
+    }
+    if (info_changed) {
+        std::lock_guard<std::mutex> lock(meta_mutex);
+        info_changed = false;
+        add_capture(timestamp);
+    }
+    next_timestamp = timestamp + items;
+
+    const char* src = static_cast<const char*>(data);
+    size_t src_size = (info.scale > 0) ? 2 * sizeof(float) : info.sample_size;
+    while (items > 0) {
+        size_t index = write_index.load(std::memory_order_relaxed);
+        char* block = blocks[index % blocks.size()];
+        size_t count = std::min(items, (block_size - block_fill) / info.sample_size);
+        if (info.scale > 0)
+            convert_ci16(reinterpret_cast<const float*>(src),
+                         reinterpret_cast<int16_t*>(block + block_fill),
+                         count);
+        else
+            memcpy(block + block_fill, src, count * info.sample_size);
+        block_fill += count * info.sample_size;
+        src += count * src_size;
+        items -= count;
+        samples += count;
+
+        if (block_fill == block_size) {
+            // Hand block over to writer unless the next one is still being written
+            if (index + 1 - read_index.load(std::memory_order_acquire) < blocks.size()) {
+                write_index.store(index + 1, std::memory_order_release);
+                std::lock_guard<std::mutex> lock(wait_mutex);
+                wait_cv.notify_one();
+            } else {
+                uint64_t lost = block_size / info.sample_size;
+                samples -= lost;
+                overflow_samples += lost;
+                std::lock_guard<std::mutex> lock(meta_mutex);
+                drops.push_back({samples, lost, 0, true});
+                add_capture(timestamp_at(samples));
+            }
+            block_fill = 0;
+        }
+    }
+}
+
+void iq_recorder::convert_ci16(const float* src, int16_t* dst, size_t count) const {
+    for (size_t i = 0; i < 2 * count; i++) {
+        // IQ correction may push corrected samples slightly past full scale
+        float v = std::max(-32768.0f, std::min(32767.0f, src[i] * info.scale));
+        dst[i] = (int16_t)std::lrint(v);
+    }
+}
+
+void iq_recorder::update_info(double rf_freq, unsigned gain) {
+    std::lock_guard<std::mutex> lock(meta_mutex);
+    info.rf_freq = rf_freq;
+    info.gain = gain;
+    info_changed = true;
+}
+
+// meta_mutex must be held
+void iq_recorder::add_capture(uint64_t timestamp) {
+    // Retune and gap on the same buffer start a single segment
+    if (!captures.empty() && captures.back().sample == samples)
+        captures.pop_back();
+    captures.push_back({samples, timestamp, info.rf_freq, info.gain});
+    meta_dirty = true;
+}
+
+// meta_mutex must be held
+uint64_t iq_recorder::timestamp_at(uint64_t sample) const {
+    // Device timestamp counts all samples lost up to this point
+    uint64_t timestamp = start_timestamp + sample;
+    for (const recording_drop& drop : drops) {
+        if (drop.sample <= sample)
+            timestamp += drop.lost_samples;
+    }
+    return timestamp;
+}
+
+void iq_recorder::writer_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(wait_mutex);
+            wait_cv.wait(lock, [this] {
+                return read_index.load() != write_index.load() || !running;
+            });
+        }
+        size_t index = read_index.load(std::memory_order_relaxed);
+        while (index != write_index.load(std::memory_order_acquire)) {
+            write_block(blocks[index % blocks.size()], block_size);
+            read_index.store(++index, std::memory_order_release);
+        }
+        // Keep SigMF metadata of current file up to date while recording
+        if (info.metadata == RECORDING_META_SIGMF) {
+            bool dirty;
+            {
+                std::lock_guard<std::mutex> lock(meta_mutex);
+                dirty = meta_dirty;
+                meta_dirty = false;
+            }
+            if (dirty)
+                write_metadata(file_written / info.sample_size, false);
+        }
+        if (!running && index == write_index.load())
+            break;
+    }
+    // Work thread has stopped, store partially filled block
+    if (block_fill > 0)
+        write_block(blocks[write_index.load() % blocks.size()], block_fill);
+    close_file();
+}
+
+bool iq_recorder::write_block(char* data, size_t length) {
+    if (fd < 0)
+        return false;
+
+    if (file_size > 0 && file_written + length > file_size) {
+        close_file();
+        file_number++;
+        if (!open_file())
+            return false;
+    }
+
+    // Last block can be partial, pad it for O_DIRECT and truncate file on close
+    size_t padded = direct_io ? (length + DIRECT_IO_ALIGN - 1) / DIRECT_IO_ALIGN * DIRECT_IO_ALIGN
+                              : length;
+    if (padded != length)
+        memset(data + length, 0, padded - length);
+
+    size_t done = 0;
+    while (done < padded) {
+        ssize_t ret = pwrite(fd, data + done, padded - done, file_written + done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            log_stream() << "ERROR: iq_recorder::write_block(): " << strerror(errno) << std::endl;
+            return false;
+        }
+        done += ret;
+    }
+    file_written += length;
+    return true;
+}
+
+std::string iq_recorder::file_name(const std::string& extension) const {
+    std::ostringstream name;
+    name << basename << "_ch" << info.channel << "_" << std::setw(3) << std::setfill('0')
+         << file_number << extension;
+    return name.str();
+}
+
+bool iq_recorder::open_file() {
+    std::string name = file_name((info.metadata == RECORDING_META_SIGMF) ? ".sigmf-data"
+                                                                         : "." + info.format);
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    fd = open(name.c_str(), flags | O_DIRECT, 0644);
+    // Some filesystems (e.g. tmpfs) do not support direct I/O
+    if (fd < 0 && errno == EINVAL) {
+        log_stream() << "WARNING: iq_recorder::open_file(): O_DIRECT not supported for " << name
+                     << ", using buffered writes." << std::endl;
+        direct_io = false;
+        fd = open(name.c_str(), flags, 0644);
+    }
+#else
+    direct_io = false;
+    fd = open(name.c_str(), flags, 0644);
+#endif
+    if (fd < 0) {
+        log_stream() << "ERROR: iq_recorder::open_file(): cannot open " << name << ": "
+                     << strerror(errno) << std::endl;
+        return false;
+    }
+
+#ifdef __linux__
+    // Pre-allocate so that filesystem does not allocate extents while streaming
+    if (file_size > 0 && posix_fallocate(fd, 0, file_size) != 0)
+        log_stream() << "WARNING: iq_recorder::open_file(): failed to pre-allocate " << name
+                     << std::endl;
+#endif
+    file_written = 0;
+    std::lock_guard<std::mutex> lock(meta_mutex);
+    meta_dirty = true;
+    return true;
+}
+
+void iq_recorder::close_file() {
+    if (fd < 0)
+        return;
+    // Drop pre-allocated space and O_DIRECT padding
+    if (ftruncate(fd, file_written) != 0)
+        log_stream() << "WARNING: iq_recorder::close_file(): failed to truncate file." << std::endl;
+    close(fd);
+    fd = -1;
+
+    uint64_t file_samples = file_written / info.sample_size;
+    write_metadata(file_samples, true);
+    file_start_sample += file_samples;
+}
+
+void iq_recorder::write_metadata(uint64_t file_samples, bool final) {
+    std::lock_guard<std::mutex> lock(meta_mutex);
+    if (info.metadata == RECORDING_META_SIGMF)
+        write_sigmf_metadata(file_samples, final);
+    else
+        write_plain_metadata(file_samples);
+}
+
+// meta_mutex must be held
+void iq_recorder::write_plain_metadata(uint64_t file_samples) {
+    uint64_t timestamp = timestamp_at(file_start_sample);
+
+    std::ofstream meta(file_name(".meta"));
+    meta << std::setprecision(15);
+    meta << "[recording]" << std::endl;
+    meta << "serial=" << info.serial << std::endl;
+    meta << "channel=" << info.channel << std::endl;
+    meta << "format=" << info.format << std::endl;
+    if (info.scale > 0)
+        meta << "full_scale=" << info.scale << std::endl;
+    meta << "sample_rate=" << info.samp_rate << std::endl;
+    meta << "frequency=" << info.rf_freq << std::endl;
+    meta << "gain=" << info.gain << std::endl;
+    meta << "file_index=" << file_number << std::endl;
+    meta << "first_sample=" << file_start_sample << std::endl;
+    meta << "samples=" << file_samples << std::endl;
+    meta << "start_timestamp=" << timestamp << std::endl;
+    uint64_t secs;
+    double frac;
+    if (info.sync && info.sync->to_utc(timestamp, secs, frac)) {
+        meta << "start_utc_secs=" << secs << std::endl;
+        meta << "start_utc_frac=" << frac << std::endl;
+    }
+    meta << std::endl;
+
+    // Drop map: sample offset in file, lost samples, device packets, source
+    meta << "[drops]" << std::endl;
+    for (const recording_drop& drop : drops) {
+        if (drop.sample < file_start_sample || drop.sample >= file_start_sample + file_samples)
+            continue;
+        meta << "drop=" << drop.sample - file_start_sample << "," << drop.lost_samples << ","
+             << drop.device_packets << "," << (drop.overflow ? "recorder" : "device")
+             << std::endl;
+    }
+}
+
+// Format UTC time as ISO 8601 string used by SigMF
+static std::string iso8601(uint64_t secs, double frac) {
+    time_t t = secs;
+    struct tm utc;
+    gmtime_r(&t, &utc);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::ostringstream s;
+    s << date << "." << std::setw(9) << std::setfill('0')
+      << std::min<long long>(llround(frac * 1e9), 999999999) << "Z";
+    return s.str();
+}
+
+// meta_mutex must be held
+void iq_recorder::write_sigmf_metadata(uint64_t file_samples, bool final) {
+    uint64_t file_end = final ? file_start_sample + file_samples : UINT64_MAX;
+
+    // Segment in effect at file start continues from sample 0 of this file
+    std::vector<recording_capture> file_captures;
+    for (const recording_capture& capture : captures) {
+        if (capture.sample <= file_start_sample) {
+            file_captures.clear();
+            file_captures.push_back(capture);
+            file_captures.back().sample = file_start_sample;
+            file_captures.back().timestamp = timestamp_at(file_start_sample);
+        } else if (capture.sample < file_end) {
+            file_captures.push_back(capture);
+        }
+    }
+
+    // Write to temporary file and rename, so metadata on disk is always complete
+    std::string name = file_name(".sigmf-meta");
+    std::string tmp_name = name + ".tmp";
+    {
+        std::ofstream meta(tmp_name);
+        meta << std::setprecision(15);
+        meta << "{" << std::endl;
+        meta << "    \"global\": {" << std::endl;
+        meta << "        \"core:datatype\": \"" << info.format << "_le\"," << std::endl;
+        meta << "        \"core:sample_rate\": " << info.samp_rate << "," << std::endl;
+        if (info.scale > 0)
+            meta << "        \"limesdr:full_scale\": " << info.scale << "," << std::endl;
+        meta << "        \"core:version\": \"1.0.0\"," << std::endl;
+        meta << "        \"core:hw\": \"LimeSDR " << info.serial << " CH" << info.channel
+             << "\"," << std::endl;
+        meta << "        \"core:recorder\": \"gr-limesdr\"," << std::endl;
+        meta << "        \"core:extensions\": [" << std::endl;
+        meta << "            {\"name\": \"limesdr\", \"version\": \"1.0.0\", "
+                "\"optional\": true}"
+             << std::endl;
+        meta << "        ]" << std::endl;
+        meta << "    }," << std::endl;
+
+        meta << "    \"captures\": [";
+        for (size_t i = 0; i < file_captures.size(); i++) {
+            const recording_capture& capture = file_captures[i];
+            meta << (i ? "," : "") << std::endl;
+            meta << "        {" << std::endl;
+            meta << "            \"core:sample_start\": " << capture.sample - file_start_sample
+                 << "," << std::endl;
+            meta << "            \"core:global_index\": " << capture.timestamp << ","
+                 << std::endl;
+            uint64_t secs;
+            double frac;
+            if (info.sync && info.sync->to_utc(capture.timestamp, secs, frac))
+                meta << "            \"core:datetime\": \"" << iso8601(secs, frac) << "\","
+                     << std::endl;
+            meta << "            \"core:frequency\": " << capture.rf_freq << "," << std::endl;
+            meta << "            \"limesdr:gain\": " << capture.gain << std::endl;
+            meta << "        }";
+        }
+        meta << std::endl << "    ]," << std::endl;
+
+        meta << "    \"annotations\": [";
+        bool first = true;
+        for (const recording_drop& drop : drops) {
+            if (drop.sample < file_start_sample || drop.sample >= file_end)
+                continue;
+            meta << (first ? "" : ",") << std::endl;
+            first = false;
+            meta << "        {" << std::endl;
+            meta << "            \"core:sample_start\": " << drop.sample - file_start_sample
+                 << "," << std::endl;
+            meta << "            \"core:label\": \"drop\"," << std::endl;
+            meta << "            \"core:comment\": \"" << drop.lost_samples
+                 << " samples lost ("
+                 << (drop.overflow ? "recorder overflow" : "device stream") << ")\","
+                 << std::endl;
+            meta << "            \"limesdr:lost_samples\": " << drop.lost_samples << ","
+                 << std::endl;
+            meta << "            \"limesdr:dropped_packets\": " << drop.device_packets
+                 << std::endl;
+            meta << "        }";
+        }
+        meta << std::endl << "    ]" << std::endl;
+        meta << "}" << std::endl;
+    }
+    if (rename(tmp_name.c_str(), name.c_str()) != 0)
+        log_stream() << "WARNING: iq_recorder::write_sigmf_metadata(): failed to write " << name
+                     << std::endl;
+}
@@ -0,0 +1,191 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "buffer_alloc.h"
+#include "time_sync.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define RECORDING_META_PLAIN 0
+#define RECORDING_META_SIGMF 1
+
+/**
+ * Recording settings and device state stored with each file.
+ */
+struct recording_info {
+    std::string serial;
+    int channel = 0;
+    double samp_rate = 0;
+    double rf_freq = 0;
+    unsigned gain = 0;
+    // Sample format, e.g. "cf32" or "ci16"
+    std::string format = "cf32";
+    size_t sample_size = 8;
+    // Full scale of integer format, received cf32 samples are scaled to it while copying.
+    // 0 stores samples as received.
+    float scale = 0;
+    // Device time mapping used to store UTC of each file start, may be null
+    const time_sync* sync = nullptr;
+    // Metadata file format: plain .meta(0) or SigMF .sigmf-meta(1)
+    int metadata = RECORDING_META_PLAIN;
+    // Placement of ring buffer blocks
+    buffer_policy buffers;
+    // Number of first file, recording continued after a stream restart does not overwrite
+    int first_file = 0;
+};
+
+/**
+ * Start of a capture segment: recording start, retune or continuation after a gap.
+ */
+struct recording_capture {
+    uint64_t sample;
+    uint64_t timestamp;
+    double rf_freq;
+    unsigned gain;
+};
+
+/**
+ * Gap in recording. Samples are lost either by the device stream (timestamp discontinuity,
+ * dropped packets) or by the recorder itself when the writer falls behind (overflow).
+ */
+struct recording_drop {
+    // Recorded sample index where the gap is
+    uint64_t sample;
+    uint64_t lost_samples;
+    uint32_t device_packets;
+    bool overflow;
+};
+
+/**
+ * Continuous recorder writing stream buffers to disk from a dedicated writer thread.
+ * Receive path only copies samples into a ring of page aligned blocks, writer thread stores
+ * full blocks with O_DIRECT into pre-allocated files, so page cache writeback never stalls
+ * the stream. Files are rotated at file_size bytes and each gets a .meta sidecar or
+ * a SigMF .sigmf-meta file. SigMF metadata is rewritten while recording whenever a retune or
+ * gap adds a capture segment or annotation, so it is valid without any post-processing.
+ */
+class iq_recorder {
+    private:
+    // Block size used for O_DIRECT writes, must be multiple of storage block size
+    static const size_t block_size = 4 << 20;
+
+    std::string basename;
+    recording_info info;
+    uint64_t file_size;
+
+    // Ring of aligned blocks, single producer (work thread), single consumer (writer)
+    std::vector<char*> blocks;
+    size_t block_fill = 0;
+    std::atomic<size_t> write_index{0};
+    std::atomic<size_t> read_index{0};
+
+    // Samples stored, global over all files
+    uint64_t samples = 0;
+    bool started = false;
+    uint64_t start_timestamp = 0;
+    uint64_t next_timestamp = 0;
+    // Samples lost because ring was full
+    std::atomic<uint64_t> overflow_samples{0};
+
+    // Protects drops, captures and info, shared between work, writer and control threads
+    std::mutex meta_mutex;
+    std::vector<recording_drop> drops;
+    std::vector<recording_capture> captures;
+    // Device state changed, new capture segment starts with next buffer
+    std::atomic<bool> info_changed{false};
+    // Events added since metadata of current file was last written
+    bool meta_dirty = false;
+
+    int fd = -1;
+    int file_number = 0;
+    uint64_t file_written = 0;
+    uint64_t file_start_sample = 0;
+    bool direct_io = true;
+
+    std::thread writer_thread;
+    std::atomic<bool> running{false};
+    std::mutex wait_mutex;
+    std::condition_variable wait_cv;
+
+    void writer_loop();
+    bool write_block(char* data, size_t length);
+    void convert_ci16(const float* src, int16_t* dst, size_t count) const;
+    bool open_file();
+    void close_file();
+    void add_capture(uint64_t timestamp);
+    uint64_t timestamp_at(uint64_t sample) const;
+    void write_metadata(uint64_t file_samples, bool final);
+    void write_plain_metadata(uint64_t file_samples);
+    void write_sigmf_metadata(uint64_t file_samples, bool final);
+    std::string file_name(const std::string& extension) const;
+
+    public:
+    /**
+     * @param   basename  Path and name prefix of recording files.
+     *
+     * @param   info  Recording settings and device state at start.
+     *
+     * @param   file_size  File rotation size in bytes, 0 for a single file.
+     *
+     * @param   buffer_size  Ring buffer size in bytes.
+     */
+    iq_recorder(const std::string& basename,
+                const recording_info& info,
+                uint64_t file_size,
+                size_t buffer_size);
+    ~iq_recorder();
+
+    /**
+     * Copy received samples into recorder ring. Never blocks.
+     *
+     * @param   data  Received cf32 samples, converted when recording format is integer.
+     *
+     * @param   items  Sample count.
+     *
+     * @param   timestamp  Device timestamp of the first sample, gaps are detected from it.
+     *
+     * @param   dropped_packets  Packets dropped by device stream before these samples.
+     */
+    void write(const void* data, size_t items, uint64_t timestamp, uint32_t dropped_packets);
+
+    /**
+     * Write out buffered samples and close current file. Recorder accepts no more samples.
+     *
+     * @return  number of the next file after the last one written
+     */
+    int finish();
+
+    /**
+     * Update device state stored with following files.
+     */
+    void update_info(double rf_freq, unsigned gain);
+
+    uint64_t get_overflows() const { return overflow_samples; }
+};
+
+#endif
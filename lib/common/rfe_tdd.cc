@@ -0,0 +1,139 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "rfe_tdd.h"
+#include "logger.h"
+#include <algorithm>
+
+// Condition variable wakeup is only trusted to within this, rest of the wait is spent polling
+#define TDD_SPIN_TIME std::chrono::microseconds(500)
+
+rfe_tdd::~rfe_tdd() { this->stop(); }
+
+void rfe_tdd::start(double guard_time) {
+    this->stop();
+    guard = std::max(0.0, guard_time);
+    current_mode = -1;
+    this->apply({std::chrono::steady_clock::now(), RFE_MODE_RX});
+    switches = 0;
+    late = 0;
+    latency_sum = 0;
+    latency_max = 0;
+    running = true;
+    switch_thread = std::thread(&rfe_tdd::switch_loop, this);
+}
+
+void rfe_tdd::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (!running && !switch_thread.joinable())
+            return;
+        running = false;
+        queue_cv.notify_all();
+    }
+    if (switch_thread.joinable())
+        switch_thread.join();
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.clear();
+    }
+    if (current_mode != RFE_MODE_RX)
+        this->apply({std::chrono::steady_clock::now(), RFE_MODE_RX});
+    this->print_stats();
+}
+
+void rfe_tdd::schedule_burst(uint64_t start, uint64_t end, uint64_t device_now, double rate) {
+    if (!running || rate <= 0)
+        return;
+    auto now = std::chrono::steady_clock::now();
+    auto to_host = [&](uint64_t timestamp, double offset) {
+        double seconds = ((int64_t)(timestamp - device_now)) / rate + offset;
+        return now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                         std::chrono::duration<double>(seconds));
+    };
+    mode_switch tx = {std::max(now, to_host(start, -guard)), RFE_MODE_TX};
+    mode_switch rx = {std::max(now, to_host(end, guard)), RFE_MODE_RX};
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    if (!running)
+        return;
+    // Previous burst still ends within guard time, stay in TX over the gap
+    if (!queue.empty() && queue.back().mode == RFE_MODE_RX && queue.back().due >= tx.due)
+        queue.back() = rx;
+    else {
+        queue.push_back(tx);
+        queue.push_back(rx);
+    }
+    queue_cv.notify_all();
+}
+
+void rfe_tdd::switch_loop() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (running) {
+        if (queue.empty()) {
+            queue_cv.wait(lock);
+            continue;
+        }
+        mode_switch next = queue.front();
+        auto now = std::chrono::steady_clock::now();
+        if (next.due - now > TDD_SPIN_TIME) {
+            queue_cv.wait_until(lock, next.due - TDD_SPIN_TIME);
+            continue;
+        }
+        queue.pop_front();
+        lock.unlock();
+        while (std::chrono::steady_clock::now() < next.due)
+            std::this_thread::yield();
+        this->apply(next);
+        lock.lock();
+    }
+}
+
+void rfe_tdd::apply(const mode_switch& s) {
+    if (s.mode == current_mode || (s.mode == RFE_MODE_TX && tx_inhibit))
+        return;
+    int error;
+    {
+        std::lock_guard<std::mutex> lock(board_mutex);
+        error = RFE_Mode(rfe_dev, s.mode);
+        if (error == 0)
+            current_mode = s.mode;
+    }
+    double latency =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - s.due).count();
+    if (error != 0) {
+        log_stream() << "ERROR: rfe_tdd::apply(): failed to change mode, error " << error << "."
+                     << std::endl;
+        return;
+    }
+    switches++;
+    latency_sum += latency;
+    latency_max = std::max(latency_max, latency);
+    if (latency > guard)
+        late++;
+}
+
+void rfe_tdd::print_stats() {
+    if (switches == 0)
+        return;
+    log_stream() << "INFO: rfe_tdd::print_stats(): " << switches << " mode switches, latency mean "
+                 << latency_sum / switches * 1e3 << " ms, max " << latency_max * 1e3 << " ms, "
+                 << late << " later than guard time " << guard * 1e3 << " ms." << std::endl;
+}
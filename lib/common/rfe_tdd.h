@@ -0,0 +1,120 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef RFE_TDD_H
+#define RFE_TDD_H
+
+#include <limeRFE.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/**
+ * LimeRFE mode switching driven by sink bursts. Sink passes device timestamps of each burst,
+ * switch thread changes the board to TX guard time ahead of burst start and back to RX guard
+ * time after burst end. Bursts closer than two guard times are transmitted without switching
+ * in between.
+ */
+class rfe_tdd {
+    private:
+    struct mode_switch {
+        std::chrono::steady_clock::time_point due;
+        int mode;
+    };
+
+    rfe_dev_t* rfe_dev;
+    double guard = 0;
+    std::atomic<int> current_mode{-1};
+    // Switches to TX are dropped while set
+    std::atomic<bool> tx_inhibit{false};
+
+    std::deque<mode_switch> queue;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::thread switch_thread;
+    std::atomic<bool> running{false};
+
+    // Switch latency, time from due time until board confirmed the mode. Switch is late when
+    // it took longer than guard time, TX was then switched after burst start.
+    uint64_t switches = 0;
+    uint64_t late = 0;
+    double latency_sum = 0;
+    double latency_max = 0;
+
+    void switch_loop();
+    void apply(const mode_switch& s);
+
+    public:
+    // Serializes commands on the board link with the switch thread
+    std::mutex board_mutex;
+
+    rfe_tdd(rfe_dev_t* rfe_dev) : rfe_dev(rfe_dev){};
+    ~rfe_tdd();
+
+    /**
+     * Start switching with board in RX mode.
+     *
+     * @param   guard_time  Time in seconds the board is in TX mode before and after a burst.
+     */
+    void start(double guard_time);
+
+    /**
+     * Stop switching, board is left in RX mode. Prints switch latency statistics.
+     */
+    void stop();
+
+    bool is_running() const { return running; }
+
+    /**
+     * Mode board was last switched to, call with board_mutex held to keep it current.
+     */
+    int get_mode() const { return current_mode; }
+
+    /**
+     * Record mode set on the board outside of the switch thread, call with board_mutex held.
+     */
+    void mode_changed(int mode) { current_mode = mode; }
+
+    /**
+     * Keep board out of TX, bursts are then transmitted with the board in RX mode.
+     */
+    void set_tx_inhibit(bool inhibit) { tx_inhibit = inhibit; }
+
+    /**
+     * Queue switching for a burst. Device times are mapped to host time from device time now.
+     *
+     * @param   start  Device timestamp of first burst sample.
+     *
+     * @param   end  Device timestamp after last burst sample.
+     *
+     * @param   device_now  Device timestamp now.
+     *
+     * @param   rate  Sample rate in S/s.
+     */
+    void schedule_burst(uint64_t start, uint64_t end, uint64_t device_now, double rate);
+
+    void print_stats();
+};
+
+#endif
@@ -0,0 +1,151 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef SAMPLE_STATS_H
+#define SAMPLE_STATS_H
+
+#include <cstddef>
+
+// Samples handled per vector step. Inner loops over a fixed number of lanes with no
+// dependencies between them are vectorized by the compiler (SSE/AVX/NEON).
+#define SAMPLE_STATS_LANES 8
+
+/**
+ * Find first sample with instantaneous power |x|^2 at or above threshold.
+ *
+ * @param   iq  Interleaved I/Q float samples.
+ *
+ * @param   count  Sample count.
+ *
+ * @param   threshold  Power threshold, 1.0 is full scale.
+ *
+ * @return  index of the sample, count if none
+ */
+inline size_t find_power_above(const float* iq, size_t count, float threshold) {
+    size_t i = 0;
+    for (; i + SAMPLE_STATS_LANES <= count; i += SAMPLE_STATS_LANES) {
+        const float* v = iq + 2 * i;
+        float peak = 0;
+        for (int j = 0; j < SAMPLE_STATS_LANES; j++) {
+            float power = v[2 * j] * v[2 * j] + v[2 * j + 1] * v[2 * j + 1];
+            peak = (power > peak) ? power : peak;
+        }
+        // Locate exact sample only in the step that crosses the threshold
+        if (peak >= threshold)
+            break;
+    }
+    for (; i < count; i++) {
+        if (iq[2 * i] * iq[2 * i] + iq[2 * i + 1] * iq[2 * i + 1] >= threshold)
+            return i;
+    }
+    return count;
+}
+
+/**
+ * Level statistics of one buffer.
+ */
+struct buffer_stats {
+    // Largest I or Q magnitude, 1.0 is full scale
+    float peak = 0;
+    // Sum of |x|^2 over the buffer
+    double power_sum = 0;
+    // Samples with I or Q magnitude at or above clip level
+    size_t clipped = 0;
+    // Index of first clipped sample, count if none
+    size_t first_clip = 0;
+};
+
+/**
+ * Measure peak, power and clipping of a buffer in a single pass.
+ *
+ * @param   iq  Interleaved I/Q float samples.
+ *
+ * @param   count  Sample count.
+ *
+ * @param   clip_level  I or Q magnitude counted as clipping, 1.0 is full scale.
+ *
+ * @param   stats  Filled with buffer statistics.
+ */
+inline void measure_buffer(const float* iq, size_t count, float clip_level, buffer_stats& stats) {
+    float peak[SAMPLE_STATS_LANES] = {0};
+    float power[SAMPLE_STATS_LANES] = {0};
+    int clipped[SAMPLE_STATS_LANES] = {0};
+    size_t total_clipped = 0;
+    stats.power_sum = 0;
+    stats.first_clip = count;
+
+    size_t i = 0;
+    for (; i + SAMPLE_STATS_LANES <= count; i += SAMPLE_STATS_LANES) {
+        const float* v = iq + 2 * i;
+        for (int j = 0; j < SAMPLE_STATS_LANES; j++) {
+            float re = (v[2 * j] < 0) ? -v[2 * j] : v[2 * j];
+            float im = (v[2 * j + 1] < 0) ? -v[2 * j + 1] : v[2 * j + 1];
+            float m = (re > im) ? re : im;
+            peak[j] = (m > peak[j]) ? m : peak[j];
+            power[j] += re * re + im * im;
+            clipped[j] += (m >= clip_level) ? 1 : 0;
+        }
+        // Lane counters are flushed regularly so float power sums keep their precision
+        if ((i & 0xFFF) == 0) {
+            for (int j = 0; j < SAMPLE_STATS_LANES; j++) {
+                stats.power_sum += power[j];
+                power[j] = 0;
+            }
+        }
+        if (stats.first_clip == count) {
+            int any = 0;
+            for (int j = 0; j < SAMPLE_STATS_LANES; j++)
+                any += clipped[j];
+            if (any > 0) {
+                for (int j = 0; j < SAMPLE_STATS_LANES; j++) {
+                    float re = (v[2 * j] < 0) ? -v[2 * j] : v[2 * j];
+                    float im = (v[2 * j + 1] < 0) ? -v[2 * j + 1] : v[2 * j + 1];
+                    if (re >= clip_level || im >= clip_level) {
+                        stats.first_clip = i + j;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    for (; i < count; i++) {
+        float re = (iq[2 * i] < 0) ? -iq[2 * i] : iq[2 * i];
+        float im = (iq[2 * i + 1] < 0) ? -iq[2 * i + 1] : iq[2 * i + 1];
+        float m = (re > im) ? re : im;
+        peak[0] = (m > peak[0]) ? m : peak[0];
+        power[0] += re * re + im * im;
+        if (m >= clip_level) {
+            total_clipped++;
+            if (stats.first_clip == count)
+                stats.first_clip = i;
+        }
+    }
+
+    stats.peak = 0;
+    for (int j = 0; j < SAMPLE_STATS_LANES; j++) {
+        stats.peak = (peak[j] > stats.peak) ? peak[j] : stats.peak;
+        stats.power_sum += power[j];
+        total_clipped += clipped[j];
+    }
+    stats.clipped = total_clipped;
+}
+
+#endif
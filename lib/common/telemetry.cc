@@ -0,0 +1,209 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "telemetry.h"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <vector>
+
+// Board parameter of VCTCXO trim DAC
+#ifndef BOARD_PARAM_DAC
+#define BOARD_PARAM_DAC 0
+#endif
+
+device_telemetry::~device_telemetry() { this->stop(); }
+
+void device_telemetry::attach(lms_device_t* device,
+                              std::recursive_mutex* mutex,
+                              const std::string& serial,
+                              int device_number) {
+    this->stop();
+    std::lock_guard<std::mutex> lock(state_mutex);
+    this->device = device;
+    device_mutex = mutex;
+    this->serial = serial;
+    this->device_number = device_number;
+    temperature = NAN;
+    ref_clock = NAN;
+    cgen_clock = NAN;
+    tcxo_dac = -1;
+    // Subscriptions outlive a reconnect, poll the new handle
+    if (device && !subscribers.empty()) {
+        running = true;
+        poll_thread = std::thread(&device_telemetry::poll_loop, this);
+    }
+}
+
+std::shared_ptr<stream_counters>
+device_telemetry::add_stream(int direction, int channel, int& key) {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    stream_entry entry;
+    entry.direction = direction;
+    entry.channel = channel;
+    entry.counters = std::make_shared<stream_counters>();
+    key = next_id++;
+    streams[key] = entry;
+    return entry.counters;
+}
+
+void device_telemetry::remove_stream(int key) {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    streams.erase(key);
+}
+
+int device_telemetry::subscribe(double interval, std::function<void(pmt::pmt_t)> callback) {
+    std::unique_lock<std::mutex> lock(state_mutex);
+    subscriber s;
+    s.interval = std::max(interval, 0.01);
+    s.callback = callback;
+    s.next = std::chrono::steady_clock::now();
+    int key = next_id++;
+    subscribers[key] = s;
+    if (!running && device) {
+        if (poll_thread.joinable())
+            poll_thread.join();
+        running = true;
+        poll_thread = std::thread(&device_telemetry::poll_loop, this);
+    } else {
+        wait_cv.notify_all();
+    }
+    return key;
+}
+
+void device_telemetry::unsubscribe(int key) {
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        subscribers.erase(key);
+        last = subscribers.empty();
+    }
+    if (last) {
+        this->stop();
+        return;
+    }
+    // Report being delivered may still hold the callback
+    std::lock_guard<std::mutex> wait(delivery_mutex);
+}
+
+void device_telemetry::stop() {
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        running = false;
+        wait_cv.notify_all();
+    }
+    if (poll_thread.joinable() && poll_thread.get_id() != std::this_thread::get_id())
+        poll_thread.join();
+}
+
+void device_telemetry::poll_loop() {
+#ifdef SCHED_IDLE
+    // Polling only runs when streaming threads leave the CPU idle
+    sched_param param = {};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+    std::unique_lock<std::mutex> lock(state_mutex);
+    while (running) {
+        auto now = std::chrono::steady_clock::now();
+        auto next = now + std::chrono::hours(1);
+        for (auto& s : subscribers)
+            next = std::min(next, s.second.next);
+        if (next > now) {
+            wait_cv.wait_until(lock, next);
+            continue;
+        }
+
+        lock.unlock();
+        this->read_chip();
+        std::lock_guard<std::mutex> delivery(delivery_mutex);
+        lock.lock();
+        if (!running)
+            break;
+
+        pmt::pmt_t report = this->make_report();
+        std::vector<std::function<void(pmt::pmt_t)>> due;
+        now = std::chrono::steady_clock::now();
+        for (auto& s : subscribers) {
+            if (s.second.next > now)
+                continue;
+            due.push_back(s.second.callback);
+            auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(s.second.interval));
+            s.second.next = std::max(s.second.next + interval, now);
+        }
+        lock.unlock();
+        for (auto& callback : due)
+            callback(report);
+        lock.lock();
+    }
+}
+
+void device_telemetry::read_chip() {
+    // Configuration in progress owns the device, keep previous readings this round
+    std::unique_lock<std::recursive_mutex> lock(*device_mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        return;
+
+    float_type value;
+    if (LMS_GetChipTemperature(device, 0, &value) == LMS_SUCCESS)
+        temperature = value;
+    if (LMS_GetClockFreq(device, LMS_CLOCK_REF, &value) == LMS_SUCCESS)
+        ref_clock = value;
+    if (LMS_GetClockFreq(device, LMS_CLOCK_CGEN, &value) == LMS_SUCCESS)
+        cgen_clock = value;
+    if (LMS_ReadCustomBoardParam(device, BOARD_PARAM_DAC, &value, NULL) == LMS_SUCCESS)
+        tcxo_dac = (int)value;
+}
+
+pmt::pmt_t device_telemetry::make_report() {
+    pmt::pmt_t msg = pmt::make_dict();
+    msg = pmt::dict_add(msg, pmt::mp("serial"), pmt::string_to_symbol(serial));
+    msg = pmt::dict_add(msg, pmt::mp("device_number"), pmt::from_long(device_number));
+    msg = pmt::dict_add(msg, pmt::mp("temperature"), pmt::from_double(temperature));
+    msg = pmt::dict_add(msg, pmt::mp("ref_clock"), pmt::from_double(ref_clock));
+    msg = pmt::dict_add(msg, pmt::mp("cgen_clock"), pmt::from_double(cgen_clock));
+    msg = pmt::dict_add(msg, pmt::mp("tcxo_dac"), pmt::from_long(tcxo_dac));
+
+    for (auto& s : streams) {
+        stream_entry& e = s.second;
+        const stream_counters& c = *e.counters;
+        uint32_t size = c.fifo_size.load(std::memory_order_relaxed);
+        double fill = size ? 100.0 * c.fifo_filled.load(std::memory_order_relaxed) / size : 0;
+
+        uint64_t dropped = c.dropped.load(std::memory_order_relaxed);
+        uint64_t underrun = c.underrun.load(std::memory_order_relaxed);
+        uint64_t overrun = c.overrun.load(std::memory_order_relaxed);
+        double link_rate = (double)c.link_rate.load(std::memory_order_relaxed);
+
+        pmt::pmt_t stream = pmt::make_dict();
+        stream = pmt::dict_add(stream, pmt::mp("dropped"), pmt::from_uint64(dropped));
+        stream = pmt::dict_add(stream, pmt::mp("underrun"), pmt::from_uint64(underrun));
+        stream = pmt::dict_add(stream, pmt::mp("overrun"), pmt::from_uint64(overrun));
+        stream = pmt::dict_add(stream, pmt::mp("fifo_fill"), pmt::from_double(fill));
+        // Positive when FIFO fills up since previous report
+        stream = pmt::dict_add(stream, pmt::mp("fifo_trend"), pmt::from_double(fill - e.last_fill));
+        stream = pmt::dict_add(stream, pmt::mp("link_rate"), pmt::from_double(link_rate));
+        e.last_fill = fill;
+
+        std::string name = (e.direction == LMS_CH_TX ? "tx" : "rx") + std::to_string(e.channel);
+        msg = pmt::dict_add(msg, pmt::mp(name), stream);
+    }
+    return msg;
+}
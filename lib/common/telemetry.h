@@ -0,0 +1,157 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <LimeSuite.h>
+#include <pmt/pmt.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Stream counters fed by the work thread from the status it reads anyway. LMS_GetStreamStatus
+ * resets dropped packet, underrun and overrun counts on every call, so telemetry never reads
+ * stream status itself and totals are accumulated here instead.
+ */
+class stream_counters {
+    public:
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> underrun{0};
+    std::atomic<uint64_t> overrun{0};
+    std::atomic<uint32_t> fifo_filled{0};
+    std::atomic<uint32_t> fifo_size{0};
+    std::atomic<uint64_t> link_rate{0};
+
+    void update(const lms_stream_status_t& status) {
+        dropped.fetch_add(status.droppedPackets, std::memory_order_relaxed);
+        underrun.fetch_add(status.underrun, std::memory_order_relaxed);
+        overrun.fetch_add(status.overrun, std::memory_order_relaxed);
+        fifo_filled.store(status.fifoFilledCount, std::memory_order_relaxed);
+        fifo_size.store(status.fifoSize, std::memory_order_relaxed);
+        link_rate.store((uint64_t)status.linkRate, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Device health telemetry. Low priority thread polls chip temperature and reference clock
+ * while there are subscribers and delivers a PMT dict with those and stream counters to each
+ * of them at the shortest subscribed interval. Device control is shared with block
+ * configuration, so polling skips a round rather than wait while configuration holds the lock.
+ */
+class device_telemetry {
+    private:
+    struct stream_entry {
+        int direction;
+        int channel;
+        std::shared_ptr<stream_counters> counters;
+        // FIFO fill in percent at previous report
+        double last_fill = 0;
+    };
+
+    struct subscriber {
+        double interval;
+        std::function<void(pmt::pmt_t)> callback;
+        std::chrono::steady_clock::time_point next;
+    };
+
+    lms_device_t* device = nullptr;
+    std::recursive_mutex* device_mutex = nullptr;
+    std::string serial;
+    int device_number = 0;
+
+    std::mutex state_mutex;
+    // Held while reports are delivered, so that unsubscribe returns after the last one
+    std::mutex delivery_mutex;
+    std::map<int, stream_entry> streams;
+    std::map<int, subscriber> subscribers;
+    int next_id = 0;
+
+    // Last chip readings, kept when a round is skipped
+    double temperature = NAN;
+    double ref_clock = NAN;
+    double cgen_clock = NAN;
+    int tcxo_dac = -1;
+
+    std::thread poll_thread;
+    std::atomic<bool> running{false};
+    std::condition_variable wait_cv;
+
+    void poll_loop();
+    void read_chip();
+    pmt::pmt_t make_report();
+
+    public:
+    device_telemetry(){};
+    ~device_telemetry();
+
+    /**
+     * Set device polled by telemetry. Stops polling when device is nullptr, polling of a new
+     * device resumes for existing subscribers.
+     *
+     * @param   device  Opened device.
+     *
+     * @param   mutex  Lock held by device configuration.
+     *
+     * @param   serial  Device serial reported in each dict.
+     *
+     * @param   device_number  Device number reported in each dict.
+     */
+    void attach(lms_device_t* device,
+                std::recursive_mutex* mutex,
+                const std::string& serial,
+                int device_number);
+
+    /**
+     * Register stream counters reported under "rx<channel>" or "tx<channel>".
+     *
+     * @return  counters the work thread updates and key for remove_stream
+     */
+    std::shared_ptr<stream_counters> add_stream(int direction, int channel, int& key);
+
+    void remove_stream(int key);
+
+    /**
+     * Deliver reports to callback. Polling thread starts with the first subscriber.
+     *
+     * @param   interval  Report interval in seconds.
+     *
+     * @return  key for unsubscribe
+     */
+    int subscribe(double interval, std::function<void(pmt::pmt_t)> callback);
+
+    /**
+     * Stop delivering reports. Polling thread stops with the last subscriber.
+     */
+    void unsubscribe(int key);
+
+    void stop();
+};
+
+#endif
@@ -0,0 +1,408 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "time_sync.h"
+#include "logger.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Largest device clock frequency error accepted by drift model
+static const double max_drift = 200e-6;
+// Time uncertainty of a single latch, packet timestamps over USB jitter by about 1 ms
+static const double latch_uncertainty = 2e-3;
+
+// Split host clock time point into UTC seconds and fraction
+static void split_time(std::chrono::system_clock::time_point t, time_latch& latch) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    latch.utc_secs = ns / 1000000000;
+    latch.utc_frac = (ns % 1000000000) / 1e9;
+}
+
+void stream_clock::reset(double rate) {
+    anchor_timestamp = 0;
+    anchor_secs = 0;
+    anchor_frac = 0;
+    this->rate = rate;
+}
+
+void stream_clock::rebase(uint64_t old_timestamp,
+                          uint64_t new_timestamp,
+                          double new_rate,
+                          double gap) {
+    uint64_t secs;
+    double frac;
+    to_time(old_timestamp, secs, frac);
+    frac += gap;
+    double whole = std::floor(frac);
+    anchor_secs = secs + (int64_t)whole;
+    anchor_frac = frac - whole;
+    anchor_timestamp = new_timestamp;
+    rate = new_rate;
+}
+
+void stream_clock::to_time(uint64_t timestamp, uint64_t& secs, double& frac) const {
+    // Whole seconds split off in integer arithmetic, so that sample resolution is kept
+    uint64_t delta = timestamp - anchor_timestamp;
+    uint64_t u_rate = (uint64_t)rate;
+    double f_rate = rate - u_rate;
+    uint64_t whole = delta / u_rate;
+    frac = anchor_frac + (delta - whole * u_rate - whole * f_rate) / rate;
+    secs = anchor_secs + whole;
+    double carry = std::floor(frac);
+    secs += (int64_t)carry;
+    frac -= carry;
+}
+
+uint64_t stream_clock::from_time(uint64_t secs, double frac) const {
+    int64_t delta_secs = (int64_t)(secs - anchor_secs);
+    uint64_t u_rate = (uint64_t)rate;
+    double f_rate = rate - u_rate;
+    return anchor_timestamp + u_rate * delta_secs +
+           llround(delta_secs * f_rate + (frac - anchor_frac) * rate);
+}
+
+void counter_feed::post(uint64_t timestamp, std::chrono::system_clock::time_point host) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->timestamp = timestamp;
+    this->host = host;
+    valid = true;
+}
+
+bool counter_feed::get(uint64_t& timestamp, std::chrono::system_clock::time_point& host) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    timestamp = this->timestamp;
+    host = this->host;
+    return valid;
+}
+
+void counter_feed::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    valid = false;
+}
+
+bool system_clock_source::latch(time_latch& latch) {
+    std::chrono::system_clock::time_point host;
+    if (!feed.get(latch.timestamp, host) || latch.timestamp == last_timestamp)
+        return false;
+    // Stalled stream would pair an old counter with a late latch
+    if (std::chrono::system_clock::now() - host > std::chrono::seconds(1))
+        return false;
+    last_timestamp = latch.timestamp;
+    split_time(host, latch);
+    return true;
+}
+
+pps_gpio_clock_source::pps_gpio_clock_source(lms_device_t* device,
+                                             const counter_feed& feed,
+                                             double samp_rate,
+                                             int pin,
+                                             std::atomic<bool>& running)
+    : device(device), feed(feed), samp_rate(samp_rate), pin_mask(1 << pin), running(running) {
+    // Configure PPS pin as input
+    uint8_t dir = 0;
+    if (LMS_GPIODirRead(device, &dir, 1) == LMS_SUCCESS) {
+        dir &= ~pin_mask;
+        LMS_GPIODirWrite(device, &dir, 1);
+    }
+}
+
+bool pps_gpio_clock_source::latch(time_latch& latch) {
+    uint8_t level = 0;
+    if (LMS_GPIORead(device, &level, 1) != LMS_SUCCESS)
+        return false;
+    bool previous = level & pin_mask;
+
+    // Poll for rising edge, give up after two seconds without PPS
+    auto t_end = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (running && std::chrono::steady_clock::now() < t_end) {
+        if (LMS_GPIORead(device, &level, 1) != LMS_SUCCESS)
+            return false;
+        bool current = level & pin_mask;
+        if (current && !previous) {
+            auto t_edge = std::chrono::system_clock::now();
+            // Edge marks start of the nearest full second of host time
+            time_latch host;
+            split_time(t_edge, host);
+            latch.utc_secs = host.utc_secs + (host.utc_frac >= 0.5 ? 1 : 0);
+            latch.utc_frac = 0;
+
+            // Wait for a work thread to post the counter after the edge, step back to it
+            auto t_wait = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+            while (running && std::chrono::steady_clock::now() < t_wait) {
+                uint64_t timestamp;
+                std::chrono::system_clock::time_point t_post;
+                if (feed.get(timestamp, t_post) && t_post >= t_edge) {
+                    double behind = std::chrono::duration<double>(t_post - t_edge).count();
+                    latch.timestamp = timestamp - llround(behind * samp_rate);
+                    return true;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+            return false;
+        }
+        previous = current;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return false;
+}
+
+simulated_clock_source::simulated_clock_source(double samp_rate, double ppm, double jitter)
+    : samp_rate(samp_rate), ppm(ppm), jitter(jitter), generator(std::random_device{}()) {
+    t0 = std::chrono::steady_clock::now();
+    split_time(std::chrono::system_clock::now(), start);
+    start.timestamp = 0;
+}
+
+bool simulated_clock_source::latch(time_latch& latch) {
+    std::normal_distribution<double> noise(0, jitter);
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    latch.timestamp = start.timestamp + llround(elapsed * samp_rate * (1 + ppm * 1e-6));
+    truth.timestamp = latch.timestamp;
+    truth.utc_secs = start.utc_secs + (int64_t)std::floor(start.utc_frac + elapsed);
+    truth.utc_frac = start.utc_frac + elapsed - std::floor(start.utc_frac + elapsed);
+
+    double total = start.utc_frac + elapsed + noise(generator);
+    latch.utc_secs = start.utc_secs + (int64_t)std::floor(total);
+    latch.utc_frac = total - std::floor(total);
+    return true;
+}
+
+time_sync::~time_sync() { stop(); }
+
+void time_sync::set_source(int type, double param) {
+    if (type < TIME_SOURCE_NONE || type > TIME_SOURCE_SIMULATED) {
+        log_stream() << "ERROR: time_sync::set_source(): time source must be NONE(0), SYSTEM(1), "
+                        "PPS_GPIO(2) or SIMULATED(3)."
+                     << std::endl;
+        return;
+    }
+    if (running) {
+        log_stream() << "WARNING: time_sync::set_source(): time source change applies on next "
+                        "stream start."
+                     << std::endl;
+    }
+    source_type = type;
+    source_param = param;
+}
+
+void time_sync::start(lms_device_t* device, double rate) {
+    if (running || source_type == TIME_SOURCE_NONE)
+        return;
+
+    samp_rate = rate;
+    {
+        std::lock_guard<std::mutex> lock(model_mutex);
+        history.clear();
+        rate_estimate = rate;
+        locked = false;
+    }
+    // Counter restarts with the stream
+    feed.reset();
+
+    running = true;
+    simulated = nullptr;
+    check_passed = false;
+    switch (source_type) {
+    case TIME_SOURCE_SYSTEM:
+        source.reset(new system_clock_source(feed));
+        break;
+    case TIME_SOURCE_PPS_GPIO:
+        source.reset(
+            new pps_gpio_clock_source(device, feed, rate, (int)source_param, running));
+        break;
+    case TIME_SOURCE_SIMULATED:
+        simulated = new simulated_clock_source(rate, source_param);
+        source.reset(simulated);
+        break;
+    }
+    latch_thread = std::thread(&time_sync::latch_loop, this);
+
+    std::string s_source[4] = {"NONE", "SYSTEM", "PPS_GPIO", "SIMULATED"};
+    log_stream() << "INFO: time_sync::start(): latching device time to " << s_source[source_type]
+                 << " time source." << std::endl;
+}
+
+void time_sync::stop() {
+    if (!running)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex);
+        running = false;
+    }
+    wait_cv.notify_all();
+    if (latch_thread.joinable())
+        latch_thread.join();
+    simulated = nullptr;
+    source.reset();
+}
+
+void time_sync::post_timestamp(uint64_t timestamp, std::chrono::system_clock::time_point host) {
+    if (running)
+        feed.post(timestamp, host);
+}
+
+void time_sync::latch_loop() {
+    // PPS source blocks until the edge itself, so only skip past the current edge
+    auto period = (source_type == TIME_SOURCE_PPS_GPIO) ? std::chrono::milliseconds(500)
+                                                        : std::chrono::milliseconds(1000);
+    while (running) {
+        time_latch latch;
+        if (source->latch(latch)) {
+            update_model(latch);
+            if (simulated)
+                check_model();
+        }
+
+        std::unique_lock<std::mutex> lock(wait_mutex);
+        wait_cv.wait_for(lock, period, [this] { return !running; });
+    }
+}
+
+void time_sync::update_model(const time_latch& latch) {
+    std::lock_guard<std::mutex> lock(model_mutex);
+
+    // Device counter restarted (stream restart), previous points are meaningless
+    if (!history.empty() && latch.timestamp < history.back().timestamp)
+        history.clear();
+
+    history.push_back(latch);
+    if (history.size() > history_size)
+        history.pop_front();
+
+    // Least squares fit of timestamp against UTC, relative to the oldest point for precision
+    const time_latch& first = history.front();
+    size_t n = history.size();
+    double mean_x = 0, mean_y = 0;
+    for (const time_latch& l : history) {
+        mean_x += (l.utc_secs - first.utc_secs) + (l.utc_frac - first.utc_frac);
+        mean_y += (double)(l.timestamp - first.timestamp);
+    }
+    mean_x /= n;
+    mean_y /= n;
+
+    double slope = samp_rate;
+    double span = 0;
+    if (n > 1) {
+        span = (history.back().utc_secs - first.utc_secs) +
+               (history.back().utc_frac - first.utc_frac);
+        double sxx = 0, sxy = 0;
+        for (const time_latch& l : history) {
+            double x = (l.utc_secs - first.utc_secs) + (l.utc_frac - first.utc_frac) - mean_x;
+            double y = (double)(l.timestamp - first.timestamp) - mean_y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        if (sxx > 0)
+            slope = sxy / sxx;
+    }
+
+    // Reject estimates far away from nominal rate (e.g. missed PPS edge) and start over. Latch
+    // jitter allows a larger slope error while points span only a few seconds.
+    double limit = max_drift + ((span > 0) ? latch_uncertainty / span : 0);
+    if (std::fabs(slope - samp_rate) > samp_rate * limit) {
+        log_stream() << "WARNING: time_sync::update_model(): clock drift out of range, resetting."
+                     << std::endl;
+        history.clear();
+        history.push_back(latch);
+        slope = samp_rate;
+        mean_x = 0;
+        mean_y = 0;
+    }
+
+    // Anchor model at latest UTC point, timestamp taken from fitted line
+    const time_latch& last = history.back();
+    double x_last = (last.utc_secs - history.front().utc_secs) +
+                    (last.utc_frac - history.front().utc_frac);
+    reference.utc_secs = last.utc_secs;
+    reference.utc_frac = last.utc_frac;
+    reference.timestamp =
+        history.front().timestamp + llround(mean_y + slope * (x_last - mean_x));
+    rate_estimate = slope;
+
+    if (!locked) {
+        log_stream() << "INFO: time_sync::update_model(): device time locked to UTC." << std::endl;
+        locked = true;
+    }
+}
+
+void time_sync::check_model() {
+    const time_latch& truth = simulated->get_truth();
+    uint64_t secs;
+    double frac;
+    if (!to_utc(truth.timestamp, secs, frac))
+        return;
+    double time_error = (double)((int64_t)secs - truth.utc_secs) + (frac - truth.utc_frac);
+    double rate_error;
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(model_mutex);
+        rate_error = (rate_estimate / simulated->get_rate() - 1) * 1e6;
+        full = history.size() == history_size;
+    }
+
+    // Fit averages latch jitter, it must track true time within a few jitter deviations and
+    // estimate frequency error once history is full
+    bool time_ok = std::fabs(time_error) <= std::max(10 * simulated->get_jitter(), 1e-6);
+    bool rate_ok = !full || std::fabs(rate_error) <= 1;
+    if (!time_ok || !rate_ok) {
+        log_stream() << "WARNING: time_sync::check_model(): simulated clock check failed, time "
+                        "error "
+                     << time_error * 1e6 << " us, frequency error " << rate_error << " ppm."
+                     << std::endl;
+        check_passed = false;
+    } else if (full && !check_passed) {
+        log_stream() << "INFO: time_sync::check_model(): simulated clock check passed, time "
+                        "error "
+                     << time_error * 1e6 << " us, frequency error " << rate_error << " ppm."
+                     << std::endl;
+        check_passed = true;
+    }
+}
+
+bool time_sync::is_locked() const {
+    std::lock_guard<std::mutex> lock(model_mutex);
+    return locked;
+}
+
+bool time_sync::to_utc(uint64_t timestamp, uint64_t& secs, double& frac) const {
+    std::lock_guard<std::mutex> lock(model_mutex);
+    if (!locked)
+        return false;
+
+    double total =
+        reference.utc_frac + (double)(int64_t)(timestamp - reference.timestamp) / rate_estimate;
+    double whole = std::floor(total);
+    secs = reference.utc_secs + (int64_t)whole;
+    frac = total - whole;
+    return true;
+}
+
+bool time_sync::from_utc(uint64_t secs, double frac, uint64_t& timestamp) const {
+    std::lock_guard<std::mutex> lock(model_mutex);
+    if (!locked)
+        return false;
+
+    double delta = (double)((int64_t)secs - reference.utc_secs) + (frac - reference.utc_frac);
+    timestamp = reference.timestamp + llround(delta * rate_estimate);
+    return true;
+}
@@ -0,0 +1,274 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <LimeSuite.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#define TIME_SOURCE_NONE 0
+#define TIME_SOURCE_SYSTEM 1
+#define TIME_SOURCE_PPS_GPIO 2
+#define TIME_SOURCE_SIMULATED 3
+
+/**
+ * Single correspondence between the device sample counter and absolute UTC time.
+ * UTC is kept as integer seconds plus fraction so that sample resolution is not lost.
+ */
+struct time_latch {
+    uint64_t timestamp = 0;
+    int64_t utc_secs = 0;
+    double utc_frac = 0;
+};
+
+/**
+ * Stream time since start, continuous over sample rate changes that restart the device
+ * sample counter. Time at a counter value is anchor time plus distance from anchor
+ * counter value at current rate.
+ */
+class stream_clock {
+    private:
+    uint64_t anchor_timestamp = 0;
+    uint64_t anchor_secs = 0;
+    double anchor_frac = 0;
+    double rate = 0;
+
+    public:
+    /**
+     * Start from zero time at zero counter value.
+     */
+    void reset(double rate);
+
+    /**
+     * Continue with new rate and counter: time at new_timestamp is time at old_timestamp
+     * plus gap seconds.
+     */
+    void rebase(uint64_t old_timestamp, uint64_t new_timestamp, double new_rate, double gap);
+
+    void to_time(uint64_t timestamp, uint64_t& secs, double& frac) const;
+
+    uint64_t from_time(uint64_t secs, double frac) const;
+};
+
+/**
+ * Device sample counter values read by the streaming work threads with the host time of the
+ * read. Stream status read clears dropped packet and FIFO error counters, so clock sources
+ * take the counter from here instead of reading the stream themselves.
+ */
+class counter_feed {
+    private:
+    mutable std::mutex mutex;
+    uint64_t timestamp = 0;
+    std::chrono::system_clock::time_point host;
+    bool valid = false;
+
+    public:
+    void post(uint64_t timestamp, std::chrono::system_clock::time_point host);
+
+    /**
+     * Get latest counter value.
+     *
+     * @return  false when nothing was posted since last reset
+     */
+    bool get(uint64_t& timestamp, std::chrono::system_clock::time_point& host) const;
+
+    void reset();
+};
+
+/**
+ * Host time reference used to latch the device sample counter.
+ */
+class clock_source {
+    public:
+    virtual ~clock_source(){};
+
+    /**
+     * Produce one latch point. May block until the reference edge arrives.
+     *
+     * @param   latch  Filled with device timestamp and matching UTC time.
+     *
+     * @return  true if latch is valid
+     */
+    virtual bool latch(time_latch& latch) = 0;
+};
+
+/**
+ * Host system clock (CLOCK_REALTIME). When the host runs ptp4l/phc2sys the system clock is
+ * PTP disciplined, so no separate PTP handling is needed here.
+ */
+class system_clock_source : public clock_source {
+    private:
+    const counter_feed& feed;
+    uint64_t last_timestamp = 0;
+
+    public:
+    system_clock_source(const counter_feed& feed) : feed(feed){};
+    bool latch(time_latch& latch);
+};
+
+/**
+ * PPS edge connected to one of the board GPIO pins. The edge is taken as the start of the
+ * nearest full UTC second of the host clock, so host time must be within +-0.5 s. Counter
+ * at the edge is extrapolated from the first counter value posted after it.
+ */
+class pps_gpio_clock_source : public clock_source {
+    private:
+    lms_device_t* device;
+    const counter_feed& feed;
+    double samp_rate;
+    uint8_t pin_mask;
+    std::atomic<bool>& running;
+
+    public:
+    pps_gpio_clock_source(lms_device_t* device,
+                          const counter_feed& feed,
+                          double samp_rate,
+                          int pin,
+                          std::atomic<bool>& running);
+    bool latch(time_latch& latch);
+};
+
+/**
+ * Simulated device clock for trying time tags without reference hardware. Device counter runs at
+ * samp_rate with given frequency error and latch jitter, starting at host time of creation.
+ * Noise free time of each latch is kept, so the drift model can be checked against it.
+ */
+class simulated_clock_source : public clock_source {
+    private:
+    double samp_rate;
+    double ppm;
+    double jitter;
+    std::chrono::steady_clock::time_point t0;
+    time_latch start;
+    std::mt19937 generator;
+    time_latch truth;
+
+    public:
+    simulated_clock_source(double samp_rate, double ppm, double jitter = 1e-6);
+    bool latch(time_latch& latch);
+
+    /**
+     * Last latch without jitter.
+     */
+    const time_latch& get_truth() const { return truth; }
+
+    /**
+     * Device counter rate in samples per UTC second, including frequency error.
+     */
+    double get_rate() const { return samp_rate * (1 + ppm * 1e-6); }
+
+    double get_jitter() const { return jitter; }
+};
+
+/**
+ * Maps device sample counter to absolute UTC using latches from a clock source and a linear
+ * drift model fitted over the latest latch points.
+ */
+class time_sync {
+    private:
+    // Number of latch points used in drift model
+    static const size_t history_size = 16;
+
+    int source_type = TIME_SOURCE_NONE;
+    double source_param = 0;
+    double samp_rate = 0;
+    std::unique_ptr<clock_source> source;
+    // Set when source is simulated, model is checked against its true time
+    simulated_clock_source* simulated = nullptr;
+    bool check_passed = false;
+    counter_feed feed;
+
+    mutable std::mutex model_mutex;
+    std::deque<time_latch> history;
+    // Drift model: reference latch and estimated device rate in samples per UTC second
+    time_latch reference;
+    double rate_estimate = 0;
+    bool locked = false;
+
+    std::thread latch_thread;
+    std::atomic<bool> running{false};
+    std::mutex wait_mutex;
+    std::condition_variable wait_cv;
+
+    void latch_loop();
+    void update_model(const time_latch& latch);
+    void check_model();
+
+    public:
+    time_sync(){};
+    ~time_sync();
+
+    /**
+     * Select host time source.
+     *
+     * @param   type  None(0), system clock(1), PPS on GPIO(2), simulated(3).
+     *
+     * @param   param GPIO pin number for PPS source, frequency error in ppm for simulated source.
+     */
+    void set_source(int type, double param);
+
+    int get_source() const { return source_type; }
+
+    /**
+     * Start latching against counter values posted by the streaming blocks. Does nothing if
+     * already running or no source set.
+     */
+    void start(lms_device_t* device, double rate);
+
+    void stop();
+
+    bool is_running() const { return running; }
+
+    /**
+     * Post device counter from a stream status read by a work thread.
+     *
+     * @param   timestamp  Counter value of the status.
+     *
+     * @param   host  Host time of the status read.
+     */
+    void post_timestamp(uint64_t timestamp, std::chrono::system_clock::time_point host);
+
+    bool is_locked() const;
+
+    /**
+     * Convert device timestamp to absolute UTC.
+     *
+     * @return  false when model is not locked yet
+     */
+    bool to_utc(uint64_t timestamp, uint64_t& secs, double& frac) const;
+
+    /**
+     * Convert absolute UTC to device timestamp.
+     *
+     * @return  false when model is not locked yet
+     */
+    bool from_utc(uint64_t secs, double frac, uint64_t& timestamp) const;
+};
+
+#endif
@@ -0,0 +1,133 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "tuning_cache.h"
+#include "logger.h"
+#include <cmath>
+
+// MAC field of register 0x0020 selects which SX is accessed: SXR(1), SXT(2)
+#define LMS7_MAC_REG 0x0020
+
+bool tuning_cache::select_sx(lms_device_t* device, bool direction, uint16_t& mac) {
+    if (LMS_ReadLMSReg(device, LMS7_MAC_REG, &mac) != LMS_SUCCESS)
+        return false;
+    uint16_t value = (mac & ~0x3) | (direction == LMS_CH_TX ? 2 : 1);
+    return LMS_WriteLMSReg(device, LMS7_MAC_REG, value) == LMS_SUCCESS;
+}
+
+void tuning_cache::store(
+    lms_device_t* device, bool direction, int channel, double freq, double actual) {
+    tuning_entry entry;
+    uint16_t mac;
+    if (!select_sx(device, direction, mac))
+        return;
+    bool ok = true;
+    for (int i = 0; i < sx_reg_count; i++)
+        ok &= LMS_ReadLMSReg(device, sx_first_reg + i, &entry.regs[i]) == LMS_SUCCESS;
+    LMS_WriteLMSReg(device, LMS7_MAC_REG, mac);
+    if (!ok)
+        return;
+
+    entry.antenna = LMS_GetAntenna(device, direction, channel);
+    entry.actual = actual;
+    last_antenna[direction] = entry.antenna;
+
+    int64_t key = std::llround(freq);
+    std::map<int64_t, cached_entry>& dir_entries = entries[direction];
+    std::list<int64_t>& order = use_order[direction];
+    auto it = dir_entries.find(key);
+    if (it != dir_entries.end()) {
+        it->second.entry = entry;
+        order.splice(order.begin(), order, it->second.use);
+        return;
+    }
+    if (dir_entries.size() >= max_entries) {
+        dir_entries.erase(order.back());
+        order.pop_back();
+    }
+    order.push_front(key);
+    dir_entries[key] = {entry, order.begin()};
+}
+
+bool tuning_cache::replay(lms_device_t* device,
+                          bool direction,
+                          int channel,
+                          double freq,
+                          bool auto_path,
+                          double& actual) {
+    auto it = entries[direction].find(std::llround(freq));
+    if (it == entries[direction].end())
+        return false;
+    const tuning_entry& entry = it->second.entry;
+
+    uint16_t mac;
+    if (!select_sx(device, direction, mac))
+        return false;
+    bool ok = true;
+    for (int i = 0; i < sx_reg_count; i++)
+        ok &= LMS_WriteLMSReg(device, sx_first_reg + i, entry.regs[i]) == LMS_SUCCESS;
+    LMS_WriteLMSReg(device, LMS7_MAC_REG, mac);
+    if (!ok)
+        return false;
+
+    if (auto_path && entry.antenna >= 0 && entry.antenna != last_antenna[direction]) {
+        LMS_SetAntenna(device, direction, channel, entry.antenna);
+        last_antenna[direction] = entry.antenna;
+    }
+    actual = entry.actual;
+    std::list<int64_t>& order = use_order[direction];
+    order.splice(order.begin(), order, it->second.use);
+    return true;
+}
+
+bool tuning_cache::contains(bool direction, double freq) const {
+    return entries[direction].count(std::llround(freq)) > 0;
+}
+
+void tuning_cache::clear() {
+    for (int direction = 0; direction < 2; direction++) {
+        entries[direction].clear();
+        use_order[direction].clear();
+    }
+    last_antenna[0] = last_antenna[1] = -1;
+}
+
+void tuning_cache::record(bool hit, double seconds) {
+    if (hit) {
+        hits++;
+        hit_time += seconds;
+    } else {
+        misses++;
+        miss_time += seconds;
+    }
+}
+
+void tuning_cache::print_stats() const {
+    if (hits + misses == 0)
+        return;
+    log_stream() << "INFO: tuning_cache::print_stats(): " << misses << " full tunes";
+    if (misses > 0)
+        log_stream() << " (avg. " << miss_time / misses * 1e6 << " us)";
+    log_stream() << ", " << hits << " cached tunes";
+    if (hits > 0)
+        log_stream() << " (avg. " << hit_time / hits * 1e6 << " us)";
+    log_stream() << "." << std::endl;
+}
@@ -0,0 +1,104 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2018 Lime Microsystems info@limemicro.com
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef TUNING_CACHE_H
+#define TUNING_CACHE_H
+
+#include <LimeSuite.h>
+#include <cstdint>
+#include <list>
+#include <map>
+
+/**
+ * Resolved synthesizer (SXR/SXT) register set of one LO frequency.
+ */
+struct tuning_entry {
+    // LMS7002M SX registers 0x011C - 0x0124
+    uint16_t regs[9];
+    // Path selected by the board for this frequency (matters with automatic path selection)
+    int antenna;
+    // Actual LO frequency
+    double actual;
+};
+
+/**
+ * Cache of synthesizer register sets per LO frequency. First tune to a frequency goes through
+ * LMS_SetLOFrequency (PLL/VCO calculation and VCO tuning), its resulting register set is then
+ * written back directly on revisits.
+ */
+class tuning_cache {
+    private:
+    static const uint16_t sx_first_reg = 0x011C;
+    static const int sx_reg_count = 9;
+    static const size_t max_entries = 4096;
+
+    struct cached_entry {
+        tuning_entry entry;
+        // Position in use order
+        std::list<int64_t>::iterator use;
+    };
+    // Entries per direction, keyed by frequency in Hz
+    std::map<int64_t, cached_entry> entries[2];
+    // Frequencies per direction, most recently used first, least recently used is evicted
+    std::list<int64_t> use_order[2];
+    // Path last written by the cache per direction, -1 if unknown
+    int last_antenna[2] = {-1, -1};
+
+    // Retune statistics: count and total time of cached and full tunes
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    double hit_time = 0;
+    double miss_time = 0;
+
+    bool select_sx(lms_device_t* device, bool direction, uint16_t& mac);
+
+    public:
+    /**
+     * Store register set of a frequency just tuned with LMS_SetLOFrequency.
+     */
+    void store(lms_device_t* device, bool direction, int channel, double freq, double actual);
+
+    /**
+     * Write cached register set of a frequency.
+     *
+     * @param   auto_path  Board selects path by frequency, restore stored path too.
+     *
+     * @param   actual  Actual LO frequency of the entry.
+     *
+     * @return  false if frequency is not cached
+     */
+    bool replay(lms_device_t* device,
+                bool direction,
+                int channel,
+                double freq,
+                bool auto_path,
+                double& actual);
+
+    bool contains(bool direction, double freq) const;
+
+    void clear();
+
+    void record(bool hit, double seconds);
+
+    void print_stats() const;
+};
+
+#endif
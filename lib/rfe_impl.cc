@@ -22,26 +22,54 @@
 #include "config.h"
 #endif
 
-#include "common/device_handler.h"
-#include <limesdr/rfe.h>
+#include "rfe_impl.h"
+#include "common/logger.h"
+#include <gnuradio/io_signature.h>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+// Power detector ADC reference voltage and full scale code
+#define RFE_ADC_VREF 5.0
+#define RFE_ADC_MAX 1023
+// Log detector output slope in V/dB
+#define RFE_DETECTOR_SLOPE 0.021
+// Forward ADC code below which there is no transmission to judge SWR from
+#define RFE_SWR_MIN_FORWARD 20
 
 namespace gr {
 namespace limesdr {
-rfe::rfe(int comm_type,
-         std::string device,
-         std::string config_file,
-         char IDRX,
-         char IDTX,
-         char PortRX,
-         char PortTX,
-         char Mode,
-         char Notch,
-         char Atten)
+rfe::sptr rfe::make(int comm_type,
+                    std::string device,
+                    std::string config_file,
+                    char IDRX,
+                    char IDTX,
+                    char PortRX,
+                    char PortTX,
+                    char Mode,
+                    char Notch,
+                    char Atten)
+{
+    return gnuradio::get_initial_sptr(new rfe_impl(
+        comm_type, device, config_file, IDRX, IDTX, PortRX, PortTX, Mode, Notch, Atten));
+}
+
+rfe_impl::rfe_impl(int comm_type,
+                   std::string device,
+                   std::string config_file,
+                   char IDRX,
+                   char IDTX,
+                   char PortRX,
+                   char PortTX,
+                   char Mode,
+                   char Notch,
+                   char Atten)
+    : gr::block("rfe", gr::io_signature::make(0, 0, 0), gr::io_signature::make(0, 0, 0))
 {
-    std::cout << "---------------------------------------------------------------"
-              << std::endl;
-    std::cout << "LimeSuite RFE info" << std::endl;
-    std::cout << std::endl;
+    log_stream() << "---------------------------------------------------------------"
+                 << std::endl;
+    log_stream() << "LimeSuite RFE info" << std::endl;
+    log_stream() << std::endl;
 
     boardState.channelIDRX = IDRX;
     boardState.channelIDTX = IDTX;
@@ -54,209 +82,520 @@ rfe::rfe(int comm_type,
     if (comm_type) // SDR GPIO communication
     {
         sdr_device_num = device_handler::getInstance().open_device(device);
+        sdr_comm = true;
 
-        std::cout << "LimeRFE: Opening through GPIO communication" << std::endl;
+        log_stream() << "LimeRFE: Opening through GPIO communication" << std::endl;
         rfe_dev =
             RFE_Open(nullptr, device_handler::getInstance().get_device(sdr_device_num));
         if (!rfe_dev) {
-            std::cout << "LimeRFE: Failed to open device, exiting" << std::endl;
+            log_stream() << "LimeRFE: Failed to open device, exiting" << std::endl;
             exit(0);
         }
 
         // No need to set up this if it isn't automatic
         if (boardState.channelIDRX == RFE_CID_AUTO ||
             boardState.channelIDTX == RFE_CID_AUTO) {
-            device_handler::getInstance().set_rfe_device(rfe_dev);
+            device_handler::getInstance().set_rfe_device(sdr_device_num, rfe_dev);
+            rfe_auto_channels = true;
 
             // Update the channels since the SDR could already be set up and working
-            device_handler::getInstance().update_rfe_channels();
+            device_handler::getInstance().update_rfe_channels(sdr_device_num);
         }
     } else // Direct USB
     {
         // Not using device handler so print the version
-        std::cout << "##################" << std::endl;
-        std::cout << "LimeSuite version: " << LMS_GetLibraryVersion() << std::endl;
-        std::cout << "gr-limesdr version: " << GR_LIMESDR_VER << std::endl;
-        std::cout << "##################" << std::endl;
+        log_stream() << "##################" << std::endl;
+        log_stream() << "LimeSuite version: " << LMS_GetLibraryVersion() << std::endl;
+        log_stream() << "gr-limesdr version: " << GR_LIMESDR_VER << std::endl;
+        log_stream() << "##################" << std::endl;
 
-        std::cout << "LimeRFE: Opening " << device << std::endl;
+        log_stream() << "LimeRFE: Opening " << device << std::endl;
         rfe_dev = RFE_Open(device.c_str(), nullptr);
         if (!rfe_dev) {
-            std::cout << "LimeRFE: Failed to open device, exiting" << std::endl;
+            log_stream() << "LimeRFE: Failed to open device, exiting" << std::endl;
             exit(0);
         }
     }
 
+    tdd = std::make_shared<rfe_tdd>(rfe_dev);
+
     int error = 0;
     unsigned char info[4] = { 0 };
     if ((error = RFE_GetInfo(rfe_dev, info)) != 0) {
-        std::cout << "LimeRFE: Failed to get device info: ";
+        log_stream() << "LimeRFE: Failed to get device info: ";
         print_error(error);
         exit(0);
     }
-    std::cout << "LimeRFE: FW: " << (int)info[0] << " HW: " << (int)info[1] << std::endl;
+    log_stream() << "LimeRFE: FW: " << (int)info[0] << " HW: " << (int)info[1] << std::endl;
 
     if (config_file.empty()) {
         if ((error = RFE_ConfigureState(rfe_dev, boardState)) != 0) {
-            std::cout << "LimeRFE: Failed to configure device: ";
+            log_stream() << "LimeRFE: Failed to configure device: ";
             print_error(error);
             exit(0);
         }
     } else {
-        std::cout << "LimeRFE: Loading configuration file" << std::endl;
+        log_stream() << "LimeRFE: Loading configuration file" << std::endl;
         if ((error = RFE_LoadConfig(rfe_dev, config_file.c_str())) != 0) {
-            std::cout << "LimeRFE: Failed to load configuration file: ";
+            log_stream() << "LimeRFE: Failed to load configuration file: ";
             print_error(error);
             exit(0);
         }
+        // Later changes start from the loaded configuration
+        RFE_GetState(rfe_dev, &boardState);
     }
-    std::cout << "LimeRFE: Board state: " << std::endl;
+    board_state = boardState;
+    board_state_valid = true;
+    log_stream() << "LimeRFE: Board state: " << std::endl;
     get_board_state();
-    std::cout << "---------------------------------------------------------------"
-              << std::endl;
+
+    // Result of each background board update
+    message_port_register_out(pmt::mp("status"));
+    // Power and SWR measurements
+    message_port_register_out(pmt::mp("measurement"));
+    command_running = true;
+    command_thread = std::thread(&rfe_impl::command_loop, this);
+    log_stream() << "---------------------------------------------------------------"
+                 << std::endl;
 }
 
-rfe::~rfe()
+rfe_impl::~rfe_impl()
 {
-    std::cout << "LimeRFE: closing" << std::endl;
+    log_stream() << "LimeRFE: closing" << std::endl;
+    stop_measurement();
+    // Pending update is written before the thread exits
+    {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        command_running = false;
+        command_cv.notify_all();
+    }
+    if (command_thread.joinable())
+        command_thread.join();
+    if (tdd && tdd->is_running()) {
+        device_handler::getInstance().set_rfe_tdd(sdr_device_num, nullptr);
+        tdd->stop();
+    }
+    if (rfe_auto_channels)
+        device_handler::getInstance().set_rfe_device(sdr_device_num, nullptr);
     if (rfe_dev) {
         RFE_Reset(rfe_dev);
         RFE_Close(rfe_dev);
     }
 }
 
-int rfe::change_mode(int mode)
+int rfe_impl::change_mode(int mode)
 {
     if (rfe_dev) {
         if (mode == RFE_MODE_TXRX) {
             if (boardState.selPortRX == boardState.selPortTX &&
                 boardState.channelIDRX < RFE_CID_CELL_BAND01) {
-                std::cout
-                    << "LimeRFE: mode cannot be set to RX+TX when same port is selected"
-                    << std::endl;
+                log_stream()
+                       << "LimeRFE: mode cannot be set to RX+TX when same port is selected"
+                       << std::endl;
                 return -1;
             }
         }
         int error = 0;
-        if (mode > 3 || mode < 0)
-            std::cout << "LimeRFE: invalid mode" << std::endl;
+        if (mode > 3 || mode < 0) {
+            log_stream() << "LimeRFE: invalid mode" << std::endl;
+            return -1;
+        }
+        if (tx_cutoff && (mode == RFE_MODE_TX || mode == RFE_MODE_TXRX)) {
+            log_stream() << "LimeRFE: TX is cut off after high SWR, clear cut-off first"
+                         << std::endl;
+            return -1;
+        }
         std::string mode_str[4] = { "RX", "TX", "NONE", "RX+TX" };
-        std::cout << "LimeRFE: changing mode to " << mode_str[mode] << std::endl;
+        log_stream() << "LimeRFE: changing mode to " << mode_str[mode] << std::endl;
+        std::lock_guard<std::mutex> lock(tdd->board_mutex);
         if ((error = RFE_Mode(rfe_dev, mode)) != 0) {
-            std::cout << "LimeRFE: failed to change mode:";
+            log_stream() << "LimeRFE: failed to change mode:";
             print_error(error);
         }
+        tdd->mode_changed(mode);
+        std::lock_guard<std::mutex> command_lock(command_mutex);
         boardState.mode = mode;
+        board_state.mode = mode;
         return error;
     }
-    std::cout << "LimeRFE: no RFE device opened" << std::endl;
+    log_stream() << "LimeRFE: no RFE device opened" << std::endl;
     return -1;
 }
 
-int rfe::set_fan(int enable)
+int rfe_impl::set_fan(int enable)
 {
     if (rfe_dev) {
         std::string enable_str[2] = { "disabling", "enabling" };
-        std::cout << "LimeRFE: " << enable_str[enable] << " fan" << std::endl;
+        log_stream() << "LimeRFE: " << enable_str[enable] << " fan" << std::endl;
         int error = 0;
+        std::lock_guard<std::mutex> lock(tdd->board_mutex);
         if ((error = RFE_Fan(rfe_dev, enable)) != 0) {
-            std::cout << "LimeRFE: failed to change mode:";
+            log_stream() << "LimeRFE: failed to change mode:";
             print_error(error);
+        } else {
+            fan_state = enable;
         }
         return error;
     }
-    std::cout << "LimeRFE: no RFE device opened" << std::endl;
+    log_stream() << "LimeRFE: no RFE device opened" << std::endl;
     return -1;
 }
 
-int rfe::set_attenuation(int attenuation)
+int rfe_impl::set_attenuation(int attenuation)
 {
     if (rfe_dev) {
-        int error = 0;
-        if (attenuation > 7) {
-            std::cout << "LimeRFE: attenuation value too high, valid range [0, 7]"
-                      << std::endl;
+        if (attenuation > 7 || attenuation < 0) {
+            log_stream() << "LimeRFE: attenuation value out of range, valid range [0, 7]"
+                         << std::endl;
             return -1;
         }
-        std::cout << "LimeRFE: changing attenuation value to: " << attenuation
-                  << std::endl;
-        ;
-
+        std::lock_guard<std::mutex> lock(command_mutex);
         boardState.attValue = attenuation;
-        if ((error = RFE_ConfigureState(rfe_dev, boardState)) != 0) {
-            std::cout << "LimeRFE: failed to change attenuation: ";
-            print_error(error);
-        }
-        return error;
+        request_update();
+        return 0;
     }
-    std::cout << "LimeRFE: no RFE device opened" << std::endl;
+    log_stream() << "LimeRFE: no RFE device opened" << std::endl;
     return -1;
 }
 
-int rfe::set_notch(int enable)
+int rfe_impl::set_notch(int enable)
 {
     if (rfe_dev) {
         if (boardState.channelIDRX > RFE_CID_HAM_0920 ||
             boardState.channelIDRX == RFE_CID_WB_4000) {
-            std::cout << "LimeRFE: notch filter cannot be se for this RX channel"
-                      << std::endl;
+            log_stream() << "LimeRFE: notch filter cannot be se for this RX channel"
+                         << std::endl;
             return -1;
         }
-        int error = 0; //! TODO: might need renaming
+        std::lock_guard<std::mutex> lock(command_mutex);
         boardState.notchOnOff = enable;
-        std::string en_dis[2] = { "disabling", "enabling" };
-        std::cout << "LimeRFE: " << en_dis[enable] << " notch filter" << std::endl;
-        if ((error = RFE_ConfigureState(rfe_dev, boardState)) != 0) {
-            std::cout << "LimeRFE: failed to change change attenuation: ";
+        request_update();
+        return 0;
+    }
+    return -1;
+}
+
+// Called with command_mutex held
+void rfe_impl::request_update()
+{
+    update_requests++;
+    update_pending = true;
+    command_cv.notify_all();
+}
+
+void rfe_impl::command_loop()
+{
+    std::unique_lock<std::mutex> lock(command_mutex);
+    while (true) {
+        command_cv.wait(lock, [this] { return update_pending || !command_running; });
+        if (!update_pending)
+            break;
+        rfe_boardState state = boardState;
+        int merged = update_requests;
+        update_pending = false;
+        update_requests = 0;
+        lock.unlock();
+
+        int error = 0;
+        bool write;
+        {
+            std::lock_guard<std::mutex> board_lock(tdd->board_mutex);
+            // Mode is owned by burst switching while it runs
+            bool mode_owned = false;
+            if (tdd->is_running() && tdd->get_mode() >= 0) {
+                state.mode = tdd->get_mode();
+                mode_owned = true;
+            }
+            if (tx_cutoff && (state.mode == RFE_MODE_TX || state.mode == RFE_MODE_TXRX)) {
+                state.mode = RFE_MODE_RX;
+                mode_owned = true;
+            }
+            // Nothing to write when requests ended where the board is. Overridden mode is
+            // the one the board is in, it does not count as a change.
+            {
+                std::lock_guard<std::mutex> command_lock(command_mutex);
+                rfe_boardState current = board_state;
+                if (mode_owned)
+                    current.mode = state.mode;
+                write = !board_state_valid ||
+                        std::memcmp(&state, &current, sizeof(state)) != 0;
+            }
+            if (write)
+                error = RFE_ConfigureState(rfe_dev, state);
+        }
+        if (error != 0) {
+            log_stream() << "LimeRFE: failed to configure board state: ";
             print_error(error);
+        } else if (write) {
+            std::string en_dis[2] = { "disabled", "enabled" };
+            log_stream() << "LimeRFE: attenuation " << (int)state.attValue << ", notch "
+                         << en_dis[state.notchOnOff != 0] << std::endl;
+        }
+        // Requests already in effect are reported as well
+        publish_status("configure_state", error, state, merged);
+
+        lock.lock();
+        // Board state is unknown after a failed write, next request is written in full
+        if (write) {
+            board_state = state;
+            board_state_valid = error == 0;
         }
-        return error;
     }
-    return -1;
 }
-void rfe::print_error(int error)
+
+void rfe_impl::publish_status(const std::string& command,
+                              int error,
+                              const rfe_boardState& state,
+                              int merged)
+{
+    pmt::pmt_t msg = pmt::make_dict();
+    msg = pmt::dict_add(msg, pmt::mp("command"), pmt::string_to_symbol(command));
+    msg = pmt::dict_add(msg, pmt::mp("error"), pmt::from_long(error));
+    msg = pmt::dict_add(msg,
+                        pmt::mp("message"),
+                        pmt::string_to_symbol(error ? error_string(error) : "success"));
+    msg = pmt::dict_add(msg, pmt::mp("mode"), pmt::from_long(state.mode));
+    msg = pmt::dict_add(msg, pmt::mp("attenuation"), pmt::from_long(state.attValue));
+    msg = pmt::dict_add(msg, pmt::mp("notch"), pmt::from_long(state.notchOnOff));
+    msg = pmt::dict_add(msg, pmt::mp("merged"), pmt::from_long(merged));
+    message_port_pub(pmt::mp("status"), msg);
+}
+
+int rfe_impl::set_tdd(int enable, double guard_time)
+{
+    if (!rfe_dev) {
+        log_stream() << "LimeRFE: no RFE device opened" << std::endl;
+        return -1;
+    }
+    if (!enable) {
+        if (tdd->is_running()) {
+            log_stream() << "LimeRFE: disabling TDD switching" << std::endl;
+            device_handler::getInstance().set_rfe_tdd(sdr_device_num, nullptr);
+            tdd->stop();
+        }
+        return 0;
+    }
+    if (!sdr_comm) {
+        log_stream() << "LimeRFE: TDD switching needs SDR communication" << std::endl;
+        return -1;
+    }
+    if (guard_time < 0) {
+        log_stream() << "LimeRFE: guard time must not be negative" << std::endl;
+        return -1;
+    }
+    log_stream() << "LimeRFE: enabling TDD switching, guard time " << guard_time * 1e3 << " ms"
+                 << std::endl;
+    tdd->start(guard_time);
+    {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        boardState.mode = RFE_MODE_RX;
+    }
+    device_handler::getInstance().set_rfe_tdd(sdr_device_num, tdd);
+    return 0;
+}
+
+int rfe_impl::set_measurement(int enable,
+                              double interval,
+                              int swr_source,
+                              double swr_threshold)
+{
+    if (!rfe_dev) {
+        log_stream() << "LimeRFE: no RFE device opened" << std::endl;
+        return -1;
+    }
+    stop_measurement();
+    if (!enable) {
+        // Detectors are switched off again with the measurement
+        std::lock_guard<std::mutex> lock(command_mutex);
+        if (boardState.enableSWR != RFE_SWR_DISABLE) {
+            boardState.enableSWR = RFE_SWR_DISABLE;
+            request_update();
+        }
+        return 0;
+    }
+    if (interval <= 0 || swr_threshold < 0 || (swr_threshold > 0 && swr_threshold <= 1)) {
+        log_stream() << "LimeRFE: measurement interval must be more than 0 and SWR threshold "
+                        "0 (off) or more than 1"
+                     << std::endl;
+        return -1;
+    }
+    measure_interval = interval;
+    this->swr_threshold = swr_threshold;
+    {
+        // SWR detectors are routed by board state
+        std::lock_guard<std::mutex> lock(command_mutex);
+        boardState.enableSWR = RFE_SWR_ENABLE;
+        boardState.sourceSWR = swr_source ? RFE_SWR_SRC_CELL : RFE_SWR_SRC_EXT;
+        request_update();
+    }
+    log_stream() << "LimeRFE: measuring power every " << interval * 1e3 << " ms";
+    if (swr_threshold > 0)
+        log_stream() << ", TX cut-off above SWR " << swr_threshold;
+    log_stream() << std::endl;
+    measure_running = true;
+    measure_thread = std::thread(&rfe_impl::measure_loop, this);
+    return 0;
+}
+
+int rfe_impl::clear_tx_cutoff()
+{
+    if (tx_cutoff.exchange(false)) {
+        log_stream() << "LimeRFE: TX cut-off cleared" << std::endl;
+        tdd->set_tx_inhibit(false);
+    }
+    return 0;
+}
+
+void rfe_impl::stop_measurement()
+{
+    {
+        std::lock_guard<std::mutex> lock(measure_mutex);
+        measure_running = false;
+        measure_cv.notify_all();
+    }
+    if (measure_thread.joinable())
+        measure_thread.join();
+}
+
+void rfe_impl::measure_loop()
+{
+    auto next = std::chrono::steady_clock::now();
+    while (measure_running) {
+        int forward = 0;
+        int reflected = 0;
+        int mode;
+        {
+            std::lock_guard<std::mutex> lock(command_mutex);
+            mode = board_state.mode;
+        }
+        // One read per lock, so that burst mode switches wait for a single read at most
+        int error;
+        {
+            std::lock_guard<std::mutex> lock(tdd->board_mutex);
+            error = RFE_ReadADC(rfe_dev, RFE_ADC1, &forward);
+            if (tdd->is_running())
+                mode = tdd->get_mode();
+        }
+        if (error == 0) {
+            std::lock_guard<std::mutex> lock(tdd->board_mutex);
+            error = RFE_ReadADC(rfe_dev, RFE_ADC2, &reflected);
+        }
+        auto t = std::chrono::system_clock::now().time_since_epoch();
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+
+        if (error != 0) {
+            log_stream() << "LimeRFE: failed to read power detectors: ";
+            print_error(error);
+        } else {
+            // Detectors are logarithmic, code difference is return loss
+            double volts_per_code = RFE_ADC_VREF / RFE_ADC_MAX;
+            double forward_db = forward * volts_per_code / RFE_DETECTOR_SLOPE;
+            double return_loss = (forward - reflected) * volts_per_code / RFE_DETECTOR_SLOPE;
+            double gamma = std::pow(10, -std::max(0.0, return_loss) / 20);
+            double swr = (gamma < 1) ? (1 + gamma) / (1 - gamma) : INFINITY;
+
+            bool transmitting = mode == RFE_MODE_TX || mode == RFE_MODE_TXRX;
+            if (swr_threshold > 0 && transmitting && forward >= RFE_SWR_MIN_FORWARD &&
+                swr > swr_threshold && !tx_cutoff)
+                cut_off_tx(swr);
+
+            pmt::pmt_t msg = pmt::make_dict();
+            msg = pmt::dict_add(msg,
+                                pmt::mp("time"),
+                                pmt::make_tuple(pmt::from_uint64(ns / 1000000000),
+                                                pmt::from_double((ns % 1000000000) / 1e9)));
+            msg = pmt::dict_add(msg, pmt::mp("forward_adc"), pmt::from_long(forward));
+            msg = pmt::dict_add(msg, pmt::mp("reflected_adc"), pmt::from_long(reflected));
+            msg = pmt::dict_add(msg, pmt::mp("forward_db"), pmt::from_double(forward_db));
+            msg = pmt::dict_add(msg, pmt::mp("return_loss"), pmt::from_double(return_loss));
+            msg = pmt::dict_add(msg, pmt::mp("swr"), pmt::from_double(swr));
+            msg = pmt::dict_add(msg, pmt::mp("mode"), pmt::from_long(mode));
+            msg = pmt::dict_add(msg, pmt::mp("fan"), pmt::from_long(fan_state));
+            msg = pmt::dict_add(msg, pmt::mp("tx_cutoff"), pmt::from_bool(tx_cutoff));
+            message_port_pub(pmt::mp("measurement"), msg);
+        }
+
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(measure_interval));
+        std::unique_lock<std::mutex> lock(measure_mutex);
+        measure_cv.wait_until(lock, next, [this] { return !measure_running; });
+    }
+}
+
+void rfe_impl::cut_off_tx(double swr)
+{
+    tx_cutoff = true;
+    // Burst switching stops going to TX before the board is taken out of it
+    tdd->set_tx_inhibit(true);
+    int error;
+    {
+        std::lock_guard<std::mutex> lock(tdd->board_mutex);
+        error = RFE_Mode(rfe_dev, RFE_MODE_RX);
+        if (error == 0)
+            tdd->mode_changed(RFE_MODE_RX);
+    }
+    {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        boardState.mode = RFE_MODE_RX;
+        if (error == 0)
+            board_state.mode = RFE_MODE_RX;
+    }
+    log_stream() << "LimeRFE: SWR " << swr << " above " << swr_threshold
+                 << ", TX cut off until clear_tx_cutoff" << std::endl;
+    if (error != 0) {
+        log_stream() << "LimeRFE: failed to change mode:";
+        print_error(error);
+    }
+}
+
+std::string rfe_impl::error_string(int error)
 {
     switch (error) {
     case -4:
-        std::cout << "error synchronizing communication" << std::endl;
-        break;
+        return "error synchronizing communication";
     case -3:
-        std::cout
-            << "non-configurable GPIO pin specified. Only pins 4 and 5 are configurable."
-            << std::endl;
-        break;
+        return "non-configurable GPIO pin specified. Only pins 4 and 5 are configurable.";
     case -2:
-        std::cout << "couldn't read the .ini configuration file" << std::endl;
-        break;
+        return "couldn't read the .ini configuration file";
     case -1:
-        std::cout << "communication error" << std::endl;
-        break;
+        return "communication error";
     case 1:
-        std::cout << "wrong TX port - not possible to route selected TX channel"
-                  << std::endl;
-        break;
+        return "wrong TX port - not possible to route selected TX channel";
     case 2:
-        std::cout << "wrong RX port - not possible to route selected RX channel"
-                  << std::endl;
-        break;
+        return "wrong RX port - not possible to route selected RX channel";
     case 3:
-        std::cout << "TX+RX mode cannot be used when same TX and RX port is used"
-                  << std::endl;
-        break;
+        return "TX+RX mode cannot be used when same TX and RX port is used";
     case 4:
-        std::cout << "wrong mode for the cellular channel" << std::endl;
-        break;
+        return "wrong mode for the cellular channel";
     case 5:
-        std::cout << "cellular channels must be the same both for RX and TX" << std::endl;
-        break;
+        return "cellular channels must be the same both for RX and TX";
     case 6:
-        std::cout << "requested channel code is wrong" << std::endl;
-        break;
+        return "requested channel code is wrong";
     default:
-        std::cout << "error code doesn't match" << std::endl;
-        break;
+        return "error code doesn't match";
     }
 }
 
+void rfe_impl::print_error(int error) { log_stream() << error_string(error) << std::endl; }
+
+void rfe_impl::get_board_state()
+{
+    rfe_boardState currentState = { 0 };
+    if (RFE_GetState(rfe_dev, &currentState) != 0) {
+        log_stream() << "LimeRFE: failed to get board state" << std::endl;
+        return;
+    }
+
+    log_stream() << "LimeRFE: RX channel: " << (int)currentState.channelIDRX << std::endl;
+    log_stream() << "LimeRFE: TX channel: " << (int)currentState.channelIDTX << std::endl;
+    log_stream() << "LimeRFE: PortRX: " << (int)currentState.selPortRX << std::endl;
+    log_stream() << "LimeRFE: PortTx: " << (int)currentState.selPortTX << std::endl;
+    log_stream() << "LimeRFE: Mode: " << (int)currentState.mode << std::endl;
+    log_stream() << "LimeRFE: Notch: " << (int)currentState.notchOnOff << std::endl;
+    log_stream() << "LimeRFE: Attenuation: " << (int)currentState.attValue << std::endl;
+    log_stream() << "LimeRFE: Enable SWR: " << (int)currentState.enableSWR << std::endl;
+    log_stream() << "LimeRFE: SourceSWR: " << (int)currentState.sourceSWR << std::endl;
+}
+
 } // namespace limesdr
 } // namespace gr
@@ -0,0 +1,126 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2020 Lime Microsystems.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_LIMESDR_RFE_IMPL_H
+#define INCLUDED_LIMESDR_RFE_IMPL_H
+
+#include "common/device_handler.h"
+#include <limeRFE.h>
+#include <limesdr/rfe.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace gr {
+namespace limesdr {
+class rfe_impl : public rfe
+{
+private:
+    rfe_dev_t* rfe_dev = nullptr;
+    // Requested board state
+    rfe_boardState boardState = { RFE_CID_WB_1000,
+                                  RFE_CID_WB_1000,
+                                  RFE_PORT_1,
+                                  RFE_PORT_1,
+                                  RFE_MODE_NONE,
+                                  RFE_NOTCH_OFF,
+                                  0,
+                                  0,
+                                  0 };
+    int sdr_device_num = 0;
+    bool sdr_comm = false;
+    // Registered with device_handler for automatic channel assignment
+    bool rfe_auto_channels = false;
+    // Mode switching by sink bursts, also serializes board commands with its thread
+    std::shared_ptr<rfe_tdd> tdd;
+
+    // Board state updates written by command thread. Requests are merged into boardState
+    // and written as one RFE_ConfigureState, board_state holds what was last written.
+    rfe_boardState board_state = {};
+    bool board_state_valid = false;
+    bool update_pending = false;
+    int update_requests = 0;
+    std::mutex command_mutex;
+    std::condition_variable command_cv;
+    std::thread command_thread;
+    bool command_running = false;
+
+    // Power and SWR measurement thread. TX is cut off and kept off after SWR was above
+    // threshold until clear_tx_cutoff.
+    std::thread measure_thread;
+    std::atomic<bool> measure_running{false};
+    std::mutex measure_mutex;
+    std::condition_variable measure_cv;
+    double measure_interval = 0.1;
+    double swr_threshold = 0;
+    std::atomic<bool> tx_cutoff{false};
+    std::atomic<int> fan_state{0};
+
+    void measure_loop();
+    void stop_measurement();
+    void cut_off_tx(double swr);
+
+    void request_update();
+    void command_loop();
+    void publish_status(const std::string& command,
+                        int error,
+                        const rfe_boardState& state,
+                        int merged);
+
+    static std::string error_string(int error);
+    void print_error(int error);
+    void get_board_state();
+
+public:
+    rfe_impl(int comm_type,
+             std::string device,
+             std::string config_file,
+             char IDRX,
+             char IDTX,
+             char PortRX,
+             char PortTX,
+             char Mode,
+             char Notch,
+             char Atten);
+    ~rfe_impl();
+
+    int change_mode(int mode);
+
+    int set_fan(int enable);
+
+    int set_attenuation(int attenuation);
+
+    int set_notch(int enable);
+
+    int set_tdd(int enable, double guard_time = 0.0005);
+
+    int set_measurement(int enable,
+                        double interval = 0.1,
+                        int swr_source = 0,
+                        double swr_threshold = 0);
+
+    int clear_tx_cutoff();
+};
+} // namespace limesdr
+} // namespace gr
+
+#endif
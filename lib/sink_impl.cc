@@ -23,7 +23,10 @@
 #endif
 
 #include "sink_impl.h"
+#include "common/logger.h"
 #include <gnuradio/io_signature.h>
+#include <boost/bind.hpp>
+#include <cmath>
 
 namespace gr {
 namespace limesdr {
@@ -44,21 +47,41 @@ sink_impl::sink_impl(std::string serial,
           args_to_io_signature(
               channel_mode), // Based on channel_mode SISO/MIMO use appropriate input signature
           gr::io_signature::make(0, 0, 0)) {
-    std::cout << "---------------------------------------------------------------" << std::endl;
-    std::cout << "LimeSuite Sink (TX) info" << std::endl;
-    std::cout << std::endl;
+    log_stream() << "---------------------------------------------------------------" << std::endl;
+    log_stream() << "LimeSuite Sink (TX) info" << std::endl;
+    log_stream() << std::endl;
 
     LENGTH_TAG = length_tag_name.empty() ? pmt::PMT_NIL : pmt::string_to_symbol(length_tag_name);
+
+    // Waveform swap for cyclic mode
+    message_port_register_in(pmt::mp("cyclic"));
+    set_msg_handler(pmt::mp("cyclic"), boost::bind(&sink_impl::cyclic_message, this, _1));
+    // Configuration changes applied as one transaction
+    message_port_register_in(pmt::mp("command"));
+    set_msg_handler(pmt::mp("command"), boost::bind(&sink_impl::command_message, this, _1));
+    // Device health telemetry
+    message_port_register_out(pmt::mp("telemetry"));
     // 1. Store private variables upon implementation to protect from changing them later
     stored.serial = serial;
     stored.channel_mode = channel_mode;
 
     if (stored.channel_mode < 0 && stored.channel_mode > 2) {
-        std::cout << "ERROR: sink_impl::sink_impl(): Channel must be A(1), B(2) or (A+B) MIMO(3)"
-                  << std::endl;
+        log_stream() << "ERROR: sink_impl::sink_impl(): Channel must be A(1), B(2) or (A+B) MIMO(3)"
+                     << std::endl;
         exit(0);
     }
 
+    // Input ports in order of device channels
+    for (int channel = 0; channel < 2; channel++) {
+        if (stored.channel_mode == 2 || stored.channel_mode == channel) {
+            channel_stream s;
+            s.channel = channel;
+            streams.push_back(s);
+        }
+    }
+    replay_file.resize(streams.size());
+    cyclic_capture.resize(streams.size());
+
     // 2. Open device if not opened
     stored.device_number = device_handler::getInstance().open_device(stored.serial);
     // 3. Check where to load settings from (file or block)
@@ -81,22 +104,25 @@ sink_impl::sink_impl(std::string serial,
 }
 
 sink_impl::~sink_impl() {
-    // Stop and destroy stream for channel 0 (if channel_mode is SISO)
-    if (stored.channel_mode < 2) {
-        this->release_stream(stored.device_number, &streamId[stored.channel_mode]);
-    }
-    // Stop and destroy stream for channels 0 & 1 (if channel_mode is MIMO)
-    else if (stored.channel_mode == 2) {
-        this->release_stream(stored.device_number, &streamId[LMS_CH_0]);
-        this->release_stream(stored.device_number, &streamId[LMS_CH_1]);
-    }
+    this->set_telemetry(0);
+    this->stop_replay();
+    this->stop_cyclic();
+    for (channel_stream& s : streams)
+        this->release_stream(stored.device_number, &s.stream);
     device_handler::getInstance().close_device(stored.device_number, sink_block);
 }
 
 bool sink_impl::start(void) {
     std::unique_lock<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
+    // Rate requested while last run was stopping
+    if (rate_change.exchange(false)) {
+        double rate = rate_pending;
+        device_handler::getInstance().set_samp_rate(stored.device_number, rate);
+        stored.samp_rate = rate;
+    }
     // Init timestamp
     tx_meta.timestamp = 0;
+    clock.reset(stored.samp_rate);
 
     if (stream_analyzer) {
         t1 = std::chrono::high_resolution_clock::now();
@@ -104,34 +130,48 @@ bool sink_impl::start(void) {
     }
     // Enable PA path
     this->toggle_pa_path(stored.device_number, true);
-    // Initialize and start stream for channel 0 (if channel_mode is SISO)
-    if (stored.channel_mode < 2) // If SISO configure prefered channel
-    {
-        this->init_stream(stored.device_number, stored.channel_mode);
-        LMS_StartStream(&streamId[stored.channel_mode]);
+    // Set up all channel streams before starting any of them
+    device_telemetry& telemetry = device_handler::getInstance().get_telemetry(stored.device_number);
+    for (channel_stream& s : streams) {
+        this->init_stream(stored.device_number, s);
+        s.counters = telemetry.add_stream(LMS_CH_TX, s.channel, s.counters_key);
     }
-    // Initialize and start stream for channels 0 & 1 (if channel_mode is MIMO)
-    else if (stored.channel_mode == 2) {
-        this->init_stream(stored.device_number, LMS_CH_0);
-        this->init_stream(stored.device_number, LMS_CH_1);
+    telemetry_time = std::chrono::steady_clock::now();
+    for (channel_stream& s : streams)
+        LMS_StartStream(&s.stream);
+    reconnect.generation = device_handler::getInstance().get_generation(stored.device_number);
+    reconnect.lost = false;
+    reconnect.last_data = telemetry_time;
 
-        LMS_StartStream(&streamId[LMS_CH_0]);
-        LMS_StartStream(&streamId[LMS_CH_1]);
+    // Start latching device time to host time source if source has not done it already
+    time_sync& sync = device_handler::getInstance().get_time_sync(stored.device_number);
+    if (!sync.is_running() && sync.get_source() != TIME_SOURCE_NONE) {
+        sync.start(device_handler::getInstance().get_device(stored.device_number),
+                   stored.samp_rate);
+        time_sync_owner = true;
     }
     std::unique_lock<std::recursive_mutex> unlock(device_handler::getInstance().block_mutex);
+
+    if (replay_enabled())
+        this->start_replay();
+    else if (cyclic_enabled)
+        this->start_cyclic();
     return true;
 }
 
 bool sink_impl::stop(void) {
+    this->stop_replay();
+    this->stop_cyclic();
     std::unique_lock<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
-    // Stop stream for channel 0 (if channel_mode is SISO)
-    if (stored.channel_mode < 2) {
-        this->release_stream(stored.device_number, &streamId[stored.channel_mode]);
+    if (time_sync_owner) {
+        device_handler::getInstance().get_time_sync(stored.device_number).stop();
+        time_sync_owner = false;
     }
-    // Stop streams for channels 0 & 1 (if channel_mode is MIMO)
-    else if (stored.channel_mode == 2) {
-        this->release_stream(stored.device_number, &streamId[LMS_CH_0]);
-        this->release_stream(stored.device_number, &streamId[LMS_CH_1]);
+    device_telemetry& telemetry = device_handler::getInstance().get_telemetry(stored.device_number);
+    for (channel_stream& s : streams) {
+        this->release_stream(stored.device_number, &s.stream);
+        telemetry.remove_stream(s.counters_key);
+        s.counters.reset();
     }
     // Disable PA path
     this->toggle_pa_path(stored.device_number, false);
@@ -143,6 +183,33 @@ int sink_impl::general_work(int noutput_items,
                             gr_vector_int& ninput_items,
                             gr_vector_const_void_star& input_items,
                             gr_vector_void_star& output_items) {
+    if (rate_change) {
+        rate_change = false;
+        this->change_rate(rate_pending);
+    }
+    this->poll_stream_status();
+
+    // Replay thread feeds the device, leave input untouched so upstream blocks idle
+    if (replay_enabled())
+        return 0;
+
+    // Cyclic thread feeds the device, input is only used to capture the waveform
+    if (cyclic_enabled) {
+        size_t capture_length = cyclic_capture_length;
+        if (cyclic_capture[0].size() < capture_length) {
+            size_t count =
+                std::min<size_t>(noutput_items, capture_length - cyclic_capture[0].size());
+            for (size_t i = 0; i < streams.size(); i++) {
+                const gr_complex* in = static_cast<const gr_complex*>(input_items[i]);
+                cyclic_capture[i].insert(cyclic_capture[i].end(), in, in + count);
+                consume(i, count);
+            }
+            if (cyclic_capture[0].size() == capture_length)
+                this->queue_cyclic_waveform(cyclic_capture[0], cyclic_capture.back());
+        }
+        return 0;
+    }
+
     // Init number of items to be sent and timestamps
     nitems_send = noutput_items;
     uint64_t current_sample = nitems_read(0);
@@ -161,38 +228,39 @@ int sink_impl::general_work(int noutput_items,
         }
     }
 
-    // Send stream for channel 0 (if channel_mode is SISO)
-    if (stored.channel_mode < 2) {
-        // Print stream stats to debug
-        if (stream_analyzer == true) {
-            this->print_stream_stats(stored.channel_mode);
-        }
-        ret[0] = LMS_SendStream(
-            &streamId[stored.channel_mode], input_items[0], nitems_send, &tx_meta, 100);
-        if (ret[0] < 0) {
-            return 0;
-        }
-        burst_length -= ret[0];
-        tx_meta.timestamp += ret[0];
-        consume(0, ret[0]);
-    }
-    // Send stream for channels 0 & 1 (if channel_mode is MIMO)
-    else if (stored.channel_mode == 2) {
-        // Print stream stats to debug
-        if (stream_analyzer == true) {
-            this->print_stream_stats(LMS_CH_0);
-        }
-        ret[0] = LMS_SendStream(&streamId[LMS_CH_0], input_items[0], nitems_send, &tx_meta, 100);
-        ret[1] = LMS_SendStream(&streamId[LMS_CH_1], input_items[1], nitems_send, &tx_meta, 100);
-        // Send data
-        if (ret[0] < 0 || ret[1] < 0) {
+    // LimeRFE goes to TX ahead of the burst and back to RX after it
+    if (burst_start) {
+        burst_start = false;
+        this->schedule_rfe(tx_meta.timestamp, burst_length);
+    }
+
+    // Print stream stats to debug
+    if (stream_analyzer == true) {
+        this->print_stream_stats(streams[0]);
+    }
+    // All channels share burst metadata, timing follows the first one
+    for (size_t i = 0; i < streams.size(); i++) {
+        channel_stream& s = streams[i];
+        s.sent = LMS_SendStream(&s.stream, input_items[i], nitems_send, &tx_meta, 100);
+    }
+    for (const channel_stream& s : streams) {
+        if (s.sent < 0) {
+            if (reconnect.enabled)
+                this->check_connection();
             return 0;
         }
-        burst_length -= ret[0];
-        tx_meta.timestamp += ret[0];
-        consume(0, ret[0]);
-        consume(1, ret[1]);
     }
+    // Send to an unplugged device times out with full FIFO
+    if (reconnect.enabled) {
+        if (streams[0].sent > 0)
+            this->data_sent();
+        else
+            this->check_connection();
+    }
+    burst_length -= streams[0].sent;
+    tx_meta.timestamp += streams[0].sent;
+    for (size_t i = 0; i < streams.size(); i++)
+        consume(i, streams[i].sent);
     return 0;
 }
 void sink_impl::work_tags(int noutput_items) {
@@ -209,10 +277,12 @@ void sink_impl::work_tags(int noutput_items) {
                 // Convert time to sample timestamp
                 uint64_t secs = pmt::to_uint64(pmt::tuple_ref(cTag.value, 0));
                 double fracs = pmt::to_double(pmt::tuple_ref(cTag.value, 1));
-                uint64_t u_rate = (uint64_t)stored.samp_rate;
-                double f_rate = stored.samp_rate - u_rate;
-                uint64_t timestamp =
-                    u_rate * secs + llround(secs * f_rate + fracs * stored.samp_rate);
+                uint64_t timestamp;
+                // Absolute UTC when device time is locked to host time source,
+                // otherwise time since start
+                if (!device_handler::getInstance().get_time_sync(stored.device_number).from_utc(
+                        secs, fracs, timestamp))
+                    timestamp = clock.from_time(secs, fracs);
 
                 if (cTag.offset == current_sample) {
                     tx_meta.waitForTimestamp = true;
@@ -226,9 +296,16 @@ void sink_impl::work_tags(int noutput_items) {
             else if (!pmt::is_null(LENGTH_TAG) && pmt::eq(cTag.key, LENGTH_TAG)) {
                 if (cTag.offset == current_sample) {
                     // Found length tag in the middle of the burst
-                    if (burst_length > 0 && ret[0] > 0)
-                        std::cout << "Warning: Length tag has been preemted" << std::endl;
+                    static log_limiter preempted;
+                    uint64_t skipped;
+                    if (burst_length > 0 && streams[0].sent > 0 && preempted.allow(skipped)) {
+                        log_stream() << "Warning: Length tag has been preemted";
+                        if (skipped)
+                            log_stream() << " (" << skipped << " more suppressed)";
+                        log_stream() << std::endl;
+                    }
                     burst_length = pmt::to_long(cTag.value);
+                    burst_start = burst_length > 0;
                 } else {
                     nitems_send = int(cTag.offset - current_sample);
                     break;
@@ -238,42 +315,92 @@ void sink_impl::work_tags(int noutput_items) {
     }
 }
 // Print stream status
-void sink_impl::print_stream_stats(int channel) {
+void sink_impl::print_stream_stats(channel_stream& s) {
     t2 = std::chrono::high_resolution_clock::now();
     auto timePeriod = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
     if (timePeriod >= 1000) {
         lms_stream_status_t status;
-        LMS_GetStreamStatus(&streamId[channel], &status);
-        std::cout << std::endl;
-        std::cout << "TX";
-        std::cout << "|rate: " << status.linkRate / 1e6 << " MB/s ";
-        std::cout << "|dropped packets: " << status.droppedPackets << " ";
-        std::cout << "|FIFO: " << 100 * status.fifoFilledCount / status.fifoSize << "%"
-                  << std::endl;
+        LMS_GetStreamStatus(&s.stream, &status);
+        if (s.counters)
+            s.counters->update(status);
+        log_stream() << std::endl;
+        log_stream() << "TX";
+        log_stream() << "|rate: " << status.linkRate / 1e6 << " MB/s ";
+        log_stream() << "|dropped packets: " << status.droppedPackets << " ";
+        log_stream() << "|FIFO: " << 100 * status.fifoFilledCount / status.fifoSize << "%"
+                     << std::endl;
         t1 = t2;
     }
 }
+// Stream status is reset on every read, so it is read here once per telemetry interval and
+// accumulated into the counters. Device time synchronization gets the counter of the first
+// stream at least twice per latch period.
+void sink_impl::poll_stream_status() {
+    time_sync& sync = device_handler::getInstance().get_time_sync(stored.device_number);
+    bool sync_running = sync.is_running();
+    if (telemetry_key < 0 && !sync_running)
+        return;
+    double interval = (telemetry_key >= 0) ? telemetry_interval : 0.5;
+    if (sync_running)
+        interval = std::min(interval, 0.5);
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - telemetry_time).count() < interval)
+        return;
+    telemetry_time = now;
+    // Rate change from caller thread (replay, cyclic) sets streams up again under the lock
+    std::lock_guard<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
+    for (size_t i = 0; i < streams.size(); i++) {
+        channel_stream& s = streams[i];
+        if (s.stream.handle == 0)
+            continue;
+        lms_stream_status_t status;
+        auto t_before = std::chrono::system_clock::now();
+        if (LMS_GetStreamStatus(&s.stream, &status) != LMS_SUCCESS)
+            continue;
+        auto t_after = std::chrono::system_clock::now();
+        if (s.counters)
+            s.counters->update(status);
+        if (i == 0 && sync_running)
+            sync.post_timestamp(status.timestamp, t_before + (t_after - t_before) / 2);
+    }
+}
+void sink_impl::schedule_rfe(uint64_t start, long length) {
+    std::shared_ptr<rfe_tdd> tdd = device_handler::getInstance().get_rfe_tdd(stored.device_number);
+    if (!tdd || !tdd->is_running())
+        return;
+    lms_stream_status_t status;
+    if (LMS_GetStreamStatus(&streams[0].stream, &status) != LMS_SUCCESS)
+        return;
+    if (streams[0].counters)
+        streams[0].counters->update(status);
+    // Burst behind device time is sent as soon as the samples queued before it are
+    if ((int64_t)(start - status.timestamp) < 0)
+        start = status.timestamp + status.fifoFilledCount;
+    tdd->schedule_burst(start, start + length, status.timestamp, stored.samp_rate);
+}
 // Setup stream
-void sink_impl::init_stream(int device_number, int channel) {
-    streamId[channel].channel = channel;
-    streamId[channel].fifoSize =
-        (stored.FIFO_size == 0) ? (int)stored.samp_rate / 10 : stored.FIFO_size;
-    streamId[channel].throughputVsLatency = 0.5;
-    streamId[channel].isTx = LMS_CH_TX;
-    streamId[channel].dataFmt = lms_stream_t::LMS_FMT_F32;
-
-    if (LMS_SetupStream(device_handler::getInstance().get_device(device_number),
-                        &streamId[channel]) != LMS_SUCCESS)
+void sink_impl::init_stream(int device_number, channel_stream& s) {
+    s.stream.channel = s.channel;
+    s.stream.fifoSize = (stored.FIFO_size == 0) ? (int)stored.samp_rate / 10 : stored.FIFO_size;
+    s.stream.throughputVsLatency = 0.5;
+    s.stream.isTx = LMS_CH_TX;
+    // Replay files are sent as is in native I16 format
+    s.stream.dataFmt = replay_enabled() ? lms_stream_t::LMS_FMT_I16 : lms_stream_t::LMS_FMT_F32;
+
+    reconnect.stream_device = device_handler::getInstance().get_device(device_number);
+    if (LMS_SetupStream(reconnect.stream_device, &s.stream) != LMS_SUCCESS)
         device_handler::getInstance().error(device_number);
 
-    std::cout << "INFO: sink_impl::init_stream(): sink channel " << channel << " (device nr. "
-              << device_number << ") stream setup done." << std::endl;
+    log_stream() << "INFO: sink_impl::init_stream(): sink channel " << s.channel << " (device nr. "
+                 << device_number << ") stream setup done." << std::endl;
 }
 
 void sink_impl::release_stream(int device_number, lms_stream_t* stream) {
     if (stream->handle != 0) {
+        // Handle of an unplugged device is replaced on reconnect, stream belongs to the old one
         LMS_StopStream(stream);
-        LMS_DestroyStream(device_handler::getInstance().get_device(device_number), stream);
+        LMS_DestroyStream(reconnect.stream_device, stream);
+        stream->handle = 0;
     }
 }
 
@@ -285,15 +412,26 @@ inline gr::io_signature::sptr sink_impl::args_to_io_signature(int channel_number
     } else if (channel_number == 2) {
         return gr::io_signature::make(2, 2, sizeof(gr_complex));
     } else {
-        std::cout << "ERROR: sink_impl::args_to_io_signature(): channel_number must be 0,1 or 2."
-                  << std::endl;
+        log_stream() << "ERROR: sink_impl::args_to_io_signature(): channel_number must be 0,1 or 2."
+                     << std::endl;
         exit(0);
     }
 }
 
 double sink_impl::set_center_freq(double freq, size_t chan) {
-    return device_handler::getInstance().set_rf_freq(
-        stored.device_number, LMS_CH_TX, LMS_CH_0, freq);
+    if (chan > 1) {
+        log_stream() << "ERROR: sink_impl::set_center_freq(): channel must be 0 or 1." << std::endl;
+        return 0;
+    }
+    // SISO: channel is tuned by LO alone
+    if (streams.size() == 1) {
+        if (freq == 0)
+            return 0;
+        return device_handler::getInstance().set_rf_freq(
+            stored.device_number, LMS_CH_TX, streams[0].channel, freq);
+    }
+    // MIMO: shared LO plus per-channel NCO offset
+    return device_handler::getInstance().tune_channel(stored.device_number, LMS_CH_TX, chan, freq);
 }
 
 void sink_impl::set_antenna(int antenna, int channel) {
@@ -303,24 +441,28 @@ void sink_impl::set_antenna(int antenna, int channel) {
 
 void sink_impl::toggle_pa_path(int device_number, bool enable) {
     LMS_RegisterLogHandler([](int, const char*) {});
-    if (stored.channel_mode < 2) {
+    for (const channel_stream& s : streams) {
         LMS_SetAntenna(device_handler::getInstance().get_device(device_number),
                        LMS_CH_TX,
-                       stored.channel_mode,
-                       enable ? pa_path[stored.channel_mode] : 0);
-    } else {
-        LMS_SetAntenna(device_handler::getInstance().get_device(device_number),
-                       LMS_CH_TX,
-                       LMS_CH_0,
-                       enable ? pa_path[0] : 0);
-        LMS_SetAntenna(device_handler::getInstance().get_device(device_number),
-                       LMS_CH_TX,
-                       LMS_CH_1,
-                       enable ? pa_path[1] : 0);
+                       s.channel,
+                       enable ? pa_path[s.channel] : 0);
+        // Antenna was written around configuration cache
+        device_handler::getInstance().invalidate_antenna(device_number, LMS_CH_TX, s.channel);
     }
     LMS_RegisterLogHandler(nullptr);
 }
 
+void sink_impl::warm_up_tuning(const std::vector<double>& freqs) {
+    // In MIMO both channels share LO, tune through first channel
+    device_handler::getInstance().warm_up_tuning(
+        stored.device_number, LMS_CH_TX, streams[0].channel, freqs);
+}
+
+void sink_impl::benchmark_tuning(const std::vector<double>& freqs, int rounds) {
+    device_handler::getInstance().benchmark_tuning(
+        stored.device_number, LMS_CH_TX, streams[0].channel, freqs, rounds);
+}
+
 void sink_impl::set_nco(float nco_freq, int channel) {
     device_handler::getInstance().set_nco(stored.device_number, LMS_CH_TX, channel, nco_freq);
 }
@@ -335,6 +477,22 @@ void sink_impl::set_digital_filter(double digital_bandw, int channel) {
         stored.device_number, LMS_CH_TX, channel, digital_bandw);
 }
 
+void sink_impl::set_gfir_taps(int filter, const std::vector<double>& taps, int channel) {
+    device_handler::getInstance().set_gfir_taps(
+        stored.device_number, LMS_CH_TX, channel, filter, taps);
+}
+
+void sink_impl::set_gfir_lowpass(
+    int filter, double passband, double stopband, double ripple, double attenuation, int channel) {
+    fir_spec spec;
+    spec.passband = passband;
+    spec.stopband = stopband;
+    spec.ripple = ripple;
+    spec.attenuation = attenuation;
+    device_handler::getInstance().set_gfir_lowpass(
+        stored.device_number, LMS_CH_TX, channel, filter, spec);
+}
+
 unsigned sink_impl::set_gain(unsigned gain_dB, int channel) {
     return device_handler::getInstance().set_gain(
         stored.device_number, LMS_CH_TX, channel, gain_dB);
@@ -347,20 +505,561 @@ void sink_impl::calibrate(double bandw, int channel) {
 }
 
 double sink_impl::set_sample_rate(double rate) {
+    if (streams[0].stream.handle != 0) {
+        // Replay and cyclic threads are restarted around the change, work does not send then
+        if (replay_enabled() || cyclic_enabled) {
+            this->change_rate(rate);
+            return stored.samp_rate;
+        }
+        // Otherwise work thread restarts stream so that it never sends to a destroyed stream
+        rate_pending = rate;
+        rate_change = true;
+        return rate;
+    }
     device_handler::getInstance().set_samp_rate(stored.device_number, rate);
     stored.samp_rate = rate;
     return rate;
 }
 
+void sink_impl::change_rate(double rate) {
+    auto t_start = std::chrono::steady_clock::now();
+    bool replay_active = replay_running;
+    bool cyclic_active = cyclic_running;
+    this->stop_replay();
+    this->stop_cyclic();
+
+    std::unique_lock<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
+    time_sync& sync = device_handler::getInstance().get_time_sync(stored.device_number);
+    if (time_sync_owner)
+        sync.stop();
+
+    // Stream time reached so far, new counter continues from it
+    lms_stream_status_t status;
+    LMS_GetStreamStatus(&streams[0].stream, &status);
+    if (streams[0].counters)
+        streams[0].counters->update(status);
+    uint64_t old_timestamp = status.timestamp;
+    auto t_old = std::chrono::steady_clock::now();
+
+    // FIFO is sized from sample rate, so streams are set up again
+    for (channel_stream& s : streams)
+        this->release_stream(stored.device_number, &s.stream);
+    device_handler::getInstance().set_samp_rate(stored.device_number, rate);
+    stored.samp_rate = rate;
+    for (channel_stream& s : streams)
+        this->init_stream(stored.device_number, s);
+    for (channel_stream& s : streams)
+        LMS_StartStream(&s.stream);
+
+    LMS_GetStreamStatus(&streams[0].stream, &status);
+    double gap = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_old).count();
+    clock.rebase(old_timestamp, status.timestamp, rate, gap);
+    // Bursts without tx_time continue from current device time
+    tx_meta.timestamp = status.timestamp;
+
+    if (time_sync_owner)
+        sync.start(device_handler::getInstance().get_device(stored.device_number),
+                   stored.samp_rate);
+    lock.unlock();
+
+    if (replay_active)
+        this->start_replay();
+    else if (cyclic_active)
+        this->start_cyclic();
+
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    log_stream() << "INFO: sink_impl::change_rate(): stream restarted at " << rate / 1e6
+                 << " MS/s in " << elapsed * 1e3 << " ms." << std::endl;
+}
+
 void sink_impl::set_buffer_size(uint32_t size) { stored.FIFO_size = size; }
 
 void sink_impl::set_oversampling(int oversample) {
     device_handler::getInstance().set_oversampling(stored.device_number, oversample);
 }
 
+void sink_impl::set_rate_plan(double bandwidth, double attenuation) {
+    device_handler::getInstance().set_rate_plan(
+        stored.device_number, LMS_CH_TX, bandwidth, attenuation);
+    this->set_sample_rate(stored.samp_rate);
+}
+
 void sink_impl::set_tcxo_dac(uint16_t dacVal) {
     device_handler::getInstance().set_tcxo_dac(stored.device_number, dacVal);
 }
 
+void sink_impl::set_time_source(int source, double param) {
+    device_handler::getInstance().set_time_source(stored.device_number, source, param);
+}
+
+void sink_impl::set_buffer_policy(bool hugepages, int numa_node) {
+    buffers.hugepages = hugepages;
+    buffers.numa_node = numa_node;
+}
+
+void sink_impl::set_replay(const std::string& filename_ch0,
+                           const std::string& filename_ch1,
+                           bool loop,
+                           bool prefetch) {
+    if (streams.size() > 1 && !filename_ch0.empty() && filename_ch1.empty()) {
+        log_stream() << "ERROR: sink_impl::set_replay(): MIMO mode requires file for each channel."
+                     << std::endl;
+        return;
+    }
+    if (replay_running) {
+        log_stream() << "WARNING: sink_impl::set_replay(): replay settings apply on next start."
+                     << std::endl;
+    }
+    replay.filename[0] = filename_ch0;
+    replay.filename[1] = filename_ch1;
+    replay.loop = loop;
+    replay.prefetch = prefetch;
+}
+
+void sink_impl::start_replay() {
+    for (size_t i = 0; i < streams.size(); i++) {
+        replay_file[i].reset(new mapped_file(replay.filename[i], replay.prefetch));
+        if (!replay_file[i]->is_open()) {
+            for (std::unique_ptr<mapped_file>& f : replay_file)
+                f.reset();
+            return;
+        }
+    }
+    replay_underruns = 0;
+    replay_running = true;
+    replay_thread = std::thread(&sink_impl::replay_loop, this);
+}
+
+void sink_impl::stop_replay() {
+    replay_running = false;
+    if (replay_thread.joinable())
+        replay_thread.join();
+    for (std::unique_ptr<mapped_file>& f : replay_file)
+        f.reset();
+}
+
+bool sink_impl::send_all(lms_stream_t* stream,
+                         const void* samples,
+                         size_t count,
+                         size_t sample_size) {
+    const char* data = static_cast<const char*>(samples);
+    lms_stream_meta_t meta;
+    meta.timestamp = 0;
+    meta.waitForTimestamp = false;
+    meta.flushPartialPacket = false;
+    // Send may return early when FIFO is full, keep channels aligned by sending everything
+    while (count > 0 && (replay_running || cyclic_running)) {
+        int ret = LMS_SendStream(stream, data, count, &meta, 1000);
+        if (ret < 0)
+            return false;
+        data += ret * sample_size;
+        count -= ret;
+    }
+    return true;
+}
+
+size_t sink_impl::send_chunk_size() {
+    // In MIMO channels are filled in turns, a chunk must fit into FIFO so that
+    // one channel never waits for space while the other one is empty
+    return std::min<size_t>(65536, std::max<size_t>(streams[0].stream.fifoSize / 4, 1024));
+}
+
+void sink_impl::replay_loop() {
+    // Samples per LMS_SendStream call
+    const size_t chunk = this->send_chunk_size();
+    size_t channels = streams.size();
+
+    // Interleaved I16 I/Q, channels are replayed for the length of the shortest file
+    std::vector<const int16_t*> data(channels);
+    size_t samples = SIZE_MAX;
+    for (size_t i = 0; i < channels; i++) {
+        data[i] = static_cast<const int16_t*>(replay_file[i]->data());
+        samples = std::min(samples, replay_file[i]->size() / (2 * sizeof(int16_t)));
+    }
+
+    log_stream() << "INFO: sink_impl::replay_loop(): replaying " << samples << " samples"
+                 << (replay.loop ? " in loop" : "") << "." << std::endl;
+
+    size_t position = 0;
+    uint64_t loops = 0;
+    auto t_stats = std::chrono::steady_clock::now();
+    while (replay_running) {
+        size_t count = std::min(chunk, samples - position);
+        for (size_t i = 0; i < channels; i++) {
+            if (!send_all(
+                    &streams[i].stream, data[i] + 2 * position, count, 2 * sizeof(int16_t))) {
+                log_stream() << "ERROR: sink_impl::replay_loop(): failed to send samples."
+                             << std::endl;
+                replay_running = false;
+                break;
+            }
+        }
+        position += count;
+        if (position == samples) {
+            if (!replay.loop)
+                break;
+            position = 0;
+            loops++;
+        }
+
+        // Collect underruns once per second, counter is reset by every status read
+        auto t_now = std::chrono::steady_clock::now();
+        if (t_now - t_stats >= std::chrono::seconds(1)) {
+            lms_stream_status_t status;
+            LMS_GetStreamStatus(&streams[0].stream, &status);
+            if (streams[0].counters)
+                streams[0].counters->update(status);
+            replay_underruns += status.underrun;
+            if (stream_analyzer)
+                log_stream() << "TX replay|rate: " << status.linkRate / 1e6
+                             << " MB/s |underruns: " << replay_underruns
+                             << " |FIFO: " << 100 * status.fifoFilledCount / status.fifoSize << "%"
+                             << std::endl;
+            t_stats = t_now;
+        }
+    }
+    log_stream() << "INFO: sink_impl::replay_loop(): replay finished after " << loops
+                 << " loops, " << replay_underruns << " underruns." << std::endl;
+}
+
+void sink_impl::begin_config() {
+    if (config_depth++ == 0)
+        device_handler::getInstance().begin_batch(stored.device_number);
+}
+
+void sink_impl::commit() {
+    if (config_depth == 0 || --config_depth > 0)
+        return;
+    device_handler::getInstance().end_batch(stored.device_number);
+}
+
+void sink_impl::command_message(pmt::pmt_t msg) {
+    if (!pmt::is_dict(msg)) {
+        log_stream() << "WARNING: sink_impl::command_message(): command must be a dict."
+                     << std::endl;
+        return;
+    }
+    // Channel settings apply to "chan" if present, otherwise to all block channels
+    std::vector<int> channels;
+    pmt::pmt_t chan = pmt::dict_ref(msg, pmt::mp("chan"), pmt::PMT_NIL);
+    if (pmt::is_number(chan)) {
+        // Only channels streamed by this block, settings are indexed by channel
+        double requested = pmt::to_double(chan);
+        for (const channel_stream& s : streams) {
+            if (s.channel == requested)
+                channels.push_back(s.channel);
+        }
+        if (channels.empty()) {
+            log_stream() << "WARNING: sink_impl::command_message(): chan " << requested
+                         << " is not a channel of this block, command ignored." << std::endl;
+            return;
+        }
+    } else {
+        for (const channel_stream& s : streams)
+            channels.push_back(s.channel);
+    }
+
+    auto value = [&msg](const char* key) {
+        return pmt::dict_ref(msg, pmt::mp(key), pmt::PMT_NIL);
+    };
+
+    this->begin_config();
+    for (int channel : channels) {
+        if (pmt::is_number(value("freq")))
+            this->set_center_freq(pmt::to_double(value("freq")), channel);
+        if (pmt::is_number(value("antenna")))
+            this->set_antenna((int)pmt::to_double(value("antenna")), channel);
+        if (pmt::is_number(value("bandwidth")))
+            this->set_bandwidth(pmt::to_double(value("bandwidth")), channel);
+        if (pmt::is_number(value("digital_filter")))
+            this->set_digital_filter(pmt::to_double(value("digital_filter")), channel);
+        if (pmt::is_number(value("nco")))
+            this->set_nco(pmt::to_double(value("nco")), channel);
+        if (pmt::is_number(value("gain")))
+            this->set_gain((unsigned)std::lround(pmt::to_double(value("gain"))), channel);
+    }
+    this->commit();
+}
+
+void sink_impl::set_cyclic_waveform(const std::vector<gr_complex>& waveform_ch0,
+                                    const std::vector<gr_complex>& waveform_ch1) {
+    if (waveform_ch0.empty()) {
+        // Back to streaming from block input
+        cyclic_capture_length = 0;
+        this->stop_cyclic();
+        cyclic_enabled = false;
+        return;
+    }
+    // Rejected waveform leaves current mode unchanged
+    if (!this->queue_cyclic_waveform(waveform_ch0, waveform_ch1))
+        return;
+    cyclic_capture_length = 0;
+    cyclic_enabled = true;
+}
+
+void sink_impl::set_cyclic_file(const std::string& filename_ch0, const std::string& filename_ch1) {
+    std::vector<gr_complex> waveform[2];
+    std::string filename[2] = {filename_ch0, filename_ch1};
+    for (int i = 0; i < 2; i++) {
+        if (filename[i].empty())
+            continue;
+        mapped_file file(filename[i], false);
+        if (!file.is_open())
+            return;
+        const gr_complex* data = static_cast<const gr_complex*>(file.data());
+        waveform[i].assign(data, data + file.size() / sizeof(gr_complex));
+    }
+    this->set_cyclic_waveform(waveform[0], waveform[1]);
+}
+
+void sink_impl::set_cyclic_capture(int length) {
+    if (length <= 0) {
+        log_stream() << "ERROR: sink_impl::set_cyclic_capture(): length must be more than 0."
+                     << std::endl;
+        return;
+    }
+    cyclic_capture_length = length;
+    for (std::vector<gr_complex>& capture : cyclic_capture)
+        capture.clear();
+    cyclic_enabled = true;
+}
+
+bool sink_impl::queue_cyclic_waveform(const std::vector<gr_complex>& waveform_ch0,
+                                      const std::vector<gr_complex>& waveform_ch1) {
+    // Shortest period repeated so that each pass is long enough to keep LMS_SendStream
+    // overhead negligible; repetitions keep the period boundary intact
+    const size_t min_length = 16384;
+    std::shared_ptr<cyclic_waveform> waveform = std::make_shared<cyclic_waveform>();
+    waveform->samples.resize(streams.size(),
+                             buffer_vector<gr_complex>(buffer_allocator<gr_complex>(buffers)));
+    for (size_t i = 0; i < streams.size(); i++) {
+        // In MIMO single waveform is transmitted on both channels
+        const std::vector<gr_complex>& source =
+            (i > 0 && !waveform_ch1.empty()) ? waveform_ch1 : waveform_ch0;
+        if (i > 0 && source.size() != waveform_ch0.size()) {
+            log_stream() << "ERROR: sink_impl::queue_cyclic_waveform(): channel waveforms must "
+                            "have the same length."
+                         << std::endl;
+            return false;
+        }
+        size_t repeat = (min_length + source.size() - 1) / source.size();
+        waveform->samples[i].reserve(repeat * source.size());
+        for (size_t r = 0; r < repeat; r++)
+            waveform->samples[i].insert(waveform->samples[i].end(), source.begin(), source.end());
+    }
+
+    log_stream() << "INFO: sink_impl::queue_cyclic_waveform(): " << waveform_ch0.size()
+                 << " samples queued for cyclic transmission." << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(cyclic_mutex);
+        cyclic_pending = waveform;
+    }
+    cyclic_cv.notify_one();
+    return true;
+}
+
+void sink_impl::cyclic_message(pmt::pmt_t msg) {
+    // Accepts PDU or bare vector, dict with "ch0"/"ch1" vectors, or symbol with file path
+    if (pmt::is_pair(msg) && !pmt::is_dict(msg) && pmt::is_c32vector(pmt::cdr(msg)))
+        msg = pmt::cdr(msg);
+
+    if (pmt::is_c32vector(msg)) {
+        this->set_cyclic_waveform(pmt::c32vector_elements(msg), std::vector<gr_complex>());
+    } else if (pmt::is_dict(msg)) {
+        std::vector<gr_complex> waveform[2];
+        const char* keys[2] = {"ch0", "ch1"};
+        for (int i = 0; i < 2; i++) {
+            pmt::pmt_t value = pmt::dict_ref(msg, pmt::mp(keys[i]), pmt::PMT_NIL);
+            if (pmt::is_c32vector(value))
+                waveform[i] = pmt::c32vector_elements(value);
+        }
+        this->set_cyclic_waveform(waveform[0], waveform[1]);
+    } else if (pmt::is_symbol(msg)) {
+        this->set_cyclic_file(pmt::symbol_to_string(msg));
+    } else {
+        log_stream() << "WARNING: sink_impl::cyclic_message(): unsupported message." << std::endl;
+        return;
+    }
+    // Start transmitting if waveform arrived while streaming from input
+    if (cyclic_enabled && !cyclic_running && streams[0].stream.handle != 0)
+        this->start_cyclic();
+}
+
+void sink_impl::start_cyclic() {
+    if (cyclic_running)
+        return;
+    cyclic_running = true;
+    cyclic_thread = std::thread(&sink_impl::cyclic_loop, this);
+}
+
+void sink_impl::stop_cyclic() {
+    {
+        std::lock_guard<std::mutex> lock(cyclic_mutex);
+        cyclic_running = false;
+    }
+    cyclic_cv.notify_one();
+    if (cyclic_thread.joinable())
+        cyclic_thread.join();
+}
+
+void sink_impl::cyclic_loop() {
+    const size_t chunk = this->send_chunk_size();
+    std::shared_ptr<cyclic_waveform> current;
+    bool moved = false;
+    while (cyclic_running) {
+        // Period boundary: swap to queued waveform, or wait for the first one
+        {
+            std::unique_lock<std::mutex> lock(cyclic_mutex);
+            if (!current)
+                cyclic_cv.wait(lock, [this] { return cyclic_pending || !cyclic_running; });
+            if (cyclic_pending) {
+                current = cyclic_pending;
+                cyclic_pending.reset();
+                moved = false;
+            }
+        }
+        if (!current)
+            continue;
+        // Waveform was built by another thread, bring it to the node sending it
+        if (!moved && buffers.hugepages && buffers.numa_node < 0) {
+            for (buffer_vector<gr_complex>& samples : current->samples)
+                buffer_move_here(samples.data(), samples.size() * sizeof(gr_complex));
+            moved = true;
+        }
+
+        size_t length = current->samples[0].size();
+        for (size_t position = 0; position < length && cyclic_running; position += chunk) {
+            size_t count = std::min(chunk, length - position);
+            for (size_t i = 0; i < streams.size(); i++) {
+                if (!send_all(&streams[i].stream,
+                              current->samples[i].data() + position,
+                              count,
+                              sizeof(gr_complex))) {
+                    log_stream() << "ERROR: sink_impl::cyclic_loop(): failed to send samples."
+                                 << std::endl;
+                    cyclic_running = false;
+                    break;
+                }
+            }
+        }
+    }
+    // Keep waveform for next start unless a new one is already queued
+    {
+        std::lock_guard<std::mutex> lock(cyclic_mutex);
+        if (!cyclic_pending)
+            cyclic_pending = current;
+    }
+    if (current && (buffers.hugepages || buffers.numa_node >= 0)) {
+        for (size_t i = 0; i < current->samples.size(); i++) {
+            std::string name = "sink cyclic waveform " + std::to_string(i);
+            buffer_report(name.c_str(),
+                          current->samples[i].data(),
+                          current->samples[i].size() * sizeof(gr_complex));
+        }
+    }
+}
+
+void sink_impl::set_telemetry(double interval) {
+    if (interval < 0) {
+        log_stream() << "ERROR: sink_impl::set_telemetry(): interval must not be negative."
+                     << std::endl;
+        return;
+    }
+    device_telemetry& telemetry = device_handler::getInstance().get_telemetry(stored.device_number);
+    if (telemetry_key >= 0) {
+        telemetry.unsubscribe(telemetry_key);
+        telemetry_key = -1;
+    }
+    telemetry_interval = interval;
+    if (interval == 0)
+        return;
+    telemetry_key = telemetry.subscribe(
+        interval, [this](pmt::pmt_t msg) { message_port_pub(pmt::mp("telemetry"), msg); });
+    log_stream() << "INFO: sink_impl::set_telemetry(): publishing device telemetry every "
+                 << interval << " s." << std::endl;
+}
+
+void sink_impl::set_auto_reconnect(bool enable, double timeout) {
+    if (timeout <= 0) {
+        log_stream() << "ERROR: sink_impl::set_auto_reconnect(): timeout must be more than 0."
+                     << std::endl;
+        return;
+    }
+    reconnect.timeout = timeout;
+    reconnect.enabled = enable;
+    if (!enable)
+        return;
+    // Arrivals and removals are known before a stream stalls
+    device_handler::getInstance().start_discovery(timeout);
+    log_stream() << "INFO: sink_impl::set_auto_reconnect(): reconnecting to " << stored.serial
+                 << " after " << timeout << " s without sending." << std::endl;
+}
+
+void sink_impl::check_connection() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - reconnect.last_data < std::chrono::duration<double>(reconnect.timeout))
+        return;
+
+    if (!reconnect.lost) {
+        // Burst waiting for its timestamp keeps FIFO full on a device that still responds
+        if (!device_handler::getInstance().device_lost(stored.device_number,
+                                                       reconnect.generation)) {
+            reconnect.last_data = now;
+            return;
+        }
+        log_stream() << "WARNING: sink_impl::check_connection(): no samples sent to "
+                     << stored.serial << " for " << reconnect.timeout
+                     << " s, device lost. Reconnecting." << std::endl;
+        reconnect.lost = true;
+
+        std::unique_lock<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
+        if (time_sync_owner)
+            device_handler::getInstance().get_time_sync(stored.device_number).stop();
+        for (channel_stream& s : streams)
+            this->release_stream(stored.device_number, &s.stream);
+    }
+
+    // Waits up to timeout for the device without holding the device lock, work is called
+    // again if it does not appear
+    if (!device_handler::getInstance().reconnect_device(
+            stored.device_number, reconnect.generation, reconnect.timeout))
+        return;
+    std::unique_lock<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
+    this->toggle_pa_path(stored.device_number, true);
+    for (channel_stream& s : streams)
+        this->init_stream(stored.device_number, s);
+    for (channel_stream& s : streams)
+        LMS_StartStream(&s.stream);
+
+    // Device counter starts again, time continues over the outage
+    lms_stream_status_t status;
+    LMS_GetStreamStatus(&streams[0].stream, &status);
+    double gap =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - reconnect.last_data)
+            .count();
+    clock.rebase(tx_meta.timestamp, status.timestamp, stored.samp_rate, gap);
+    // Bursts without tx_time continue from current device time
+    tx_meta.timestamp = status.timestamp;
+
+    time_sync& sync = device_handler::getInstance().get_time_sync(stored.device_number);
+    if (time_sync_owner)
+        sync.start(device_handler::getInstance().get_device(stored.device_number),
+                   stored.samp_rate);
+}
+
+void sink_impl::data_sent() {
+    auto now = std::chrono::steady_clock::now();
+    if (reconnect.lost) {
+        reconnect.lost = false;
+        reconnect.count++;
+        double elapsed = std::chrono::duration<double>(now - reconnect.last_data).count();
+        log_stream() << "INFO: sink_impl::data_sent(): streaming to " << stored.serial
+                     << " resumed " << elapsed * 1e3 << " ms after last samples (reconnect "
+                     << reconnect.count << ")." << std::endl;
+    }
+    reconnect.last_data = now;
+}
+
 } // namespace limesdr
 } // namespace gr
@@ -21,8 +21,14 @@
 #ifndef INCLUDED_LIMESDR_SINK_IMPL_H
 #define INCLUDED_LIMESDR_SINK_IMPL_H
 
+#include "common/buffer_alloc.h"
 #include "common/device_handler.h"
+#include "common/mapped_file.h"
 #include <limesdr/sink.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <thread>
 
 
 static const pmt::pmt_t TIME_TAG = pmt::string_to_symbol("tx_time");
@@ -31,7 +37,16 @@ namespace gr {
 namespace limesdr {
 class sink_impl : public sink {
     private:
-    lms_stream_t streamId[2];
+    // Stream of one input port, port i carries device channel streams[i].channel
+    struct channel_stream {
+        int channel;
+        lms_stream_t stream = {};
+        int sent = 0;
+        // Totals for device telemetry
+        std::shared_ptr<stream_counters> counters;
+        int counters_key = -1;
+    };
+    std::vector<channel_stream> streams;
 
     bool stream_analyzer = false;
 
@@ -40,9 +55,12 @@ class sink_impl : public sink {
     pmt::pmt_t LENGTH_TAG;
     lms_stream_meta_t tx_meta;
     long burst_length = 0;
+    // Set by length tag at the start of a burst
+    bool burst_start = false;
     int nitems_send = 0;
-    int ret[2] = {0};
     int pa_path[2] = {0}; // TX PA path NONE
+    // Set when this block started device time synchronization
+    bool time_sync_owner = false;
 
     struct constant_data {
         std::string serial;
@@ -54,9 +72,94 @@ class sink_impl : public sink {
 
     std::chrono::high_resolution_clock::time_point t1, t2;
 
+    // Device health telemetry published on "telemetry" port, stream status is read by the
+    // work thread once per interval
+    int telemetry_key = -1;
+    double telemetry_interval = 0;
+    std::chrono::steady_clock::time_point telemetry_time;
+
+    void poll_stream_status();
+
+    // Queue LimeRFE switching for a burst when LimeRFE TDD is enabled on this device
+    void schedule_rfe(uint64_t start, long length);
+
+    // Replay of memory mapped I16 files from a dedicated thread, bypassing the scheduler
+    struct replay_settings {
+        std::string filename[2];
+        bool loop = true;
+        bool prefetch = false;
+    } replay;
+    std::vector<std::unique_ptr<mapped_file>> replay_file;
+    std::thread replay_thread;
+    std::atomic<bool> replay_running{false};
+    std::atomic<uint64_t> replay_underruns{0};
+
+    bool replay_enabled() const { return !replay.filename[0].empty(); }
+    void start_replay();
+    void stop_replay();
+    void replay_loop();
+
+    // Cyclic transmission of a waveform from a dedicated thread
+    struct cyclic_waveform {
+        std::vector<buffer_vector<gr_complex>> samples;
+    };
+    // Set from flowgraph thread, read by work
+    std::atomic<bool> cyclic_enabled{false};
+    // Waveform to be used from next period boundary
+    std::shared_ptr<cyclic_waveform> cyclic_pending;
+    std::mutex cyclic_mutex;
+    std::condition_variable cyclic_cv;
+    std::thread cyclic_thread;
+    std::atomic<bool> cyclic_running{false};
+    // Capture of first N input samples as waveform
+    std::atomic<size_t> cyclic_capture_length{0};
+    std::vector<std::vector<gr_complex>> cyclic_capture;
+
+    bool queue_cyclic_waveform(const std::vector<gr_complex>& waveform_ch0,
+                               const std::vector<gr_complex>& waveform_ch1);
+    void start_cyclic();
+    void stop_cyclic();
+    void cyclic_loop();
+    void cyclic_message(pmt::pmt_t msg);
+
+    // Sample rate change while streaming, applied by the thread that sends samples
+    std::atomic<bool> rate_change{false};
+    double rate_pending = 0;
+    stream_clock clock;
+
+    void change_rate(double rate);
+
+    // Reattach to the device serial after it was unplugged, handled by work thread. Replay
+    // and cyclic threads stop on send errors instead.
+    struct reconnect_state {
+        bool enabled = false;
+        double timeout = 1;
+        // Device generation streams are set up on and handle they are set up on
+        uint64_t generation = 0;
+        lms_device_t* stream_device = NULL;
+        // Streams released, waiting for device to reappear
+        bool lost = false;
+        // Host time of last sent buffer
+        std::chrono::steady_clock::time_point last_data;
+        uint64_t count = 0;
+    } reconnect;
+
+    void check_connection();
+    void data_sent();
+
+    // Placement of sample buffers
+    buffer_policy buffers;
+
+    // Nesting depth of begin_config/commit
+    int config_depth = 0;
+    void command_message(pmt::pmt_t msg);
+
+    bool send_all(lms_stream_t* stream, const void* samples, size_t count, size_t sample_size);
+    size_t send_chunk_size();
+
     void work_tags(int noutput_items);
 
-    void print_stream_stats(int channel);
+    void print_stream_stats(channel_stream& s);
 
     public:
     sink_impl(std::string serial,
@@ -76,10 +179,14 @@ class sink_impl : public sink {
 
     inline gr::io_signature::sptr args_to_io_signature(int channel_number);
 
-    void init_stream(int device_number, int channel);
+    void init_stream(int device_number, channel_stream& s);
     void release_stream(int device_number, lms_stream_t* stream);
 
     double set_center_freq(double freq, size_t chan = 0);
+
+    void warm_up_tuning(const std::vector<double>& freqs);
+
+    void benchmark_tuning(const std::vector<double>& freqs, int rounds = 10);
     
     void set_antenna(int antenna, int channel = 0);
     void toggle_pa_path(int device_number, bool enable);
@@ -90,17 +197,52 @@ class sink_impl : public sink {
 
     void set_digital_filter(double digital_bandw, int channel = 0);
 
+    void set_gfir_taps(int filter, const std::vector<double>& taps, int channel = 0);
+
+    void set_gfir_lowpass(int filter,
+                          double passband,
+                          double stopband,
+                          double ripple = 0.1,
+                          double attenuation = 60,
+                          int channel = 0);
+
     unsigned set_gain(unsigned gain_dB, int channel = 0);
 
     double set_sample_rate(double rate);
 
     void set_oversampling(int oversample);
 
+    void set_rate_plan(double bandwidth, double attenuation = 60);
+
     void set_buffer_size(uint32_t size);
 
     void calibrate(double bandw, int channel = 0);
     
     void set_tcxo_dac(uint16_t dacVal = 125);
+
+    void set_time_source(int source, double param = 0);
+
+    void set_buffer_policy(bool hugepages, int numa_node = -1);
+
+    void set_replay(const std::string& filename_ch0,
+                    const std::string& filename_ch1 = "",
+                    bool loop = true,
+                    bool prefetch = false);
+
+    void begin_config();
+
+    void commit();
+
+    void set_cyclic_waveform(const std::vector<gr_complex>& waveform_ch0,
+                             const std::vector<gr_complex>& waveform_ch1);
+
+    void set_cyclic_file(const std::string& filename_ch0, const std::string& filename_ch1 = "");
+
+    void set_cyclic_capture(int length);
+
+    void set_telemetry(double interval);
+
+    void set_auto_reconnect(bool enable, double timeout = 1);
 };
 } // namespace limesdr
 } // namespace gr
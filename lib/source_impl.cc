@@ -23,7 +23,11 @@
 #endif
 
 #include "source_impl.h"
+#include "common/logger.h"
+#include "common/sample_stats.h"
 #include <gnuradio/io_signature.h>
+#include <boost/bind.hpp>
+#include <cmath>
 
 namespace gr {
 namespace limesdr {
@@ -36,21 +40,38 @@ source_impl::source_impl(std::string serial, int channel_mode, const std::string
                 gr::io_signature::make(
                     0, 0, 0), // Based on channel_mode SISO/MIMO use appropriate output signature
                 args_to_io_signature(channel_mode)) {
-    std::cout << "---------------------------------------------------------------" << std::endl;
-    std::cout << "LimeSuite Source (RX) info" << std::endl;
-    std::cout << std::endl;
+    log_stream() << "---------------------------------------------------------------" << std::endl;
+    log_stream() << "LimeSuite Source (RX) info" << std::endl;
+    log_stream() << std::endl;
 
     // 1. Store private variables upon implementation to protect from changing them later
     stored.serial = serial;
     stored.channel_mode = channel_mode;
 
     if (stored.channel_mode < 0 && stored.channel_mode > 2) {
-        std::cout
-            << "ERROR: source_impl::source_impl(): Channel must be A(0), B(1) or (A+B) MIMO(2)"
-            << std::endl;
+        log_stream()
+               << "ERROR: source_impl::source_impl(): Channel must be A(0), B(1) or (A+B) MIMO(2)"
+               << std::endl;
         exit(0);
     }
 
+    // Output ports in order of device channels
+    for (int channel = 0; channel < 2; channel++) {
+        if (stored.channel_mode == 2 || stored.channel_mode == channel) {
+            channel_stream s;
+            s.channel = channel;
+            streams.push_back(s);
+        }
+    }
+    size_t ports = streams.size();
+    recorder.resize(ports);
+    trigger_buffer.resize(ports);
+    trigger_in.resize(ports);
+    trigger_out.resize(ports);
+    levels.resize(ports);
+    agc.resize(ports);
+    iq_correction.resize(ports);
+
     // 2. Open device if not opened
     stored.device_number = device_handler::getInstance().open_device(stored.serial);
     // 3. Check where to load settings from (file or block)
@@ -67,64 +88,105 @@ source_impl::source_impl(std::string serial, int channel_mode, const std::string
         device_handler::getInstance().enable_channels(
             stored.device_number, stored.channel_mode, LMS_CH_RX);
     }
+
+    // External trigger for triggered capture
+    message_port_register_in(pmt::mp("trigger"));
+    set_msg_handler(pmt::mp("trigger"), boost::bind(&source_impl::trigger_message, this, _1));
+    // Level statistics of overload detector
+    message_port_register_out(pmt::mp("stats"));
+    // Device health telemetry
+    message_port_register_out(pmt::mp("telemetry"));
+    // Configuration changes applied as one transaction
+    message_port_register_in(pmt::mp("command"));
+    set_msg_handler(pmt::mp("command"), boost::bind(&source_impl::command_message, this, _1));
 }
 
 source_impl::~source_impl() {
-    // Stop and destroy stream for channel 0 (if channel_mode is SISO)
-    if (stored.channel_mode < 2) {
-        this->release_stream(stored.device_number, &streamId[stored.channel_mode]);
-    }
-    // Stop and destroy stream for channels 0 & 1 (if channel_mode is MIMO)
-    else if (stored.channel_mode == 2) {
-        this->release_stream(stored.device_number, &streamId[LMS_CH_0]);
-        this->release_stream(stored.device_number, &streamId[LMS_CH_1]);
-    }
+    this->set_telemetry(0);
+    this->stop_agc();
+    this->stop_recording();
+    for (channel_stream& s : streams)
+        this->release_stream(stored.device_number, &s.stream);
     device_handler::getInstance().close_device(stored.device_number, source_block);
 }
 
 bool source_impl::start(void) {
     std::unique_lock<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
-    // Initialize and start stream for channel 0 (if channel_mode is SISO)
-    if (stored.channel_mode < 2) // If SISO configure prefered channel
+    // Rate requested while last run was stopping
+    if (rate_change.exchange(false)) {
+        double rate = rate_pending;
+        device_handler::getInstance().set_samp_rate(stored.device_number, rate);
+        stored.samp_rate = rate;
+    }
     {
-        this->init_stream(stored.device_number, stored.channel_mode);
-        if (LMS_StartStream(&streamId[stored.channel_mode]) != LMS_SUCCESS)
+        std::lock_guard<std::mutex> iq_lock(iq_mutex);
+        for (std::unique_ptr<iq_corrector>& c : iq_correction)
+            if (c)
+                c->set_samp_rate(stored.samp_rate);
+    }
+    // Set up all channel streams before starting any of them
+    device_telemetry& telemetry = device_handler::getInstance().get_telemetry(stored.device_number);
+    for (channel_stream& s : streams) {
+        this->init_stream(stored.device_number, s);
+        s.counters = telemetry.add_stream(LMS_CH_RX, s.channel, s.counters_key);
+    }
+    for (channel_stream& s : streams) {
+        if (LMS_StartStream(&s.stream) != LMS_SUCCESS)
             device_handler::getInstance().error(stored.device_number);
     }
 
-    // Initialize and start stream for channels 0 & 1 (if channel_mode is MIMO)
-    else if (stored.channel_mode == 2) {
-
-        this->init_stream(stored.device_number, LMS_CH_0);
-        this->init_stream(stored.device_number, LMS_CH_1);
-
-        if (LMS_StartStream(&streamId[LMS_CH_0]) != LMS_SUCCESS)
-            device_handler::getInstance().error(stored.device_number);
-        if (LMS_StartStream(&streamId[LMS_CH_1]) != LMS_SUCCESS)
-            device_handler::getInstance().error(stored.device_number);
+    // Start latching device time to host time source if sink has not done it already
+    time_sync& sync = device_handler::getInstance().get_time_sync(stored.device_number);
+    if (!sync.is_running() && sync.get_source() != TIME_SOURCE_NONE) {
+        sync.start(device_handler::getInstance().get_device(stored.device_number),
+                   stored.samp_rate);
+        time_sync_owner = true;
     }
     std::unique_lock<std::recursive_mutex> unlock(device_handler::getInstance().block_mutex);
 
+    if (!record_filename.empty())
+        this->start_recording();
+
+    if (agc_enabled)
+        this->start_agc();
+
     if (stream_analyzer) {
         t1 = std::chrono::high_resolution_clock::now();
         t2 = t1;
     }
 
+    clock.reset(stored.samp_rate);
     add_tag = true;
+    levels_time = std::chrono::steady_clock::now();
+    reconnect.generation = device_handler::getInstance().get_generation(stored.device_number);
+    reconnect.lost = false;
+    reconnect.last_data = levels_time;
 
     return true;
 }
 
 bool source_impl::stop(void) {
+    if (buffers.hugepages || buffers.numa_node >= 0) {
+        std::lock_guard<std::mutex> lock(trigger_mutex);
+        for (size_t i = 0; i < trigger_buffer.size(); i++) {
+            std::string name = "source trigger buffer " + std::to_string(i);
+            buffer_report(name.c_str(),
+                          trigger_buffer[i].data(),
+                          trigger_buffer[i].size() * sizeof(gr_complex));
+        }
+    }
+    this->stop_agc();
+    this->stop_recording();
     std::unique_lock<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
-    // Stop stream for channel 0 (if channel_mode is SISO)
-    if (stored.channel_mode < 2) {
-        this->release_stream(stored.device_number, &streamId[stored.channel_mode]);
+    if (time_sync_owner) {
+        device_handler::getInstance().get_time_sync(stored.device_number).stop();
+        time_sync_owner = false;
     }
-    // Stop streams for channels 0 & 1 (if channel_mode is MIMO)
-    else if (stored.channel_mode == 2) {
-        this->release_stream(stored.device_number, &streamId[LMS_CH_0]);
-        this->release_stream(stored.device_number, &streamId[LMS_CH_1]);
+    device_telemetry& telemetry = device_handler::getInstance().get_telemetry(stored.device_number);
+    for (channel_stream& s : streams) {
+        this->release_stream(stored.device_number, &s.stream);
+        telemetry.remove_stream(s.counters_key);
+        s.counters.reset();
     }
     std::unique_lock<std::recursive_mutex> unlock(device_handler::getInstance().block_mutex);
     return true;
@@ -134,89 +196,320 @@ int source_impl::general_work(int noutput_items,
                               gr_vector_int& ninput_items,
                               gr_vector_const_void_star& input_items,
                               gr_vector_void_star& output_items) {
-    // Receive stream for channel 0 (if channel_mode is SISO)
-    if (stored.channel_mode < 2) {
-        lms_stream_status_t status;
-        lms_stream_meta_t rx_metadata;
-
-        int ret0 = LMS_RecvStream(
-            &streamId[stored.channel_mode], output_items[0], noutput_items, &rx_metadata, 100);
-        if (ret0 < 0) {
+    if (rate_change)
+        this->change_rate();
+
+    if (trigger)
+        return this->triggered_work(noutput_items, output_items);
+
+    size_t ports = streams.size();
+    for (size_t i = 0; i < ports; i++) {
+        channel_stream& s = streams[i];
+        s.received = LMS_RecvStream(&s.stream, output_items[i], noutput_items, &s.meta, 100);
+        if (s.received <= 0) {
+            if (reconnect.enabled)
+                this->check_connection();
             return 0;
         }
+    }
+    if (reconnect.enabled)
+        this->data_received(streams[0].meta.timestamp + streams[0].received);
+
+    bool dropped = false;
+    for (size_t i = 0; i < ports; i++) {
+        channel_stream& s = streams[i];
+        this->read_status(i);
+        dropped |= s.status.droppedPackets > 0;
+        if (s.counters)
+            s.counters->update(s.status);
 
-        LMS_GetStreamStatus(&streamId[stored.channel_mode], &status);
+        if (iq_correction_enabled)
+            this->correct_buffer(i, static_cast<gr_complex*>(output_items[i]), s.received);
 
-        if (add_tag || status.droppedPackets > 0) {
-            pktLoss += status.droppedPackets;
-            add_tag = false;
-            this->add_time_tag(0, rx_metadata);
+        if (recording) {
+            this->record(
+                i, output_items[i], s.received, s.meta.timestamp, s.status.droppedPackets);
         }
-        // Print stream stats to debug
-        if (stream_analyzer == true) {
-            this->print_stream_stats(status);
+
+        if (overload.enabled || agc_enabled) {
+            this->measure_levels(i,
+                                 static_cast<gr_complex*>(output_items[i]),
+                                 s.received,
+                                 s.meta.timestamp,
+                                 true);
         }
+    }
+    if (overload.enabled || agc_enabled)
+        this->publish_levels();
 
-        produce(0, ret0);
-        return WORK_CALLED_PRODUCE;
+    if (add_tag || dropped) {
+        // GetStreamStatus resets packet loss on every call, first channel is representative
+        pktLoss += streams[0].status.droppedPackets;
+        add_tag = false;
+        for (size_t i = 0; i < ports; i++)
+            this->add_time_tag(i, streams[i].meta.timestamp, nitems_written(i));
+    }
+    // First sample at new rate
+    if (rate_tag) {
+        rate_tag = false;
+        const pmt::pmt_t ID = pmt::string_to_symbol(stored.serial);
+        for (size_t i = 0; i < ports; i++)
+            this->add_item_tag(
+                i, nitems_written(i), RATE_TAG, pmt::from_double(stored.samp_rate), ID);
+    }
+    // Print stream stats to debug
+    if (stream_analyzer == true) {
+        this->print_stream_stats(streams[0].status);
     }
-    // Receive stream for channels 0 & 1 (if channel_mode is MIMO)
-    else if (stored.channel_mode == 2) {
-        lms_stream_status_t status[2];
 
-        lms_stream_meta_t rx_metadata[2];
-        int ret0 = LMS_RecvStream(
-            &streamId[LMS_CH_0], output_items[0], noutput_items, &rx_metadata[0], 100);
-        int ret1 = LMS_RecvStream(
-            &streamId[LMS_CH_1], output_items[1], noutput_items, &rx_metadata[1], 100);
-        if (ret0 <= 0 || ret1 <= 0) {
-            return 0;
-        }
+    for (size_t i = 0; i < ports; i++)
+        this->produce(i, streams[i].received);
+    return WORK_CALLED_PRODUCE;
+}
 
-        LMS_GetStreamStatus(&streamId[LMS_CH_0], &status[0]);
-        LMS_GetStreamStatus(&streamId[LMS_CH_1], &status[1]);
+int source_impl::triggered_work(int noutput_items, gr_vector_void_star& output_items) {
+    std::lock_guard<std::mutex> lock(trigger_mutex);
+    if (!trigger)
+        return 0;
+    size_t ports = streams.size();
+    for (size_t i = 0; i < ports; i++)
+        trigger_out[i] = static_cast<gr_complex*>(output_items[i]);
 
-        if (add_tag || status[0].droppedPackets > 0 || status[1].droppedPackets > 0) {
-            pktLoss += status[0].droppedPackets; // because every time GetStreamStatus is called,
-                                                 // packet loss is reset
-            add_tag = false;
-            this->add_time_tag(LMS_CH_0, rx_metadata[0]);
-            this->add_time_tag(LMS_CH_1, rx_metadata[1]);
+    // Output captures queued by previous calls before receiving more
+    if (trigger->get_pending() == 0) {
+        int ret = noutput_items;
+        for (size_t i = 0; i < ports; i++) {
+            channel_stream& s = streams[i];
+            trigger_buffer[i].resize(std::max(noutput_items, s.surplus));
+            trigger_in[i] = trigger_buffer[i].data();
+            int wanted = noutput_items - s.surplus;
+            s.received = 0;
+            if (wanted > 0) {
+                s.received = LMS_RecvStream(
+                    &s.stream, trigger_in[i] + s.surplus, wanted, &s.meta, 100);
+                if (s.received <= 0) {
+                    // Channels already read keep their samples for next call
+                    for (size_t j = 0; j < i; j++) {
+                        streams[j].surplus = streams[j].received;
+                        streams[j].surplus_timestamp = streams[j].meta.timestamp;
+                    }
+                    if (reconnect.enabled)
+                        this->check_connection();
+                    return 0;
+                }
+                // Kept samples are dropped if new ones do not continue them (gap or restart)
+                if (s.surplus > 0 && s.meta.timestamp != s.surplus_timestamp + s.surplus) {
+                    std::copy(trigger_in[i] + s.surplus,
+                              trigger_in[i] + s.surplus + s.received,
+                              trigger_in[i]);
+                    s.surplus = 0;
+                }
+            }
+            if (s.surplus > 0)
+                s.meta.timestamp = s.surplus_timestamp;
+            s.received += s.surplus;
+            s.surplus = 0;
+            ret = std::min(ret, s.received);
         }
+        for (size_t i = 0; i < ports; i++) {
+            static log_limiter uneven;
+            uint64_t skipped;
+            if (streams[i].received == ret || !uneven.allow(skipped))
+                continue;
+            log_stream() << "WARNING: source_impl::triggered_work(): channel sample counts "
+                            "differ, CH"
+                         << streams[i].channel << " keeps " << streams[i].received - ret
+                         << " samples for next call";
+            if (skipped)
+                log_stream() << " (" << skipped << " more suppressed)";
+            log_stream() << "." << std::endl;
+        }
+        if (reconnect.enabled)
+            this->data_received(streams[0].meta.timestamp + streams[0].received);
 
-        // Print stream stats to debug
+        for (size_t i = 0; i < ports; i++) {
+            channel_stream& s = streams[i];
+            this->read_status(i);
+            if (s.counters)
+                s.counters->update(s.status);
+            if (iq_correction_enabled)
+                this->correct_buffer(i, trigger_in[i], ret);
+            if (recording)
+                this->record(i, trigger_in[i], ret, s.meta.timestamp, s.status.droppedPackets);
+            // Output is not continuous, only statistics are gathered
+            if (overload.enabled || agc_enabled)
+                this->measure_levels(i, trigger_in[i], ret, s.meta.timestamp, false);
+        }
+        pktLoss += streams[0].status.droppedPackets;
+        if (overload.enabled || agc_enabled)
+            this->publish_levels();
         if (stream_analyzer == true) {
-            this->print_stream_stats(status[0]);
+            this->print_stream_stats(streams[ports - 1].status);
+        }
+
+        // Each capture starts with rx_time, trigger position and length
+        trigger_captures.clear();
+        trigger->process(trigger_in.data(), ret, streams[0].meta.timestamp, trigger_captures);
+        const pmt::pmt_t ID = pmt::string_to_symbol(stored.serial);
+        for (const trigger_capture& capture : trigger_captures) {
+            for (size_t i = 0; i < ports; i++) {
+                uint64_t offset = nitems_written(i) + capture.offset;
+                this->add_time_tag(i, capture.timestamp, offset);
+                this->add_item_tag(
+                    i, offset + capture.pre, TRIGGER_TAG, pmt::from_uint64(capture.pre), ID);
+                this->add_item_tag(
+                    i, offset, BURST_LEN_TAG, pmt::from_long(capture.length), ID);
+            }
+        }
+
+        // Samples beyond the shortest channel are processed with the next buffer
+        for (size_t i = 0; i < ports; i++) {
+            channel_stream& s = streams[i];
+            s.surplus = s.received - ret;
+            if (s.surplus == 0)
+                continue;
+            std::copy(trigger_in[i] + ret, trigger_in[i] + s.received, trigger_in[i]);
+            s.surplus_timestamp = s.meta.timestamp + ret;
         }
+    }
+
+    int produced = trigger->read(trigger_out.data(), noutput_items);
+    for (size_t i = 0; i < ports; i++)
+        this->produce(i, produced);
+    return WORK_CALLED_PRODUCE;
+}
 
-        this->produce(0, ret0);
-        this->produce(1, ret1);
-        return WORK_CALLED_PRODUCE;
+// Status read clears loss counters, so it is read only here and passed on. Counter of the
+// first stream also feeds device time synchronization.
+void source_impl::read_status(size_t port) {
+    channel_stream& s = streams[port];
+    time_sync& sync = device_handler::getInstance().get_time_sync(stored.device_number);
+    if (port != 0 || !sync.is_running()) {
+        LMS_GetStreamStatus(&s.stream, &s.status);
+        return;
     }
-    return 0;
+    auto t_before = std::chrono::system_clock::now();
+    if (LMS_GetStreamStatus(&s.stream, &s.status) != LMS_SUCCESS)
+        return;
+    auto t_after = std::chrono::system_clock::now();
+    // Counter was sampled somewhere during the request, use midpoint
+    sync.post_timestamp(s.status.timestamp, t_before + (t_after - t_before) / 2);
+}
+
+void source_impl::correct_buffer(int channel, gr_complex* data, int items) {
+    std::lock_guard<std::mutex> lock(iq_mutex);
+    iq_corrector* c = iq_correction[channel].get();
+    if (!c)
+        return;
+    // Retune or gain change (also by AGC) switches to state of new frequency and gain
+    int ch = streams[channel].channel;
+    c->select(stored.rf_freq[ch], stored.gain[ch]);
+    c->process(reinterpret_cast<float*>(data), items);
+}
+
+void source_impl::measure_levels(
+    int channel, const gr_complex* data, int items, uint64_t timestamp, bool tag) {
+    buffer_stats stats;
+    measure_buffer(reinterpret_cast<const float*>(data), items, overload.clip_level, stats);
+    const pmt::pmt_t ID = pmt::string_to_symbol(stored.serial);
+
+    if (overload.enabled) {
+        level_stats& l = levels[channel];
+        l.peak = std::max(l.peak, stats.peak);
+        l.power_sum += stats.power_sum;
+        l.samples += items;
+        l.clipped += stats.clipped;
+
+        // One tag per buffer at the first clipped sample, value is clipped sample count
+        if (tag && stats.clipped > 0) {
+            this->add_item_tag(channel,
+                               nitems_written(channel) + stats.first_clip,
+                               CLIP_TAG,
+                               pmt::from_uint64(stats.clipped),
+                               ID);
+        }
+    }
+
+    if (agc_enabled) {
+        std::lock_guard<std::mutex> lock(agc_mutex);
+        if (!agc[channel])
+            return;
+        agc[channel]->update(timestamp, items, stats.power_sum, stats.clipped);
+
+        // Tag gain changes at the sample they took effect
+        agc_change change;
+        bool changed = false;
+        while (agc[channel]->pop_change(timestamp + items, change)) {
+            stored.gain[streams[channel].channel] = change.gain;
+            changed = true;
+            if (!tag)
+                continue;
+            uint64_t offset = (change.timestamp > timestamp) ? change.timestamp - timestamp : 0;
+            this->add_item_tag(channel,
+                               nitems_written(channel) + offset,
+                               GAIN_TAG,
+                               pmt::from_long(change.gain),
+                               ID);
+        }
+        if (changed)
+            this->update_recording();
+    }
+}
+
+void source_impl::publish_levels() {
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - levels_time).count() < overload.interval)
+        return;
+    levels_time = now;
+
+    for (size_t i = 0; i < streams.size(); i++) {
+        level_stats& l = levels[i];
+        if (l.samples == 0)
+            continue;
+        double rms = std::sqrt(l.power_sum / l.samples);
+        pmt::pmt_t msg = pmt::make_dict();
+        msg = pmt::dict_add(msg, pmt::mp("channel"), pmt::from_long(streams[i].channel));
+        msg = pmt::dict_add(msg, pmt::mp("peak"), pmt::from_double(l.peak));
+        msg = pmt::dict_add(msg, pmt::mp("rms"), pmt::from_double(rms));
+        msg = pmt::dict_add(
+            msg, pmt::mp("peak_dbfs"), pmt::from_double(20 * std::log10(l.peak + 1e-12)));
+        msg = pmt::dict_add(
+            msg, pmt::mp("rms_dbfs"), pmt::from_double(20 * std::log10(rms + 1e-12)));
+        msg = pmt::dict_add(msg, pmt::mp("clipped"), pmt::from_uint64(l.clipped));
+        msg = pmt::dict_add(msg, pmt::mp("samples"), pmt::from_uint64(l.samples));
+        message_port_pub(pmt::mp("stats"), msg);
+        l = level_stats();
+    }
+}
+
+void source_impl::trigger_message(pmt::pmt_t msg) {
+    std::lock_guard<std::mutex> lock(trigger_mutex);
+    if (trigger)
+        trigger->fire();
 }
 
 // Setup stream
-void source_impl::init_stream(int device_number, int channel) {
-    streamId[channel].channel = channel;
-    streamId[channel].fifoSize =
-        (stored.FIFO_size == 0) ? (int)stored.samp_rate / 10 : stored.FIFO_size;
-    streamId[channel].throughputVsLatency = 0.5;
-    streamId[channel].isTx = LMS_CH_RX;
-    streamId[channel].dataFmt = lms_stream_t::LMS_FMT_F32;
-
-    if (LMS_SetupStream(device_handler::getInstance().get_device(stored.device_number),
-                        &streamId[channel]) != LMS_SUCCESS)
+void source_impl::init_stream(int device_number, channel_stream& s) {
+    s.stream.channel = s.channel;
+    s.stream.fifoSize = (stored.FIFO_size == 0) ? (int)stored.samp_rate / 10 : stored.FIFO_size;
+    s.stream.throughputVsLatency = 0.5;
+    s.stream.isTx = LMS_CH_RX;
+    s.stream.dataFmt = lms_stream_t::LMS_FMT_F32;
+
+    reconnect.stream_device = device_handler::getInstance().get_device(stored.device_number);
+    if (LMS_SetupStream(reconnect.stream_device, &s.stream) != LMS_SUCCESS)
         device_handler::getInstance().error(stored.device_number);
 
-    std::cout << "INFO: source_impl::init_stream(): source channel " << channel << " (device nr. "
-              << device_number << ") stream setup done." << std::endl;
+    log_stream() << "INFO: source_impl::init_stream(): source channel " << s.channel
+                 << " (device nr. " << device_number << ") stream setup done." << std::endl;
 }
 
 void source_impl::release_stream(int device_number, lms_stream_t* stream) {
     if (stream->handle != 0) {
+        // Handle of an unplugged device is replaced on reconnect, stream belongs to the old one
         LMS_StopStream(stream);
-        LMS_DestroyStream(device_handler::getInstance().get_device(device_number), stream);
+        LMS_DestroyStream(reconnect.stream_device, stream);
+        stream->handle = 0;
     }
 }
 
@@ -225,28 +518,29 @@ void source_impl::print_stream_stats(lms_stream_status_t status) {
     t2 = std::chrono::high_resolution_clock::now();
     auto timePeriod = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
     if (timePeriod >= 1000) {
-        std::cout << std::endl;
-        std::cout << "RX";
-        std::cout << "|rate: " << status.linkRate / 1e6 << " MB/s ";
-        std::cout << "|dropped packets: " << pktLoss << " ";
-        std::cout << "|FIFO: " << 100 * status.fifoFilledCount / status.fifoSize << "%"
-                  << std::endl;
+        log_stream() << std::endl;
+        log_stream() << "RX";
+        log_stream() << "|rate: " << status.linkRate / 1e6 << " MB/s ";
+        log_stream() << "|dropped packets: " << pktLoss << " ";
+        log_stream() << "|FIFO: " << 100 * status.fifoFilledCount / status.fifoSize << "%"
+                     << std::endl;
         pktLoss = 0;
         t1 = t2;
     }
 }
 
 // Add rx_time tag to stream
-void source_impl::add_time_tag(int channel, lms_stream_meta_t meta) {
-
-    uint64_t u_rate = (uint64_t)stored.samp_rate;
-    double f_rate = stored.samp_rate - u_rate;
-    uint64_t intpart = meta.timestamp / u_rate;
-    double fracpart = (meta.timestamp - intpart * u_rate - intpart * f_rate) / stored.samp_rate;
+void source_impl::add_time_tag(int channel, uint64_t timestamp, uint64_t offset) {
+    uint64_t intpart;
+    double fracpart;
+    // Absolute UTC when device time is locked to host time source, otherwise time since start
+    if (!device_handler::getInstance().get_time_sync(stored.device_number).to_utc(
+            timestamp, intpart, fracpart))
+        clock.to_time(timestamp, intpart, fracpart);
 
     const pmt::pmt_t ID = pmt::string_to_symbol(stored.serial);
     const pmt::pmt_t t_val = pmt::make_tuple(pmt::from_uint64(intpart), pmt::from_double(fracpart));
-    this->add_item_tag(channel, nitems_written(channel), TIME_TAG, t_val, ID);
+    this->add_item_tag(channel, offset, TIME_TAG, t_val, ID);
 }
 // Return io_signature to manage module output count
 // based on SISO (one output) and MIMO (two outputs) modes
@@ -256,28 +550,61 @@ inline gr::io_signature::sptr source_impl::args_to_io_signature(int channel_numb
     } else if (channel_number == 2) {
         return gr::io_signature::make(2, 2, sizeof(gr_complex));
     } else {
-        std::cout << "ERROR: source_impl::args_to_io_signature(): channel_number must be 0,1 or 2."
-                  << std::endl;
+        log_stream() << "ERROR: source_impl::args_to_io_signature(): channel_number must be 0,1 "
+                        "or 2."
+                     << std::endl;
         exit(0);
     }
 }
 double source_impl::set_center_freq(double freq, size_t chan) {
-    add_tag = true;
-    return device_handler::getInstance().set_rf_freq(
-        stored.device_number, LMS_CH_RX, LMS_CH_0, freq);
+    if (chan > 1) {
+        log_stream() << "ERROR: source_impl::set_center_freq(): channel must be 0 or 1."
+                     << std::endl;
+        return 0;
+    }
+    this->config_changed();
+    // SISO: channel is tuned by LO alone
+    if (streams.size() == 1) {
+        int channel = streams[0].channel;
+        if (freq == 0)
+            return stored.rf_freq[channel];
+        stored.rf_freq[channel] = device_handler::getInstance().set_rf_freq(
+            stored.device_number, LMS_CH_RX, channel, freq);
+        this->update_recording();
+        return stored.rf_freq[channel];
+    }
+    // MIMO: shared LO plus per-channel NCO offset
+    device_handler::getInstance().tune_channel(stored.device_number, LMS_CH_RX, chan, freq);
+    for (int i = 0; i < 2; i++)
+        stored.rf_freq[i] =
+            device_handler::getInstance().get_channel_freq(stored.device_number, LMS_CH_RX, i);
+    this->update_recording();
+    return stored.rf_freq[chan];
+}
+
+void source_impl::warm_up_tuning(const std::vector<double>& freqs) {
+    // In MIMO both channels share LO, tune through first channel
+    device_handler::getInstance().warm_up_tuning(
+        stored.device_number, LMS_CH_RX, streams[0].channel, freqs);
+}
+
+void source_impl::benchmark_tuning(const std::vector<double>& freqs, int rounds) {
+    device_handler::getInstance().benchmark_tuning(
+        stored.device_number, LMS_CH_RX, streams[0].channel, freqs, rounds);
 }
 
 void source_impl::set_nco(float nco_freq, int channel) {
     device_handler::getInstance().set_nco(stored.device_number, LMS_CH_RX, channel, nco_freq);
-    add_tag = true;
+    this->config_changed();
 }
 
 void source_impl::set_antenna(int antenna, int channel) {
+    this->config_changed();
     device_handler::getInstance().set_antenna(stored.device_number, channel, LMS_CH_RX, antenna);
 }
 
 double source_impl::set_bandwidth(double analog_bandw, int channel) {
-    add_tag = true;
+    this->config_changed();
     return device_handler::getInstance().set_analog_filter(
         stored.device_number, LMS_CH_RX, channel, analog_bandw);
 }
@@ -285,12 +612,38 @@ double source_impl::set_bandwidth(double analog_bandw, int channel) {
 void source_impl::set_digital_filter(double digital_bandw, int channel) {
     device_handler::getInstance().set_digital_filter(
         stored.device_number, LMS_CH_RX, channel, digital_bandw);
-    add_tag = true;
+    this->config_changed();
+}
+
+void source_impl::set_gfir_taps(int filter, const std::vector<double>& taps, int channel) {
+    device_handler::getInstance().set_gfir_taps(
+        stored.device_number, LMS_CH_RX, channel, filter, taps);
+    this->config_changed();
+}
+
+void source_impl::set_gfir_lowpass(
+    int filter, double passband, double stopband, double ripple, double attenuation, int channel) {
+    fir_spec spec;
+    spec.passband = passband;
+    spec.stopband = stopband;
+    spec.ripple = ripple;
+    spec.attenuation = attenuation;
+    device_handler::getInstance().set_gfir_lowpass(
+        stored.device_number, LMS_CH_RX, channel, filter, spec);
+    this->config_changed();
 }
 
 unsigned source_impl::set_gain(unsigned gain_dB, int channel) {
-    return device_handler::getInstance().set_gain(
+    stored.gain[channel] = device_handler::getInstance().set_gain(
         stored.device_number, LMS_CH_RX, channel, gain_dB);
+    this->update_recording();
+    // AGC continues from the new gain
+    std::lock_guard<std::mutex> lock(agc_mutex);
+    for (size_t i = 0; i < streams.size(); i++) {
+        if (agc[i] && streams[i].channel == channel)
+            agc[i]->set_gain(stored.gain[channel]);
+    }
+    return stored.gain[channel];
 }
 
 void source_impl::calibrate(double bandw, int channel) {
@@ -298,20 +651,474 @@ void source_impl::calibrate(double bandw, int channel) {
 }
 
 double source_impl::set_sample_rate(double rate) {
+    // While streaming, stream is restarted by work thread so that it never receives from a
+    // destroyed stream
+    if (streams[0].stream.handle != 0) {
+        rate_pending = rate;
+        rate_change = true;
+        return rate;
+    }
     device_handler::getInstance().set_samp_rate(stored.device_number, rate);
     stored.samp_rate = rate;
     return rate;
 }
 
+void source_impl::change_rate() {
+    auto t_start = std::chrono::steady_clock::now();
+    rate_change = false;
+    double rate = rate_pending;
+
+    // Helper threads hold the stream, stop them first
+    bool agc_running = agc_enabled;
+    this->stop_agc();
+    // Rate is fixed per file, recording continues into new files
+    int next_file = -1;
+    {
+        std::lock_guard<std::mutex> lock(recorder_mutex);
+        for (std::unique_ptr<iq_recorder>& r : recorder) {
+            if (r)
+                next_file = std::max(next_file, r->finish());
+            r.reset();
+        }
+        recording = false;
+    }
+
+    std::unique_lock<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
+    time_sync& sync = device_handler::getInstance().get_time_sync(stored.device_number);
+    if (time_sync_owner)
+        sync.stop();
+
+    // Stream time reached so far, new counter continues from it
+    lms_stream_status_t status;
+    LMS_GetStreamStatus(&streams[0].stream, &status);
+    if (streams[0].counters)
+        streams[0].counters->update(status);
+    uint64_t old_timestamp = status.timestamp;
+    auto t_old = std::chrono::steady_clock::now();
+
+    // FIFO is sized from sample rate, so streams are set up again
+    for (channel_stream& s : streams)
+        this->release_stream(stored.device_number, &s.stream);
+    device_handler::getInstance().set_samp_rate(stored.device_number, rate);
+    stored.samp_rate = rate;
+    {
+        std::lock_guard<std::mutex> iq_lock(iq_mutex);
+        for (std::unique_ptr<iq_corrector>& c : iq_correction)
+            if (c)
+                c->set_samp_rate(rate);
+    }
+    for (channel_stream& s : streams)
+        this->init_stream(stored.device_number, s);
+    for (channel_stream& s : streams) {
+        if (LMS_StartStream(&s.stream) != LMS_SUCCESS)
+            device_handler::getInstance().error(stored.device_number);
+    }
+
+    LMS_GetStreamStatus(&streams[0].stream, &status);
+    double gap = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_old).count();
+    clock.rebase(old_timestamp, status.timestamp, rate, gap);
+
+    if (time_sync_owner)
+        sync.start(device_handler::getInstance().get_device(stored.device_number),
+                   stored.samp_rate);
+    lock.unlock();
+
+    if (next_file >= 0)
+        this->start_recording(next_file);
+    if (agc_running)
+        this->start_agc();
+
+    // rx_time and rx_rate mark the first sample at new rate
+    add_tag = true;
+    rate_tag = true;
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    log_stream() << "INFO: source_impl::change_rate(): stream restarted at " << rate / 1e6
+                 << " MS/s in " << elapsed * 1e3 << " ms." << std::endl;
+}
+
 void source_impl::set_buffer_size(uint32_t size) { stored.FIFO_size = size; }
 
 void source_impl::set_oversampling(int oversample) {
     device_handler::getInstance().set_oversampling(stored.device_number, oversample);
 }
 
+void source_impl::set_rate_plan(double bandwidth, double attenuation) {
+    device_handler::getInstance().set_rate_plan(
+        stored.device_number, LMS_CH_RX, bandwidth, attenuation);
+    this->set_sample_rate(stored.samp_rate);
+}
+
 void source_impl::set_tcxo_dac(uint16_t dacVal) {
     device_handler::getInstance().set_tcxo_dac(stored.device_number, dacVal);
 }
 
+void source_impl::set_time_source(int source, double param) {
+    device_handler::getInstance().set_time_source(stored.device_number, source, param);
+}
+
+void source_impl::set_buffer_policy(bool hugepages, int numa_node) {
+    buffers.hugepages = hugepages;
+    buffers.numa_node = numa_node;
+    // Trigger buffers are allocated by work thread on first use, so they land on its node
+    std::lock_guard<std::mutex> lock(trigger_mutex);
+    for (buffer_vector<gr_complex>& buffer : trigger_buffer)
+        buffer = buffer_vector<gr_complex>(buffer_allocator<gr_complex>(buffers));
+}
+
+void source_impl::set_recording(const std::string& filename, uint64_t file_size, int metadata) {
+    bool running = recording;
+    this->stop_recording();
+    record_filename = filename;
+    record_file_size = file_size;
+    record_metadata = metadata;
+    // Applied immediately when changed while streaming
+    if (running && !record_filename.empty())
+        this->start_recording();
+}
+
+void source_impl::set_trigger(int pre, int post, double threshold) {
+    std::lock_guard<std::mutex> lock(trigger_mutex);
+    if (post <= 0) {
+        trigger.reset();
+        return;
+    }
+    if (pre < 0) {
+        log_stream() << "ERROR: source_impl::set_trigger(): pre-trigger length can not be negative."
+                     << std::endl;
+        return;
+    }
+    trigger.reset(new burst_trigger(streams.size(), pre, post, threshold));
+    log_stream() << "INFO: source_impl::set_trigger(): triggered capture of " << pre << " + "
+                 << post << " samples";
+    if (threshold <= 0)
+        log_stream() << ", level " << threshold << " dBFS";
+    log_stream() << "." << std::endl;
+}
+
+void source_impl::begin_config() {
+    if (config_depth++ == 0)
+        device_handler::getInstance().begin_batch(stored.device_number);
+}
+
+void source_impl::commit() {
+    if (config_depth == 0 || --config_depth > 0)
+        return;
+    device_handler::getInstance().end_batch(stored.device_number);
+    // Single tag at the first sample received after all changes were applied
+    add_tag = true;
+}
+
+void source_impl::config_changed() {
+    if (config_depth == 0)
+        add_tag = true;
+}
+
+void source_impl::command_message(pmt::pmt_t msg) {
+    if (!pmt::is_dict(msg)) {
+        log_stream() << "WARNING: source_impl::command_message(): command must be a dict."
+                     << std::endl;
+        return;
+    }
+    // Channel settings apply to "chan" if present, otherwise to all block channels
+    std::vector<int> channels;
+    pmt::pmt_t chan = pmt::dict_ref(msg, pmt::mp("chan"), pmt::PMT_NIL);
+    if (pmt::is_number(chan)) {
+        // Only channels streamed by this block, settings are indexed by channel
+        double requested = pmt::to_double(chan);
+        for (const channel_stream& s : streams) {
+            if (s.channel == requested)
+                channels.push_back(s.channel);
+        }
+        if (channels.empty()) {
+            log_stream() << "WARNING: source_impl::command_message(): chan " << requested
+                         << " is not a channel of this block, command ignored." << std::endl;
+            return;
+        }
+    } else {
+        for (const channel_stream& s : streams)
+            channels.push_back(s.channel);
+    }
+
+    auto value = [&msg](const char* key) {
+        return pmt::dict_ref(msg, pmt::mp(key), pmt::PMT_NIL);
+    };
+
+    this->begin_config();
+    for (int channel : channels) {
+        if (pmt::is_number(value("freq")))
+            this->set_center_freq(pmt::to_double(value("freq")), channel);
+        if (pmt::is_number(value("antenna")))
+            this->set_antenna((int)pmt::to_double(value("antenna")), channel);
+        if (pmt::is_number(value("bandwidth")))
+            this->set_bandwidth(pmt::to_double(value("bandwidth")), channel);
+        if (pmt::is_number(value("digital_filter")))
+            this->set_digital_filter(pmt::to_double(value("digital_filter")), channel);
+        if (pmt::is_number(value("nco")))
+            this->set_nco(pmt::to_double(value("nco")), channel);
+        if (pmt::is_number(value("gain")))
+            this->set_gain((unsigned)std::lround(pmt::to_double(value("gain"))), channel);
+    }
+    this->commit();
+}
+
+void source_impl::set_overload_detector(bool enable, double clip_level, double interval) {
+    if (clip_level <= 0 || clip_level > 1) {
+        log_stream() << "ERROR: source_impl::set_overload_detector(): clip level must be more "
+                        "than 0 and not more than 1."
+                     << std::endl;
+        return;
+    }
+    overload.clip_level = clip_level;
+    overload.interval = interval;
+    overload.enabled = enable;
+}
+
+void source_impl::set_agc(
+    bool enable, double target, double attack, double decay, double hysteresis) {
+    if (target > 0 || attack <= 0 || decay <= 0 || hysteresis < 0) {
+        log_stream() << "ERROR: source_impl::set_agc(): target must not be above 0 dBFS, attack "
+                        "and decay must be more than 0, hysteresis can not be negative."
+                     << std::endl;
+        return;
+    }
+    agc_config.target = target;
+    agc_config.attack = attack;
+    agc_config.decay = decay;
+    agc_config.hysteresis = hysteresis;
+
+    bool streaming = streams[0].stream.handle != 0;
+    if (!enable) {
+        this->stop_agc();
+    } else if (agc_enabled) {
+        std::lock_guard<std::mutex> lock(agc_mutex);
+        for (std::unique_ptr<rx_agc>& a : agc)
+            if (a)
+                a->set_settings(agc_config);
+    } else if (streaming) {
+        this->start_agc();
+    }
+    agc_enabled = enable;
+}
+
+void source_impl::start_agc() {
+    std::lock_guard<std::mutex> lock(agc_mutex);
+    for (size_t i = 0; i < streams.size(); i++) {
+        int channel = streams[i].channel;
+        agc[i].reset(new rx_agc(
+            stored.device_number, channel, stored.samp_rate, agc_config, stored.gain[channel]));
+    }
+    log_stream() << "INFO: source_impl::start_agc(): AGC target " << agc_config.target << " dBFS."
+                 << std::endl;
+}
+
+void source_impl::stop_agc() {
+    std::lock_guard<std::mutex> lock(agc_mutex);
+    if (!agc[0])
+        return;
+    for (std::unique_ptr<rx_agc>& a : agc)
+        a.reset();
+    // Keep recording metadata in line with gain left by AGC
+    this->update_recording();
+}
+
+void source_impl::set_iq_correction(bool enable, double time_constant) {
+    if (time_constant <= 0) {
+        log_stream() << "ERROR: source_impl::set_iq_correction(): time constant must be more "
+                        "than 0."
+                     << std::endl;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(iq_mutex);
+    iq_time_constant = time_constant;
+    for (size_t i = 0; i < streams.size(); i++) {
+        std::unique_ptr<iq_corrector>& c = iq_correction[i];
+        if (!enable && c) {
+            double dc_i, dc_q, gain_error, phase_error;
+            c->get_estimate(dc_i, dc_q, gain_error, phase_error);
+            log_stream() << "INFO: source_impl::set_iq_correction(): CH" << streams[i].channel
+                         << " DC " << dc_i << ", " << dc_q << ", gain error " << gain_error
+                         << " dB, phase error " << phase_error << " deg, state cache hits "
+                         << c->get_hits() << ", misses " << c->get_misses() << "."
+                         << std::endl;
+            c.reset();
+        } else if (enable && c) {
+            c->set_time_constant(time_constant);
+        } else if (enable) {
+            c.reset(new iq_corrector(stored.samp_rate, time_constant));
+        }
+    }
+    iq_correction_enabled = enable;
+}
+
+void source_impl::set_telemetry(double interval) {
+    if (interval < 0) {
+        log_stream() << "ERROR: source_impl::set_telemetry(): interval must not be negative."
+                     << std::endl;
+        return;
+    }
+    device_telemetry& telemetry = device_handler::getInstance().get_telemetry(stored.device_number);
+    if (telemetry_key >= 0) {
+        telemetry.unsubscribe(telemetry_key);
+        telemetry_key = -1;
+    }
+    if (interval == 0)
+        return;
+    telemetry_key = telemetry.subscribe(
+        interval, [this](pmt::pmt_t msg) { message_port_pub(pmt::mp("telemetry"), msg); });
+    log_stream() << "INFO: source_impl::set_telemetry(): publishing device telemetry every "
+                 << interval << " s." << std::endl;
+}
+
+void source_impl::set_auto_reconnect(bool enable, double timeout) {
+    if (timeout <= 0) {
+        log_stream() << "ERROR: source_impl::set_auto_reconnect(): timeout must be more than 0."
+                     << std::endl;
+        return;
+    }
+    reconnect.timeout = timeout;
+    reconnect.enabled = enable;
+    if (!enable)
+        return;
+    // Arrivals and removals are known before a stream stalls
+    device_handler::getInstance().start_discovery(timeout);
+    log_stream() << "INFO: source_impl::set_auto_reconnect(): reconnecting to " << stored.serial
+                 << " after " << timeout << " s without samples." << std::endl;
+}
+
+void source_impl::check_connection() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - reconnect.last_data < std::chrono::duration<double>(reconnect.timeout))
+        return;
+
+    if (!reconnect.lost) {
+        // Stall of a device that still responds is not a disconnect
+        if (!device_handler::getInstance().device_lost(stored.device_number,
+                                                       reconnect.generation)) {
+            reconnect.last_data = now;
+            return;
+        }
+        log_stream() << "WARNING: source_impl::check_connection(): no samples from "
+                     << stored.serial << " for " << reconnect.timeout
+                     << " s, device lost. Reconnecting." << std::endl;
+        reconnect.lost = true;
+
+        // Helper threads hold the stream, recording continues into new files
+        reconnect.agc_running = agc_enabled;
+        this->stop_agc();
+        reconnect.next_file = -1;
+        {
+            std::lock_guard<std::mutex> lock(recorder_mutex);
+            for (std::unique_ptr<iq_recorder>& r : recorder) {
+                if (r)
+                    reconnect.next_file = std::max(reconnect.next_file, r->finish());
+                r.reset();
+            }
+            recording = false;
+        }
+        std::unique_lock<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
+        if (time_sync_owner)
+            device_handler::getInstance().get_time_sync(stored.device_number).stop();
+        for (channel_stream& s : streams)
+            this->release_stream(stored.device_number, &s.stream);
+    }
+
+    // Waits up to timeout for the device without holding the device lock, work is called
+    // again if it does not appear
+    if (!device_handler::getInstance().reconnect_device(
+            stored.device_number, reconnect.generation, reconnect.timeout))
+        return;
+    std::unique_lock<std::recursive_mutex> lock(device_handler::getInstance().block_mutex);
+    for (channel_stream& s : streams)
+        this->init_stream(stored.device_number, s);
+    for (channel_stream& s : streams) {
+        if (LMS_StartStream(&s.stream) != LMS_SUCCESS)
+            device_handler::getInstance().error(stored.device_number);
+    }
+
+    // Device counter starts again, time continues over the outage
+    lms_stream_status_t status;
+    LMS_GetStreamStatus(&streams[0].stream, &status);
+    double gap =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - reconnect.last_data)
+            .count();
+    clock.rebase(reconnect.timestamp, status.timestamp, stored.samp_rate, gap);
+
+    time_sync& sync = device_handler::getInstance().get_time_sync(stored.device_number);
+    if (time_sync_owner)
+        sync.start(device_handler::getInstance().get_device(stored.device_number),
+                   stored.samp_rate);
+    lock.unlock();
+
+    if (reconnect.next_file >= 0)
+        this->start_recording(reconnect.next_file);
+    if (reconnect.agc_running)
+        this->start_agc();
+    add_tag = true;
+}
+
+void source_impl::data_received(uint64_t timestamp) {
+    auto now = std::chrono::steady_clock::now();
+    if (reconnect.lost) {
+        reconnect.lost = false;
+        reconnect.count++;
+        double elapsed = std::chrono::duration<double>(now - reconnect.last_data).count();
+        log_stream() << "INFO: source_impl::data_received(): streaming from " << stored.serial
+                     << " resumed " << elapsed * 1e3 << " ms after last samples (reconnect "
+                     << reconnect.count << ")." << std::endl;
+    }
+    reconnect.timestamp = timestamp;
+    reconnect.last_data = now;
+}
+
+void source_impl::start_recording(int first_file) {
+    std::lock_guard<std::mutex> lock(recorder_mutex);
+    for (size_t i = 0; i < streams.size(); i++) {
+        recording_info info;
+        info.serial = stored.serial;
+        info.channel = streams[i].channel;
+        info.samp_rate = stored.samp_rate;
+        info.rf_freq = stored.rf_freq[info.channel];
+        info.gain = stored.gain[info.channel];
+        // Store link samples as 16 bit integers, half the size of the converted cf32 stream
+        info.format = "ci16";
+        info.sample_size = 2 * sizeof(int16_t);
+        info.scale = (streams[i].stream.linkFmt == lms_stream_t::LMS_LINK_FMT_I16) ? 32767 : 2047;
+        info.sync = &device_handler::getInstance().get_time_sync(stored.device_number);
+        info.metadata = record_metadata;
+        info.buffers = buffers;
+        info.first_file = first_file;
+        // Buffer half a second of samples to ride out storage stalls
+        size_t buffer_size = (size_t)(stored.samp_rate / 2) * info.sample_size;
+        recorder[i].reset(new iq_recorder(record_filename, info, record_file_size, buffer_size));
+    }
+    recording = true;
+}
+
+void source_impl::stop_recording() {
+    std::lock_guard<std::mutex> lock(recorder_mutex);
+    recording = false;
+    for (std::unique_ptr<iq_recorder>& r : recorder)
+        r.reset();
+}
+
+void source_impl::update_recording() {
+    if (!recording)
+        return;
+    std::lock_guard<std::mutex> lock(recorder_mutex);
+    for (size_t i = 0; i < streams.size(); i++) {
+        int channel = streams[i].channel;
+        if (recorder[i])
+            recorder[i]->update_info(stored.rf_freq[channel], stored.gain[channel]);
+    }
+}
+
+void source_impl::record(
+    int channel, const void* data, int items, uint64_t timestamp, uint32_t dropped) {
+    std::lock_guard<std::mutex> lock(recorder_mutex);
+    if (recorder[channel])
+        recorder[channel]->write(data, items, timestamp, dropped);
+}
+
 } // namespace limesdr
 } // namespace gr
@@ -21,17 +21,41 @@
 #ifndef INCLUDED_LIMESDR_SOURCE_IMPL_H
 #define INCLUDED_LIMESDR_SOURCE_IMPL_H
 
+#include "common/agc.h"
+#include "common/buffer_alloc.h"
+#include "common/burst_trigger.h"
 #include "common/device_handler.h"
+#include "common/iq_correction.h"
+#include "common/recorder.h"
 #include <limesdr/source.h>
 
 
 static const pmt::pmt_t TIME_TAG = pmt::string_to_symbol("rx_time");
+static const pmt::pmt_t TRIGGER_TAG = pmt::string_to_symbol("rx_trigger");
+static const pmt::pmt_t BURST_LEN_TAG = pmt::string_to_symbol("burst_len");
+static const pmt::pmt_t CLIP_TAG = pmt::string_to_symbol("rx_clip");
+static const pmt::pmt_t GAIN_TAG = pmt::string_to_symbol("rx_gain");
+static const pmt::pmt_t RATE_TAG = pmt::string_to_symbol("rx_rate");
 
 namespace gr {
 namespace limesdr {
 class source_impl : public source {
     private:
-    lms_stream_t streamId[2];
+    // Stream of one output port, port i carries device channel streams[i].channel
+    struct channel_stream {
+        int channel;
+        lms_stream_t stream = {};
+        lms_stream_meta_t meta;
+        lms_stream_status_t status;
+        int received = 0;
+        // Triggered mode: samples received beyond other channels, kept at start of trigger buffer
+        int surplus = 0;
+        uint64_t surplus_timestamp = 0;
+        // Totals for device telemetry
+        std::shared_ptr<stream_counters> counters;
+        int counters_key = -1;
+    };
+    std::vector<channel_stream> streams;
 
     bool stream_analyzer = false;
 
@@ -39,6 +63,8 @@ class source_impl : public source {
 
     bool add_tag = false;
     uint32_t pktLoss = 0;
+    // Set when this block started device time synchronization
+    bool time_sync_owner = false;
 
     struct constant_data {
         std::string serial;
@@ -46,13 +72,115 @@ class source_impl : public source {
         int channel_mode;
         double samp_rate = 10e6;
         uint32_t FIFO_size = 0;
+        double rf_freq[2] = {0};
+        unsigned gain[2] = {0};
     } stored;
 
+    // Recorder of received buffers, one per channel
+    std::string record_filename;
+    uint64_t record_file_size = 0;
+    int record_metadata = RECORDING_META_PLAIN;
+    std::vector<std::unique_ptr<iq_recorder>> recorder;
+    std::atomic<bool> recording{false};
+    std::mutex recorder_mutex;
+
+    void start_recording(int first_file = 0);
+    void stop_recording();
+    void update_recording();
+    void record(int channel, const void* data, int items, uint64_t timestamp, uint32_t dropped);
+
+    // Triggered capture, only pre + post samples around trigger points are produced
+    std::unique_ptr<burst_trigger> trigger;
+    std::mutex trigger_mutex;
+    std::vector<buffer_vector<gr_complex>> trigger_buffer;
+    std::vector<gr_complex*> trigger_in;
+    std::vector<gr_complex*> trigger_out;
+    std::vector<trigger_capture> trigger_captures;
+
+    int triggered_work(int noutput_items, gr_vector_void_star& output_items);
+    void trigger_message(pmt::pmt_t msg);
+
+    // Overload detector, per-channel level statistics published on "stats" port
+    struct overload_settings {
+        bool enabled = false;
+        float clip_level = 0.95;
+        double interval = 1;
+    } overload;
+    struct level_stats {
+        float peak = 0;
+        double power_sum = 0;
+        uint64_t samples = 0;
+        uint64_t clipped = 0;
+    };
+    std::vector<level_stats> levels;
+    std::chrono::steady_clock::time_point levels_time;
+
+    // Native AGC, one control loop per channel
+    bool agc_enabled = false;
+    agc_settings agc_config;
+    std::vector<std::unique_ptr<rx_agc>> agc;
+    std::mutex agc_mutex;
+
+    void start_agc();
+    void stop_agc();
+
+    // Host DC offset and IQ imbalance correction, one corrector per channel
+    bool iq_correction_enabled = false;
+    double iq_time_constant = 0.1;
+    std::vector<std::unique_ptr<iq_corrector>> iq_correction;
+    std::mutex iq_mutex;
+
+    void correct_buffer(int channel, gr_complex* data, int items);
+
+    // Device health telemetry published on "telemetry" port
+    int telemetry_key = -1;
+
+    void measure_levels(
+        int channel, const gr_complex* data, int items, uint64_t timestamp, bool tag);
+    void publish_levels();
+
+    // Sample rate change while streaming, applied by work thread between buffers
+    std::atomic<bool> rate_change{false};
+    double rate_pending = 0;
+    bool rate_tag = false;
+    stream_clock clock;
+
+    void change_rate();
+
+    // Reattach to the device serial after it was unplugged, handled by work thread
+    struct reconnect_state {
+        bool enabled = false;
+        double timeout = 1;
+        // Device generation streams are set up on and handle they are set up on
+        uint64_t generation = 0;
+        lms_device_t* stream_device = NULL;
+        // Streams released, waiting for device to reappear
+        bool lost = false;
+        bool agc_running = false;
+        int next_file = -1;
+        // Last received buffer, device time and host time right after it
+        uint64_t timestamp = 0;
+        std::chrono::steady_clock::time_point last_data;
+        uint64_t count = 0;
+    } reconnect;
+
+    void check_connection();
+    void data_received(uint64_t timestamp);
+
+    // Placement of sample buffers
+    buffer_policy buffers;
+
+    // Nesting depth of begin_config/commit, changes inside are tagged once at commit
+    int config_depth = 0;
+    void config_changed();
+    void command_message(pmt::pmt_t msg);
+
     std::chrono::high_resolution_clock::time_point t1, t2;
 
     void print_stream_stats(lms_stream_status_t status);
+    void read_status(size_t port);
 
-    void add_time_tag(int channel, lms_stream_meta_t meta);
+    void add_time_tag(int channel, uint64_t timestamp, uint64_t offset);
 
     public:
     source_impl(std::string serial, int channel_mode, const std::string& filename);
@@ -69,11 +197,15 @@ class source_impl : public source {
 
     inline gr::io_signature::sptr args_to_io_signature(int channel_mode);
 
-    void init_stream(int device_number, int channel);
+    void init_stream(int device_number, channel_stream& s);
     void release_stream(int device_number, lms_stream_t *stream);
 
     double set_center_freq(double freq, size_t chan = 0);
 
+    void warm_up_tuning(const std::vector<double>& freqs);
+
+    void benchmark_tuning(const std::vector<double>& freqs, int rounds = 10);
+
     void set_antenna(int antenna, int channel = 0);
 
     void set_nco(float nco_freq, int channel = 0);
@@ -82,17 +214,54 @@ class source_impl : public source {
 
     void set_digital_filter(double digital_bandw, int channel = 0);
 
+    void set_gfir_taps(int filter, const std::vector<double>& taps, int channel = 0);
+
+    void set_gfir_lowpass(int filter,
+                          double passband,
+                          double stopband,
+                          double ripple = 0.1,
+                          double attenuation = 60,
+                          int channel = 0);
+
     unsigned set_gain(unsigned gain_dB, int channel = 0);
 
     double set_sample_rate(double rate);
 
     void set_oversampling(int oversample);
 
+    void set_rate_plan(double bandwidth, double attenuation = 60);
+
     void set_buffer_size(uint32_t size);
 
     void calibrate(double bandw, int channel = 0);
     
     void set_tcxo_dac(uint16_t dacVal = 125);
+
+    void set_time_source(int source, double param = 0);
+
+    void set_buffer_policy(bool hugepages, int numa_node = -1);
+
+    void set_recording(const std::string& filename, uint64_t file_size = 0, int metadata = 0);
+
+    void set_trigger(int pre, int post, double threshold = 1);
+
+    void set_overload_detector(bool enable, double clip_level = 0.95, double interval = 1);
+
+    void begin_config();
+
+    void commit();
+
+    void set_agc(bool enable,
+                 double target = -20,
+                 double attack = 0.001,
+                 double decay = 0.1,
+                 double hysteresis = 3);
+
+    void set_iq_correction(bool enable, double time_constant = 0.1);
+
+    void set_telemetry(double interval);
+
+    void set_auto_reconnect(bool enable, double timeout = 1);
 };
 } // namespace limesdr
 } // namespace gr
@@ -23,4 +23,5 @@ GR_SWIG_BLOCK_MAGIC2(limesdr, sink);
 #include "limesdr/rfe.h"
 %}
 %include "limesdr/rfe.h"
+GR_SWIG_BLOCK_MAGIC2(limesdr, rfe);
 #endif